@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <cstring>
+#include "Arena.h"
+
+// every allocation starts at a multiple of this
+static const size_t ALIGNMENT = alignof(std::max_align_t);
+
+Arena::Arena() : current(0), used(0) {
+}
+
+Arena::~Arena() {
+    for (size_t i = 0; i < blocks.size(); i++) delete[] blocks[i];
+}
+
+void *Arena::allocate(size_t size) {
+    size = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+
+    // move on to the next block that has room. the blocks behind the
+    // current one are empty, since they were kept by reset()
+    while (current < blocks.size() && used + size > sizes[current]) {
+        current++;
+        used = 0;
+    }
+    if (current == blocks.size()) {
+        size_t blockSize = size > BLOCK_SIZE ? size : BLOCK_SIZE;
+        blocks.push_back(new char[blockSize]);
+        sizes.push_back(blockSize);
+        used = 0;
+    }
+    void *p = blocks[current] + used;
+    used += size;
+    return p;
+}
+
+char *Arena::copy(const char *s, size_t length) {
+    char *p = (char *) allocate(length + 1);
+    memcpy(p, s, length);
+    p[length] = 0;
+    return p;
+}
+
+void Arena::reset() {
+    current = 0;
+    used = 0;
+}
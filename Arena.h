@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <new>
+#include <vector>
+#include <type_traits>
+
+/**
+ * Memory for the objects of one statement. allocate() hands out the next
+ * bytes of a block, and reset() takes all of them back at once, so nothing
+ * is freed one by one. The blocks are kept for the next statement, so a
+ * session that runs short statements stops calling malloc after the first.
+ * Objects in the arena are never destructed.
+ */
+class Arena {
+public:
+
+    // # bytes in a block. a larger allocation gets a block of its own
+    static const size_t BLOCK_SIZE = 4096;
+
+    Arena();
+
+    ~Arena();
+
+    /**
+     * @param size[IN] # bytes to allocate
+     * @return memory for size bytes, aligned for any type. valid until reset()
+     */
+    void *allocate(size_t size);
+
+    /**
+     * @param s[IN] the characters to copy. need not be NUL-terminated
+     * @param length[IN] # characters to copy
+     * @return a NUL-terminated copy of the characters
+     */
+    char *copy(const char *s, size_t length);
+
+    /**
+     * @return a default-constructed T in the arena
+     */
+    template<class T> T *create() {
+        static_assert(std::is_trivially_destructible<T>::value, "objects in the arena are never destructed");
+        return new (allocate(sizeof(T))) T();
+    }
+
+    /**
+     * take back all memory handed out so far.
+     */
+    void reset();
+
+private:
+    std::vector<char *> blocks;   // the blocks, in the order they are filled
+    std::vector<size_t> sizes;    // the size of every block
+    size_t current;               // the block allocate() takes from
+    size_t used;                  // # bytes handed out from the current block
+
+    // not copyable, the blocks belong to one arena
+    Arena(const Arena &);
+    Arena &operator=(const Arena &);
+};
+
+#endif /* ARENA_H */
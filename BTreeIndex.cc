@@ -9,16 +9,68 @@
 
 #include <iostream>
 #include <vector>
+#include <cstring>
+#include <thread>
 #include "BTreeIndex.h"
 
 using namespace std;
 
+//
+// helpers for the version latches
+//
+
+// wait until no writer holds the latch and return its version
+static uint64_t readLatch(const atomic<uint64_t> &latch);
+
+// true if the latch still has the version, i.e., the node has not changed since
+static bool validate(const atomic<uint64_t> &latch, uint64_t version);
+
+// wait for the latch and take it
+static void writeLatch(atomic<uint64_t> &latch);
+
+// release the latch. changed is true if the keys or the child pointers of the node changed
+static void writeUnlatch(atomic<uint64_t> &latch, bool changed);
+
+/**
+ * The leaf node readForward() and readBackward() of a thread read last, so
+ * that a scan decodes every leaf node once instead of once per entry.
+ * A thread has a few of them, so that a join can scan two indexes at once.
+ */
+struct ScanMemo {
+    long long generation;   // the index the leaf node belongs to
+    uint64_t version;       // the version of the leaf node when it was read
+    BTLeafNode *leaf;
+    ScanMemo(): generation(-1), version(0), leaf(NULL) { };
+    ~ScanMemo() { delete leaf; }
+};
+
+static const int SCAN_MEMOS = 4;
+static thread_local ScanMemo scanMemos[SCAN_MEMOS];
+
+/**
+ * The leaf node insert() of a thread wrote last. Keys inserted in increasing
+ * order all go to the rightmost leaf node, so the thread appends to the
+ * node it holds instead of reading and decoding the page for every key.
+ */
+static thread_local ScanMemo insertMemo;
+
+static atomic<long long> generations(0);
+
 /**
  * BTreeIndex constructor
  */
-BTreeIndex::BTreeIndex() {
+BTreeIndex::BTreeIndex() : metaLatch(0) {
     rootPid = -1;
     treeHeight = 0;
+    packedLeaves = false;
+    generation = ++generations;
+    bulkLeaf = NULL;
+    for (int i = 0; i < MAX_LATCH_CHUNKS; i++) latchChunks[i] = NULL;
+}
+
+BTreeIndex::~BTreeIndex() {
+    delete bulkLeaf;
+    for (int i = 0; i < MAX_LATCH_CHUNKS; i++) delete[] latchChunks[i].load();
 }
 
 /**
@@ -33,7 +85,14 @@ RC BTreeIndex::open(const string &indexname, char mode) {
     if ((rc = pf.open(indexname, mode)) < 0) {
         return rc;
     }
+    // the pages may hold another index now
+    generation = ++generations;
     if (pf.endPid() == 0) {
+        // a file no LOAD has committed to has no index to read yet
+        if (mode == 'r') {
+            pf.close();
+            return RC_INVALID_FILE_FORMAT;
+        }
         // new index file
         writeBTreeMeta();
     } else {
@@ -51,6 +110,7 @@ RC BTreeIndex::readBTreeMeta() {
     int rc = pf.read(0, metaPage);
     rootPid = ((int *) metaPage)[0];
     treeHeight = ((int *) metaPage)[1];
+    packedLeaves = ((int *) metaPage)[2] == BT_PACKED_LEAF;
     if (INFO) {
         cout << "loading: rootPid " << rootPid << endl;
         cout << "loading: read treeHeight " << treeHeight << endl;
@@ -63,11 +123,22 @@ RC BTreeIndex::readBTreeMeta() {
  * @return error code. 0 if no error
  */
 RC BTreeIndex::close() {
+    generation = ++generations;
     return pf.close();
 }
 
-RC BTreeIndex::createNonLeafRoot(BTNonLeafNode &root, PageId pid1, int key, PageId pid2) {
-    root.initializeRoot(pid1, key, pid2);
+/**
+ * Write the leaf nodes in the packed layout from now on.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::setPackedLeaves() {
+    if (packedLeaves) return 0;
+    packedLeaves = true;
+    return writeBTreeMeta();
+}
+
+RC BTreeIndex::createNonLeafRoot(BTNonLeafNode &root, PageId pid1, int count1, int key, PageId pid2, int count2) {
+    root.initializeRoot(pid1, count1, key, pid2, count2);
     writeBTreeMeta(root.getPageId(), treeHeight + 1);
     return 0;
 }
@@ -79,8 +150,10 @@ RC BTreeIndex::writeBTreeMeta() {
         cout << "writing: treeHeight " << treeHeight << endl;
     }
     char metaPage[PageFile::PAGE_SIZE];
+    memset(metaPage, 0, PageFile::PAGE_SIZE);
     ((int *) metaPage)[0] = rootPid;
     ((int *) metaPage)[1] = treeHeight;
+    ((int *) metaPage)[2] = packedLeaves ? BT_PACKED_LEAF : 0;
     return pf.write(0, metaPage);
 }
 
@@ -90,17 +163,6 @@ RC BTreeIndex::writeBTreeMeta(PageId rootPid, int treeHeight) {
     return writeBTreeMeta();
 }
 
-RC BTreeIndex::getLeafNodeToInsert(int key, PageId &pid, vector<PageId> &path) {
-    pid = rootPid;
-    int level = 1;
-    while (level++ < treeHeight) {
-        BTNonLeafNode nonLeafNode(pid, pf);
-        path.push_back(pid);
-        nonLeafNode.locateChildPtr(key, pid);
-    }
-    return 0;
-}
-
 /**
  * Insert (key, RecordId) pair to the index.
  * @param key[IN] the key for the value inserted into the index
@@ -109,66 +171,183 @@ RC BTreeIndex::getLeafNodeToInsert(int key, PageId &pid, vector<PageId> &path) {
  */
 RC BTreeIndex::insert(int key, const RecordId &rid) {
     int rc = 0;
+
+    // the latched non-leaf nodes above the leaf, from the top. the new entry
+    // is counted in every non-leaf node on the way down. a node with room for
+    // one more entry releases the latches above it, since a split below
+    // cannot reach them, and they keep their version, since only counts changed
     vector<PageId> path;
+    bool metaLatched = true;
+    auto unlatchPath = [&]() {
+        while (!path.empty()) {
+            writeUnlatch(latch(path.back()), false);
+            path.pop_back();
+        }
+        if (metaLatched) writeUnlatch(metaLatch, false);
+        metaLatched = false;
+    };
+    writeLatch(metaLatch);
     if (rootPid == -1) {             // Tree is empty
-        BTLeafNode root(pf);
+        BTLeafNode root(pf, packedLeaves);
         root.insert(key, rid);
         writeBTreeMeta(root.getPageId(), 1);
-    } else {
-        PageId pid;
-        getLeafNodeToInsert(key, pid, path);
+        writeUnlatch(metaLatch, true);
+        return rc;
+    }
 
-        BTLeafNode leafToInsert(pid, pf);
-        if ((rc = leafToInsert.insert(key, rid)) == RC_NODE_FULL) {
+    PageId pid = rootPid;
+    for (int level = 1; level < treeHeight; level++) {
+        writeLatch(latch(pid));
+        BTNonLeafNode nonLeafNode(pid, pf);
+        if (!nonLeafNode.isFull()) unlatchPath();
+        path.push_back(pid);
+        int idx;
+        nonLeafNode.locateChildPtr(key, pid, idx);
+        // the new entry always ends up under this child,
+        // even if the child is split on the way back up
+        nonLeafNode.adjustCount(idx, 1);
+    }
 
-            if (DEBUG) cout << "Leaf node " << leafToInsert.getPageId() << " is full!" << endl;
+    writeLatch(latch(pid));
+    BTLeafNode &leafToInsert = getInsertLeaf(pid);
+    if (packedLeaves) leafToInsert.setPacked(true);
+    if ((rc = leafToInsert.insert(key, rid)) != RC_NODE_FULL) {
+        unlatchPath();
+        // the version the leaf node has once this thread unlatches it
+        insertMemo.version = latch(pid).load(memory_order_relaxed) + 1;
+        writeUnlatch(latch(pid), true);
+        if (DEBUG) leafToInsert.printNode();
+        return rc;
+    }
 
-            BTLeafNode leafSib(pf);
-            int leafSibKey;
-            leafToInsert.insertAndSplit(key, rid, leafSib, leafSibKey);
+    if (DEBUG) cout << "Leaf node " << leafToInsert.getPageId() << " is full!" << endl;
 
-            if (DEBUG) {
-                cout << endl << "After split: " << endl;
-                leafToInsert.printNode();
-                cout << "-------------" << endl;
-                leafSib.printNode();
-            }
+    // the split changes the prev pointer of the leaf node behind, too
+    PageId next = leafToInsert.getNextNodePtr();
+    if (next >= 0) writeLatch(latch(next));
 
-            PageId childPid = leafSib.getPageId();
-            int childKey = leafSibKey;
-            PageId parentID = leafToInsert.getPageId();
-            while (!path.empty()) {
-                parentID = path.back();
-                path.pop_back();
-                BTNonLeafNode parent(parentID, pf);
-                if ((rc = parent.insert(childKey, childPid)) == 0) {
-                    if (DEBUG) parent.printNode();
-                    return rc;
-                }
-                BTNonLeafNode nonLeafSib(pf);
-                int nonLeafSibKey;
-                parent.insertAndSplit(childKey, childPid, nonLeafSib, nonLeafSibKey);
-
-                if (DEBUG) {
-                    cout << endl << "After split of " << parentID << ": " << endl;
-                    cout << "------ Left -------" << endl;
-                    parent.printNode();
-                    cout << "------ Right -------" << endl;
-                    nonLeafSib.printNode();
-                    cout << "-------------------" << endl;
-
-                }
-
-                childKey = nonLeafSibKey;
-                childPid = nonLeafSib.getPageId();
-            }
-            BTNonLeafNode newRoot(pf);
-            createNonLeafRoot(newRoot, parentID, childKey, childPid);
-            if (DEBUG) newRoot.printNode();
+    BTLeafNode leafSib(pf, packedLeaves);
+    int leafSibKey;
+    leafToInsert.insertAndSplit(key, rid, leafSib, leafSibKey);
+    if (next >= 0) writeUnlatch(latch(next), true);
+    writeUnlatch(latch(pid), true);
+
+    if (DEBUG) {
+        cout << endl << "After split: " << endl;
+        leafToInsert.printNode();
+        cout << "-------------" << endl;
+        leafSib.printNode();
+    }
 
+    PageId childPid = leafSib.getPageId();
+    int childKey = leafSibKey;
+    int childCount = leafSib.getKeyCount();
+    PageId parentID = leafToInsert.getPageId();
+    int parentCount = leafToInsert.getKeyCount();
+    // the memo is no longer the leaf node the next key goes to
+    insertMemo.generation = -1;
+    rc = 0;
+    while (!path.empty()) {
+        parentID = path.back();
+        path.pop_back();
+        BTNonLeafNode parent(parentID, pf);
+        if ((rc = parent.insert(childKey, childPid, childCount)) == 0) {
+            if (DEBUG) parent.printNode();
+            writeUnlatch(latch(parentID), true);
+            // the nodes above took the count only
+            unlatchPath();
+            return rc;
         }
-        if (DEBUG) leafToInsert.printNode();
+        BTNonLeafNode nonLeafSib(pf);
+        int nonLeafSibKey;
+        parent.insertAndSplit(childKey, childPid, childCount, nonLeafSib, nonLeafSibKey);
+        writeUnlatch(latch(parentID), true);
+
+        if (DEBUG) {
+            cout << endl << "After split of " << parentID << ": " << endl;
+            cout << "------ Left -------" << endl;
+            parent.printNode();
+            cout << "------ Right -------" << endl;
+            nonLeafSib.printNode();
+            cout << "-------------------" << endl;
+
+        }
+
+        childKey = nonLeafSibKey;
+        childPid = nonLeafSib.getPageId();
+        childCount = nonLeafSib.getEntryCount();
+        parentCount = parent.getEntryCount();
     }
+
+    // every node on the path split, so the meta latch is still held
+    BTNonLeafNode newRoot(pf);
+    createNonLeafRoot(newRoot, parentID, parentCount, childKey, childPid, childCount);
+    if (DEBUG) newRoot.printNode();
+    writeUnlatch(metaLatch, true);
+    return rc;
+}
+
+RC BTreeIndex::bulkInsert(int key, const RecordId &rid) {
+    RC rc;
+    if (bulkLeaf == NULL) {
+        if (rootPid != -1) return RC_INVALID_FILE_FORMAT;
+        bulkLeaf = new BTLeafNode(pf, packedLeaves);
+    }
+    if ((rc = bulkLeaf->insert(key, rid)) != RC_NODE_FULL) return rc;
+
+    // the leaf node is full. the pair starts the next one
+    BTLeafNode *next = new BTLeafNode(pf, packedLeaves);
+    next->setPrevNodePtr(bulkLeaf->getPageId());
+    bulkLeaf->setNextNodePtr(next->getPageId());
+    rc = bulkLeaf->write();
+    BulkChild child = { bulkLeaf->getKeyByEid(0), bulkLeaf->getPageId(), bulkLeaf->getKeyCount() };
+    bulkChildren.push_back(child);
+    delete bulkLeaf;
+    bulkLeaf = next;
+    if (rc < 0) return rc;
+    return bulkLeaf->insert(key, rid);
+}
+
+RC BTreeIndex::bulkFinish() {
+    RC rc;
+    if (bulkLeaf == NULL) return 0;
+    BulkChild last = { bulkLeaf->getKeyByEid(0), bulkLeaf->getPageId(), bulkLeaf->getKeyCount() };
+    bulkChildren.push_back(last);
+    delete bulkLeaf;
+    bulkLeaf = NULL;
+
+    // every level spreads the nodes below evenly over as few full nodes as
+    // it takes, so that no node has fewer than two children
+    vector<BulkChild> children;
+    children.swap(bulkChildren);
+    int height = 1;
+    while (children.size() > 1) {
+        int n = (int) children.size();
+        int nodes = (n + BT_MAX_NONLEAF_KEY) / (BT_MAX_NONLEAF_KEY + 1);
+        vector<BulkChild> parents;
+        for (int j = 0; j < nodes; j++) {
+            int begin = (int) ((long long) n * j / nodes), end = (int) ((long long) n * (j + 1) / nodes);
+            int keys[BT_MAX_NONLEAF_KEY + 1], counts[BT_MAX_NONLEAF_KEY + 1];
+            PageId pids[BT_MAX_NONLEAF_KEY + 1];
+            BulkChild parent = { children[begin].key, -1, 0 };
+            for (int i = begin; i < end; i++) {
+                if (i > begin) keys[i - begin - 1] = children[i].key;
+                pids[i - begin] = children[i].pid;
+                counts[i - begin] = children[i].count;
+                parent.count += children[i].count;
+            }
+            BTNonLeafNode node(pf);
+            if ((rc = node.initialize(keys, pids, counts, end - begin)) < 0) return rc;
+            parent.pid = node.getPageId();
+            parents.push_back(parent);
+        }
+        children.swap(parents);
+        height++;
+    }
+
+    writeLatch(metaLatch);
+    rc = writeBTreeMeta(children[0].pid, height);
+    writeUnlatch(metaLatch, true);
     return rc;
 }
 
@@ -192,19 +371,119 @@ RC BTreeIndex::insert(int key, const RecordId &rid) {
  */
 RC BTreeIndex::locate(int searchKey, IndexCursor &cursor) {
     int rc = 0;
-    int pid = rootPid;
+    PageId pid;
+    int before;
+    uint64_t version;
+    // an empty tree leaves a cursor that readForward() ends at
+    cursor.pid = -1;
+    cursor.eid = 0;
     if (rootPid <= 0)
         return RC_NO_SUCH_RECORD;
-    for (int level = 1; level < treeHeight; level++) {
-        BTNonLeafNode current(pid, pf);
-        current.locateChildPtr(searchKey, pid);
-    }
-    BTLeafNode leaf(pid, pf);
-    int eid = 0;
-    rc = leaf.locate(searchKey, eid);
-    cursor.eid = eid;
-    cursor.pid = pid;
-    return rc;
+    for (;;) {
+        // descend to the first entry that is not smaller than searchKey,
+        // so that every duplicate of searchKey is behind the cursor
+        descend(searchKey, false, pid, before, version);
+        BTLeafNode leaf(pid, pf);
+        PageId leafPid = pid;
+        int eid = leaf.countKeysBefore(searchKey, false);
+        if (eid >= leaf.getKeyCount() && leaf.getNextNodePtr() >= 0) {
+            // every key in this leaf is smaller. the entry is the first one of the next leaf
+            pid = leaf.getNextNodePtr();
+            eid = 0;
+            leaf.read(pid, pf);
+        }
+        // a split of the leaf node may have moved the entry
+        if (!validate(latch(leafPid), version)) continue;
+        rc = (eid < leaf.getKeyCount() && leaf.getKeyByEid(eid) == searchKey) ? 0 : RC_NO_SUCH_RECORD;
+        cursor.eid = eid;
+        cursor.pid = pid;
+        return rc;
+    }
+}
+
+void BTreeIndex::descend(int searchKey, bool inclusive, PageId &pid, int &before, uint64_t &version) {
+    for (;;) {
+        // the meta latch is the parent of the root
+        const atomic<uint64_t> *parent = &metaLatch;
+        uint64_t parentVersion = readLatch(metaLatch);
+        pid = rootPid;
+        int height = treeHeight;
+        before = 0;
+        int level;
+        for (level = 1; level <= height; level++) {
+            version = readLatch(latch(pid));
+            // the parent still points here, unless it changed
+            if (!validate(*parent, parentVersion)) break;
+            if (level == height) return;
+            BTNonLeafNode current(pid, pf);
+            int n;
+            PageId child;
+            current.locateChildPtrByKey(searchKey, inclusive, child, n);
+            before += n;
+            parent = &latch(pid);
+            parentVersion = version;
+            pid = child;
+        }
+        this_thread::yield();
+    }
+}
+
+atomic<uint64_t> &BTreeIndex::latch(PageId pid) {
+    atomic<atomic<uint64_t> *> &slot = latchChunks[(pid / LATCH_CHUNK) % MAX_LATCH_CHUNKS];
+    atomic<uint64_t> *chunk = slot.load(memory_order_acquire);
+    if (chunk == NULL) {
+        // the first thread to get here installs the chunk
+        atomic<uint64_t> *fresh = new atomic<uint64_t>[LATCH_CHUNK];
+        for (int i = 0; i < LATCH_CHUNK; i++) fresh[i] = 0;
+        if (slot.compare_exchange_strong(chunk, fresh)) {
+            chunk = fresh;
+        } else {
+            delete[] fresh;
+        }
+    }
+    return chunk[pid % LATCH_CHUNK];
+}
+
+/**
+ * Move the cursor to the first index entry whose key is not
+ * smaller than searchKey, like locate(). When the entry is in the
+ * leaf node of the cursor or in the one after it, the cursor is moved
+ * within the leaf chain instead of searching down from the root.
+ * @param searchKey[IN] the key to find
+ * @param cursor[IN/OUT] the cursor to move. pid is -1 if it points nowhere yet
+ * @return 0 if searchKey is found. Othewise an error code
+ */
+RC BTreeIndex::relocate(int searchKey, IndexCursor &cursor) {
+    if (cursor.pid < 0) return locate(searchKey, cursor);
+    BTLeafNode leaf(cursor.pid, pf);
+    int n = leaf.getKeyCount();
+    if (n > 0 && leaf.getKeyByEid(n - 1) < searchKey) {
+        // the entry is behind this leaf. try the next one
+        PageId next = leaf.getNextNodePtr();
+        if (next < 0) return locate(searchKey, cursor);
+        leaf.read(next, pf);
+        cursor.pid = next;
+        n = leaf.getKeyCount();
+        if (n > 0 && leaf.getKeyByEid(0) >= searchKey) {
+            cursor.eid = 0;
+            return leaf.getKeyByEid(0) == searchKey ? 0 : RC_NO_SUCH_RECORD;
+        }
+    }
+    if (n > 0 && leaf.getKeyByEid(0) >= searchKey) {
+        // the entry is the first one of this leaf if every key in the leaf in front is smaller
+        PageId prev = leaf.getPrevNodePtr();
+        if (prev >= 0) {
+            BTLeafNode front(prev, pf);
+            if (front.getKeyByEid(front.getKeyCount() - 1) >= searchKey) return locate(searchKey, cursor);
+        }
+        cursor.eid = 0;
+        return leaf.getKeyByEid(0) == searchKey ? 0 : RC_NO_SUCH_RECORD;
+    }
+    if (n == 0 || leaf.getKeyByEid(n - 1) < searchKey) {
+        return locate(searchKey, cursor);
+    }
+    cursor.eid = leaf.countKeysBefore(searchKey, false);
+    return leaf.getKeyByEid(cursor.eid) == searchKey ? 0 : RC_NO_SUCH_RECORD;
 }
 
 /**
@@ -216,11 +495,231 @@ RC BTreeIndex::locate(int searchKey, IndexCursor &cursor) {
  * @return error code. 0 if no error
  */
 RC BTreeIndex::readForward(IndexCursor &cursor, int &key, RecordId &rid) {
+    if(cursor.pid < 0) return RC_END_OF_TREE;
+    BTLeafNode *leaf = &getScanLeaf(cursor.pid);
+    if(cursor.eid >= leaf->getKeyCount()) {
+        // locate() leaves the cursor behind the last entry when all keys
+        // in the leaf are smaller than searchKey
+        cursor.pid = leaf->getNextNodePtr();
+        cursor.eid = 0;
+        if(cursor.pid < 0) return RC_END_OF_TREE;
+        leaf = &getScanLeaf(cursor.pid);
+    }
+    key = leaf->getKeyByEid(cursor.eid);
+    rid = leaf->getRidByEid(cursor.eid);
+    return leaf->forward(cursor.pid, cursor.eid);
+}
+
+
+
+BTLeafNode &BTreeIndex::getInsertLeaf(PageId pid) {
+    ScanMemo &memo = insertMemo;
+    if (memo.generation != generation) {
+        delete memo.leaf;
+        memo.leaf = NULL;
+        memo.generation = generation;
+    }
+    // the thread holds the latch, so the version is one up from when the memo was written
+    if (memo.leaf != NULL && memo.leaf->getPageId() == pid &&
+        latch(pid).load(memory_order_relaxed) == memo.version + 1) return *memo.leaf;
+    if (memo.leaf == NULL) memo.leaf = new BTLeafNode(pid, pf);
+    else memo.leaf->read(pid, pf);
+    return *memo.leaf;
+}
+
+BTLeafNode &BTreeIndex::getScanLeaf(PageId pid) {
+    ScanMemo &memo = scanMemos[generation % SCAN_MEMOS];
+    if (memo.generation != generation) {
+        // the memo holds a leaf node of another index, with a reference to its page file
+        delete memo.leaf;
+        memo.leaf = NULL;
+        memo.generation = generation;
+    }
+    // an insert by any thread moves the version of the leaf node
+    if (memo.leaf != NULL && memo.leaf->getPageId() == pid && validate(latch(pid), memo.version)) return *memo.leaf;
+    memo.version = readLatch(latch(pid));
+    if (memo.leaf == NULL) memo.leaf = new BTLeafNode(pid, pf);
+    else memo.leaf->read(pid, pf);
+    return *memo.leaf;
+}
+
+/**
+ * Read the (key, rid) pairs from the cursor location to the end of its
+ * leaf node in one go, and move the cursor to the next leaf node.
+ * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
+ * @param keys[OUT] the keys read. must have room for BT_MAX_PACKED_KEY keys
+ * @param rids[OUT] the RecordIds read. ignored if NULL
+ * @param n[OUT] the number of pairs read
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::readLeaf(IndexCursor &cursor, int keys[], RecordId rids[], int &n) {
+    n = 0;
     if(cursor.pid < 0) return RC_END_OF_TREE;
     BTLeafNode leaf(cursor.pid, pf);
+    n = leaf.readEntries(cursor.eid, keys, rids);
+    cursor.pid = leaf.getNextNodePtr();
+    cursor.eid = 0;
+    return 0;
+}
+
+/**
+ * Set the cursor to the last index entry whose key is smaller than
+ * or equal to searchKey, so that readBackward() can walk the index
+ * in descending key order from there.
+ * @param searchKey[IN] the largest key to return
+ * @param cursor[OUT] the cursor pointing to the entry
+ * @return 0 if such an entry exists. Otherwise RC_END_OF_TREE
+ */
+RC BTreeIndex::locateLast(int searchKey, IndexCursor &cursor) {
+    PageId pid;
+    int before;
+    uint64_t version;
+    cursor.pid = -1;
+    cursor.eid = 0;
+    if (rootPid <= 0)
+        return RC_END_OF_TREE;
+    for (;;) {
+        descend(searchKey, true, pid, before, version);
+        BTLeafNode leaf(pid, pf);
+        if (!validate(latch(pid), version)) continue;
+        cursor.pid = pid;
+        cursor.eid = leaf.countKeysBefore(searchKey, true) - 1;
+        if (cursor.eid < 0) {
+            // every key in this leaf is larger. the entry is the last one of the previous leaf
+            cursor.pid = leaf.getPrevNodePtr();
+        }
+        return cursor.pid < 0 ? RC_END_OF_TREE : 0;
+    }
+}
+
+/**
+ * Read the (key, rid) pair at the location specified by the index cursor,
+ * and move back the cursor to the previous entry.
+ * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
+ * @param key[OUT] the key stored at the index cursor location.
+ * @param rid[OUT] the RecordId stored at the index cursor location.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::readBackward(IndexCursor &cursor, int &key, RecordId &rid) {
+    if(cursor.pid < 0) return RC_END_OF_TREE;
+    BTLeafNode &leaf = getScanLeaf(cursor.pid);
+    if(cursor.eid < 0) cursor.eid = leaf.getKeyCount() - 1;
     key = leaf.getKeyByEid(cursor.eid);
     rid = leaf.getRidByEid(cursor.eid);
-    return leaf.forward(cursor.pid, cursor.eid);
+    return leaf.backward(cursor.pid, cursor.eid);
 }
 
+/**
+ * Count the index entries whose key is in [minKey, maxKey].
+ * Only the two root-to-leaf paths of the range boundaries are read,
+ * using the entry counts kept in the non-leaf nodes.
+ * @param minKey[IN] the smallest key to count
+ * @param maxKey[IN] the largest key to count
+ * @param count[OUT] the number of entries in the range
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::count(int minKey, int maxKey, int &count) {
+    int rc = 0;
+    int low, high;
+    count = 0;
+    if (minKey > maxKey) return 0;
+    if ((rc = rank(maxKey, true, high)) < 0) return rc;
+    if ((rc = rank(minKey, false, low)) < 0) return rc;
+    count = high - low;
+    return 0;
+}
 
+/**
+ * Set the cursor to the rank'th (0-based) entry of the index in key order.
+ * @param rank[IN] the position of the entry to locate
+ * @param cursor[OUT] the cursor pointing to the entry
+ * @return 0 if found. RC_END_OF_TREE if the index has no more than rank entries
+ */
+RC BTreeIndex::locateByRank(int rank, IndexCursor &cursor) {
+    cursor.pid = -1;
+    cursor.eid = 0;
+    if (rootPid <= 0 || rank < 0)
+        return RC_END_OF_TREE;
+    for (;;) {
+        // descend like descend(), by rank instead of by key
+        const atomic<uint64_t> *parent = &metaLatch;
+        uint64_t parentVersion = readLatch(metaLatch);
+        PageId pid = rootPid;
+        int height = treeHeight;
+        int left = rank;
+        uint64_t version = 0;
+        bool valid = true;
+        for (int level = 1; level < height && valid; level++) {
+            version = readLatch(latch(pid));
+            if (!(valid = validate(*parent, parentVersion))) break;
+            BTNonLeafNode current(pid, pf);
+            PageId child;
+            if (current.locateChildPtrByRank(left, child) < 0) {
+                if (validate(latch(pid), version)) return RC_END_OF_TREE;
+                valid = false;
+                break;
+            }
+            parent = &latch(pid);
+            parentVersion = version;
+            pid = child;
+        }
+        if (valid) {
+            version = readLatch(latch(pid));
+            valid = validate(*parent, parentVersion);
+        }
+        if (!valid) {
+            this_thread::yield();
+            continue;
+        }
+        BTLeafNode leaf(pid, pf);
+        if (!validate(latch(pid), version)) continue;
+        if (left >= leaf.getKeyCount()) return RC_END_OF_TREE;
+        cursor.pid = pid;
+        cursor.eid = left;
+        return 0;
+    }
+}
+
+/**
+ * Compute the number of entries whose key is smaller than searchKey
+ * (or smaller than or equal to searchKey if inclusive is set).
+ */
+RC BTreeIndex::rank(int searchKey, bool inclusive, int &rank) {
+    PageId pid;
+    int before;
+    uint64_t version;
+    rank = 0;
+    if (rootPid <= 0)
+        return 0;
+    for (;;) {
+        descend(searchKey, inclusive, pid, before, version);
+        BTLeafNode leaf(pid, pf);
+        if (!validate(latch(pid), version)) continue;
+        rank = before + leaf.countKeysBefore(searchKey, inclusive);
+        return 0;
+    }
+}
+
+static uint64_t readLatch(const atomic<uint64_t> &latch) {
+    uint64_t version;
+    while ((version = latch.load(memory_order_acquire)) & 1) this_thread::yield();
+    return version;
+}
+
+static bool validate(const atomic<uint64_t> &latch, uint64_t version) {
+    return latch.load(memory_order_acquire) == version;
+}
+
+static void writeLatch(atomic<uint64_t> &latch) {
+    for (;;) {
+        uint64_t version = latch.load(memory_order_relaxed);
+        if (!(version & 1) && latch.compare_exchange_weak(version, version + 1, memory_order_acquire)) return;
+        this_thread::yield();
+    }
+}
+
+static void writeUnlatch(atomic<uint64_t> &latch, bool changed) {
+    // a changed node ends up two versions further. an unchanged one goes back to its version
+    if (changed) latch.fetch_add(1, memory_order_release);
+    else latch.fetch_sub(1, memory_order_release);
+}
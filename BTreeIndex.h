@@ -11,6 +11,8 @@
 #define BTREEINDEX_H
 
 #include <vector>
+#include <atomic>
+#include <stdint.h>
 #include "Bruinbase.h"
 #include "PageFile.h"
 #include "RecordFile.h"
@@ -31,15 +33,29 @@ typedef struct {
 
 /**
  * Implements a B-Tree index for bruinbase.
- * 
+ *
+ * Threads may share one BTreeIndex. Every node has a version latch.
+ * Readers take no latches: they remember the version of each node they
+ * pass and restart from the root if the version has moved when they get to
+ * the child. Writers latch the nodes from the root down and keep only the
+ * latches of the nodes a split below them would change. A cursor read
+ * while other threads insert may see entries move between leaf nodes.
+ *
+ * The SQL engine does not rely on the latches: a LOAD writes the index
+ * through a BTreeIndex of its own in a transaction of the write-ahead log,
+ * and the statements reading the table open theirs at a snapshot of the
+ * file (see PageFile), so they never see a LOAD halfway.
  */
 class BTreeIndex {
 public:
     BTreeIndex();
 
+    ~BTreeIndex();
+
     /**
      * Open the index file in read or write mode.
      * Under 'w' mode, the index file should be created if it does not exist.
+     * Under 'r' mode, an empty index file is an error.
      * @param indexname[IN] the name of the index file
      * @param mode[IN] 'r' for read, 'w' for write
      * @return error code. 0 if no error
@@ -52,6 +68,15 @@ public:
      */
     RC close();
 
+    /**
+     * Write the leaf nodes in the packed layout from now on, which holds
+     * several times more entries per page. New leaf nodes and the leaf
+     * nodes that take an insert are packed. The setting is kept in the
+     * index file.
+     * @return error code. 0 if no error
+     */
+    RC setPackedLeaves();
+
     /**
      * Insert (key, RecordId) pair to the index.
      * @param key[IN] the key for the value inserted into the index
@@ -60,6 +85,25 @@ public:
      */
     RC insert(int key, const RecordId &rid);
 
+    /**
+     * Build the empty index bottom up from (key, RecordId) pairs in key
+     * order: append every pair with bulkInsert(), then call bulkFinish().
+     * The leaf nodes are filled up and written in order, and the non-leaf
+     * nodes are written once the level below is done. No other thread may
+     * use the index until bulkFinish() returns.
+     * @param key[IN] the key, not smaller than the key appended before
+     * @param rid[IN] the RecordId of the record of the key
+     * @return error code. 0 if no error
+     */
+    RC bulkInsert(int key, const RecordId &rid);
+
+    /**
+     * Write the non-leaf nodes over the leaf nodes of bulkInsert() and make
+     * the top one the root.
+     * @return error code. 0 if no error
+     */
+    RC bulkFinish();
+
     /**
      * Run the standard B+Tree key search algorithm and identify the
      * leaf node where searchKey may exist. If an index entry with
@@ -90,16 +134,119 @@ public:
      */
     RC readForward(IndexCursor &cursor, int &key, RecordId &rid);
 
+    /**
+     * Read the (key, rid) pairs from the cursor location to the end of its
+     * leaf node in one go, and move the cursor to the next leaf node.
+     * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
+     * @param keys[OUT] the keys read. must have room for BT_MAX_PACKED_KEY keys
+     * @param rids[OUT] the RecordIds read. ignored if NULL
+     * @param n[OUT] the number of pairs read
+     * @return error code. 0 if no error
+     */
+    RC readLeaf(IndexCursor &cursor, int keys[], RecordId rids[], int &n);
+
+    /**
+     * Move the cursor to the first index entry whose key is not
+     * smaller than searchKey, like locate(). When the entry is in the
+     * leaf node of the cursor or in the one after it, the cursor is moved
+     * within the leaf chain instead of searching down from the root.
+     * @param searchKey[IN] the key to find
+     * @param cursor[IN/OUT] the cursor to move. pid is -1 if it points nowhere yet
+     * @return 0 if searchKey is found. Othewise an error code
+     */
+    RC relocate(int searchKey, IndexCursor &cursor);
+
+    /**
+     * Set the cursor to the last index entry whose key is smaller than
+     * or equal to searchKey, so that readBackward() can walk the index
+     * in descending key order from there.
+     * @param searchKey[IN] the largest key to return
+     * @param cursor[OUT] the cursor pointing to the entry
+     * @return 0 if such an entry exists. Otherwise RC_END_OF_TREE
+     */
+    RC locateLast(int searchKey, IndexCursor &cursor);
+
+    /**
+     * Read the (key, rid) pair at the location specified by the index cursor,
+     * and move back the cursor to the previous entry.
+     * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
+     * @param key[OUT] the key stored at the index cursor location
+     * @param rid[OUT] the RecordId stored at the index cursor location
+     * @return error code. 0 if no error
+     */
+    RC readBackward(IndexCursor &cursor, int &key, RecordId &rid);
+
+    /**
+     * Count the index entries whose key is in [minKey, maxKey].
+     * Only the two root-to-leaf paths of the range boundaries are read,
+     * using the entry counts kept in the non-leaf nodes.
+     * @param minKey[IN] the smallest key to count
+     * @param maxKey[IN] the largest key to count
+     * @param count[OUT] the number of entries in the range
+     * @return error code. 0 if no error
+     */
+    RC count(int minKey, int maxKey, int &count);
+
+    /**
+     * Set the cursor to the rank'th (0-based) entry of the index in key order.
+     * @param rank[IN] the position of the entry to locate
+     * @param cursor[OUT] the cursor pointing to the entry
+     * @return 0 if found. RC_END_OF_TREE if the index has no more than rank entries
+     */
+    RC locateByRank(int rank, IndexCursor &cursor);
+
 private:
     PageFile pf;         /// the PageFile used to store the actual b+tree in disk
 
-    PageId rootPid;    /// the PageId of the root node
-    int treeHeight; /// the height of the tree
-    /// Note that the content of the above two variables will be gone when
-    /// this class is destructed. Make sure to store the values of the two
+    std::atomic<PageId> rootPid;    /// the PageId of the root node
+    std::atomic<int> treeHeight; /// the height of the tree
+    bool packedLeaves; /// whether leaf nodes are written in the packed layout
+    /// Note that the content of the above three variables will be gone when
+    /// this class is destructed. Make sure to store the values of the
     /// variables in disk, so that they can be reconstructed when the index
     /// is opened again later.
 
+    //
+    // version latches. the lowest bit is set while a writer holds the
+    // latch, and the version goes up when a writer changes the keys or the
+    // child pointers of the node. changes of the entry counts alone keep
+    // the version, since they do not send readers to another node
+    //
+    static const int LATCH_CHUNK = 1024;        // # latches allocated at a time
+    static const int MAX_LATCH_CHUNKS = 4096;   // enough for 4M nodes
+
+    std::atomic<uint64_t> metaLatch;   /// guards rootPid and treeHeight
+    std::atomic<std::atomic<uint64_t> *> latchChunks[MAX_LATCH_CHUNKS];
+
+    long long generation;  /// tells the thread-local scan memo which index it holds
+
+    // a node of a bottom-up build, as its parent takes it
+    struct BulkChild {
+        int key;        // the first key under the node
+        PageId pid;
+        int count;      // # leaf entries under the node
+    };
+    BTLeafNode *bulkLeaf;                 /// the leaf node bulkInsert() fills. NULL before the first pair
+    std::vector<BulkChild> bulkChildren;  /// the leaf nodes bulkInsert() filled
+
+    // the latch of the node in page pid
+    std::atomic<uint64_t> &latch(PageId pid);
+
+    // the scan leaf node of this thread, read from page pid unless it is there already
+    BTLeafNode &getScanLeaf(PageId pid);
+
+    // the leaf node this thread inserted into last, read from page pid unless
+    // it is there already. the caller holds the latch of the node
+    BTLeafNode &getInsertLeaf(PageId pid);
+
+    // descend to the leaf node for searchKey with locateChildPtrByKey(),
+    // restarting until no writer got in the way
+    void descend(int searchKey, bool inclusive, PageId &pid, int &before, uint64_t &version);
+
+    // not copyable, because of the latches
+    BTreeIndex(const BTreeIndex &);
+    BTreeIndex &operator=(const BTreeIndex &);
+
 
     RC writeBTreeMeta();
 
@@ -107,9 +254,9 @@ private:
 
     RC writeBTreeMeta(PageId rootPid, int treeHeight);
 
-    RC getLeafNodeToInsert(int key, PageId &pid, std::vector<PageId> &path);
+    RC createNonLeafRoot(BTNonLeafNode &root, PageId pid1, int count1, int key, PageId pid2, int count2);
 
-    RC createNonLeafRoot(BTNonLeafNode &root, PageId pid1, int key, PageId pid2);
+    RC rank(int searchKey, bool inclusive, int &rank);
 };
 
 #endif /* BTREEINDEX_H */
@@ -6,7 +6,49 @@
 
 using namespace std;
 
-BTreeNode::BTreeNode(PageFile &pf) : pageFile(pf), pageId(pf.endPid()) {}
+// the most an insert can grow the packed entries by: one more key varint
+// (5 bytes) and a RecordId varint (10 bytes) on either side of the new entry
+static const int MAX_PACKED_GROWTH = 5 + 2 * 10;
+
+// the position of rid in the table counted in records
+static long long recordNumber(const RecordId &rid) {
+    return (long long) rid.pid * RecordFile::RECORDS_PER_PAGE + rid.sid;
+}
+
+// the difference of two RecordIds, with small magnitudes mapped to small numbers
+static unsigned long long ridDelta(const RecordId &from, const RecordId &to) {
+    long long d = recordNumber(to) - recordNumber(from);
+    return ((unsigned long long) d << 1) ^ (unsigned long long) (d >> 63);
+}
+
+// # bytes of x as a varint, seven bits per byte
+static int varintSize(unsigned long long x) {
+    int n = 1;
+    while (x >= 0x80) {
+        x >>= 7;
+        n++;
+    }
+    return n;
+}
+
+static unsigned char *putVarint(unsigned char *p, unsigned long long x) {
+    while (x >= 0x80) {
+        *p++ = (unsigned char) (x | 0x80);
+        x >>= 7;
+    }
+    *p++ = (unsigned char) x;
+    return p;
+}
+
+static const unsigned char *getVarint(const unsigned char *p, unsigned long long &x) {
+    x = *p & 0x7f;
+    for (int shift = 7; *p++ & 0x80; shift += 7) {
+        x |= (unsigned long long) (*p & 0x7f) << shift;
+    }
+    return p;
+}
+
+BTreeNode::BTreeNode(PageFile &pf) : pageFile(pf), pageId(pf.allocate()) {}
 
 BTreeNode::BTreeNode(PageId pid, PageFile &pf) : pageFile(pf), pageId(pid) {}
 
@@ -52,8 +94,9 @@ RC BTreeNode::read(PageId pid, const PageFile &pf) {
         fprintf(stderr, "Error: read from Page failed\n");
         return rc;
     }
+    // pageFile is a reference to pf already. assigning it would copy the
+    // file state onto itself, under the feet of other threads
     pageId = pid;
-    pageFile = pf;
     return 0;
 }
 
@@ -86,27 +129,146 @@ int BTreeNode::getPageId() const {
 
 //***********************************************************************
 
-BTLeafNode::BTLeafNode(PageFile &pf) : BTreeNode(pf) {
+BTLeafNode::BTLeafNode(PageFile &pf, bool packed) : BTreeNode(pf), packed(packed), encoded(0) {
     setKeyCount(0);
     setNextNodePtr(-1);
+    setPrevNodePtr(-1);
     write(pageId, pageFile);
 }
 
-BTLeafNode::BTLeafNode(PageId pid, PageFile &pf) : BTreeNode(pid, pf) {
+BTLeafNode::BTLeafNode(PageId pid, PageFile &pf) : BTreeNode(pid, pf), packed(false), encoded(0) {
     read(pid, pf);
 }
 
+/**
+ * Read the page and decode its entries, whatever the layout.
+ * @param pid[IN] the PageId to read
+ * @param pf[IN] PageFile to read from
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTLeafNode::read(PageId pid, const PageFile &pf) {
+    RC rc;
+    encoded = 0;
+    if ((rc = BTreeNode::read(pid, pf)) < 0) {
+        node.keyCount = 0;
+        node.nextPid = node.prevPid = -1;
+        return rc;
+    }
+
+    const PackedLeafNode *header = (const PackedLeafNode *) buffer;
+    packed = header->marker == BT_PACKED_LEAF;
+    if (!packed) {
+        const LeafNode *leaf = (const LeafNode *) buffer;
+        node.keyCount = leaf->keyCount;
+        memcpy(node.keys, leaf->keys, leaf->keyCount * sizeof(int));
+        memcpy(node.rids, leaf->rids, leaf->keyCount * sizeof(RecordId));
+        node.nextPid = leaf->nextPid;
+        node.prevPid = leaf->prevPid;
+        return 0;
+    }
+
+    // decode the whole page in one pass. each entry is the one in front plus the deltas
+    node.keyCount = header->keyCount;
+    node.nextPid = header->nextPid;
+    node.prevPid = header->prevPid;
+    if (node.keyCount == 0) return 0;
+    const unsigned char *p = (const unsigned char *) (header + 1);
+    unsigned int key = (unsigned int) header->firstKey;
+    long long record = recordNumber(header->firstRid);
+    node.keys[0] = header->firstKey;
+    node.rids[0] = header->firstRid;
+    for (int i = 1; i < node.keyCount; i++) {
+        unsigned long long d;
+        p = getVarint(p, d);
+        key += (unsigned int) d;
+        p = getVarint(p, d);
+        record += (long long) (d >> 1) ^ -(long long) (d & 1);
+        node.keys[i] = (int) key;
+        node.rids[i].pid = (PageId) (record / RecordFile::RECORDS_PER_PAGE);
+        node.rids[i].sid = (int) (record % RecordFile::RECORDS_PER_PAGE);
+    }
+    encoded = node.keyCount;
+    return 0;
+}
+
+/**
+ * Encode the entries in the layout of the node and write the page.
+ * In the packed layout, only the entries appended since the page buffer was
+ * last read or written are encoded.
+ * @param pid[IN] the PageId to write to
+ * @param pf[IN] PageFile to write to
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTLeafNode::write(PageId pid, PageFile &pf) {
+    if (!packed) {
+        encoded = 0;
+        memset(buffer, 0, PageFile::PAGE_SIZE);
+        LeafNode *leaf = (LeafNode *) buffer;
+        leaf->keyCount = node.keyCount;
+        memcpy(leaf->keys, node.keys, node.keyCount * sizeof(int));
+        memcpy(leaf->rids, node.rids, node.keyCount * sizeof(RecordId));
+        leaf->nextPid = node.nextPid;
+        leaf->prevPid = node.prevPid;
+        return BTreeNode::write(pid, pf);
+    }
+
+    PackedLeafNode *header = (PackedLeafNode *) buffer;
+    unsigned char *p = (unsigned char *) (header + 1);
+    int i = 1;
+    if (encoded > 0) {
+        // the entries in front are in the page already, and the bytes behind them are zero
+        p += header->size;
+        i = encoded;
+    } else {
+        memset(buffer, 0, PageFile::PAGE_SIZE);
+        header->marker = BT_PACKED_LEAF;
+        if (node.keyCount > 0) {
+            header->firstKey = node.keys[0];
+            header->firstRid = node.rids[0];
+        }
+    }
+    header->keyCount = node.keyCount;
+    header->nextPid = node.nextPid;
+    header->prevPid = node.prevPid;
+    for (; i < node.keyCount; i++) {
+        p = putVarint(p, (unsigned int) node.keys[i] - (unsigned int) node.keys[i - 1]);
+        p = putVarint(p, ridDelta(node.rids[i - 1], node.rids[i]));
+    }
+    header->size = (int) (p - (unsigned char *) (header + 1));
+    encoded = node.keyCount;
+    return BTreeNode::write(pid, pf);
+}
+
+bool BTLeafNode::isPacked() const {
+    return packed;
+}
+
+void BTLeafNode::setPacked(bool packed) {
+    if (packed != this->packed) encoded = 0;
+    this->packed = packed;
+}
+
+int BTLeafNode::getPackedSize() const {
+    if (encoded > 0 && encoded == node.keyCount) return ((const PackedLeafNode *) buffer)->size;
+    int size = 0;
+    for (int i = 1; i < node.keyCount; i++) {
+        size += varintSize((unsigned int) node.keys[i] - (unsigned int) node.keys[i - 1]);
+        size += varintSize(ridDelta(node.rids[i - 1], node.rids[i]));
+    }
+    return size;
+}
+
 
 /**
  * Return the number of keys stored in the node.
  * @return the number of keys in the node
  */
 int BTLeafNode::getKeyCount() const {
-    return ((LeafNode *) buffer)->keyCount;
+    return node.keyCount;
 }
 
 void BTLeafNode::setKeyCount(int count) {
-    ((LeafNode *) buffer)->keyCount = count;
+    node.keyCount = count;
 }
 
 /**
@@ -134,6 +296,8 @@ RC BTLeafNode::insert(int key, const RecordId &rid) {
     keys[i] = key;
     rids[i] = rid;
     setKeyCount(keyCount + 1);
+    // the entries behind the new one are encoded again
+    if (i < encoded) encoded = 0;
     if (DEBUG) cout << "KEYCOUNT:" << getKeyCount() << endl;
     write();
     return 0;
@@ -151,36 +315,94 @@ RC BTLeafNode::insert(int key, const RecordId &rid) {
  */
 RC BTLeafNode::insertAndSplit(int key, const RecordId &rid,
                               BTLeafNode &sibling, int &siblingKey) {
-    int *keys = getKeys(), *siblingKeys = sibling.getKeys();
-    RecordId *rids = getRecords(), *siblingRids = sibling.getRecords();
-    int start = key < keys[BT_MAX_KEY / 2] ? BT_MAX_KEY / 2 : (BT_MAX_KEY + 1) / 2;
-    memcpy(siblingKeys, keys + start, (BT_MAX_KEY - start) * sizeof(int));
-    memcpy(siblingRids, rids + start, (BT_MAX_KEY - start) * sizeof(RecordId));
-    setKeyCount(start);
-    sibling.setKeyCount(BT_MAX_KEY - start);
+    // a key behind every key in the node is likely followed by larger ones
+    bool append = key >= getKeys()[getKeyCount() - 1];
+    encoded = 0;
+    if (packed) {
+        splitPacked(key, rid, sibling, append);
+    } else {
+        int *keys = getKeys(), *siblingKeys = sibling.getKeys();
+        RecordId *rids = getRecords(), *siblingRids = sibling.getRecords();
+        int start = append ? BT_MAX_KEY * BT_APPEND_SPLIT / 100 :
+                    key < keys[BT_MAX_KEY / 2] ? BT_MAX_KEY / 2 : (BT_MAX_KEY + 1) / 2;
+        memcpy(siblingKeys, keys + start, (BT_MAX_KEY - start) * sizeof(int));
+        memcpy(siblingRids, rids + start, (BT_MAX_KEY - start) * sizeof(RecordId));
+        setKeyCount(start);
+        sibling.setKeyCount(BT_MAX_KEY - start);
+
+        int *insertKeys = key > keys[start - 1] ? siblingKeys : keys;
+        RecordId *insertRids = key > keys[start - 1] ? siblingRids : rids;
+        int i = key > keys[start - 1] ? sibling.getKeyCount() : getKeyCount();
+        for (; insertKeys[i - 1] > key && i > 0; i--) {
+            insertKeys[i] = insertKeys[i - 1];
+            insertRids[i] = insertRids[i - 1];
+        }
+        insertKeys[i] = key;
+        insertRids[i] = rid;
 
-    int *insertKeys = key > keys[start - 1] ? siblingKeys : keys;
-    RecordId *insertRids = key > keys[start - 1] ? siblingRids : rids;
-    int i = key > keys[start - 1] ? sibling.getKeyCount() : getKeyCount();
-    for (; insertKeys[i - 1] > key && i > 0; i--) {
-        insertKeys[i] = insertKeys[i - 1];
-        insertRids[i] = insertRids[i - 1];
+        if (key > keys[start - 1]) sibling.setKeyCount(sibling.getKeyCount() + 1);
+        else setKeyCount(getKeyCount() + 1);
     }
-    insertKeys[i] = key;
-    insertRids[i] = rid;
-
-    if (key > keys[start - 1]) sibling.setKeyCount(sibling.getKeyCount() + 1);
-    else setKeyCount(getKeyCount() + 1);
+    sibling.packed = packed;
 
     PageId temp = getNextNodePtr();
     setNextNodePtr(sibling.getPageId());
     sibling.setNextNodePtr(temp);
-    siblingKey = siblingKeys[0];
+    sibling.setPrevNodePtr(getPageId());
+    if (temp >= 0) {
+        // the old next node now sits behind the sibling
+        BTLeafNode next(temp, pageFile);
+        next.setPrevNodePtr(sibling.getPageId());
+        next.write();
+    }
+    siblingKey = sibling.getKeyByEid(0);
     sibling.write();
     write();
     return 0;
 }
 
+/**
+ * Insert the (key, rid) pair and move the entries behind the middle of the
+ * packed bytes to the empty sibling, so that both halves fit in a page
+ * however the varint sizes are spread. On an append, the entries behind
+ * BT_APPEND_SPLIT percent of the bytes move instead.
+ */
+void BTLeafNode::splitPacked(int key, const RecordId &rid, BTLeafNode &sibling, bool append) {
+    int n = getKeyCount();
+    int pos = countKeysBefore(key, true);
+    int keys[BT_MAX_PACKED_KEY + 1];
+    RecordId rids[BT_MAX_PACKED_KEY + 1];
+    memcpy(keys, node.keys, pos * sizeof(int));
+    memcpy(rids, node.rids, pos * sizeof(RecordId));
+    keys[pos] = key;
+    rids[pos] = rid;
+    memcpy(keys + pos + 1, node.keys + pos, (n - pos) * sizeof(int));
+    memcpy(rids + pos + 1, node.rids + pos, (n - pos) * sizeof(RecordId));
+    n++;
+
+    // sizes[i] is # bytes of entry i behind the first one
+    int sizes[BT_MAX_PACKED_KEY + 1];
+    int total = 0;
+    for (int i = 1; i < n; i++) {
+        sizes[i] = varintSize((unsigned int) keys[i] - (unsigned int) keys[i - 1]) +
+                   varintSize(ridDelta(rids[i - 1], rids[i]));
+        total += sizes[i];
+    }
+    // entry start becomes the first one of the sibling and takes no bytes there
+    int start = 1, front = 0;
+    int share = append ? total * BT_APPEND_SPLIT / 100 : total / 2;
+    while (start < n - 1 && front + sizes[start] <= share) {
+        front += sizes[start++];
+    }
+
+    memcpy(node.keys, keys, start * sizeof(int));
+    memcpy(node.rids, rids, start * sizeof(RecordId));
+    setKeyCount(start);
+    memcpy(sibling.node.keys, keys + start, (n - start) * sizeof(int));
+    memcpy(sibling.node.rids, rids + start, (n - start) * sizeof(RecordId));
+    sibling.setKeyCount(n - start);
+}
+
 /**
  * If searchKey exists in the node, set eid to the index entry
  * with searchKey and return 0. If not, set eid to the index entry
@@ -216,7 +438,7 @@ RC BTLeafNode::readEntry(int eid, int &key, RecordId &rid) {
  * @return the PageId of the next sibling node 
  */
 PageId BTLeafNode::getNextNodePtr() const {
-    return ((LeafNode *) buffer)->nextPid;
+    return node.nextPid;
 }
 
 /**
@@ -225,17 +447,36 @@ PageId BTLeafNode::getNextNodePtr() const {
  * @return 0 if successful. Return an error code if there is an error.
  */
 RC BTLeafNode::setNextNodePtr(PageId pid) {
-    ((LeafNode *) buffer)->nextPid = pid;
+    node.nextPid = pid;
+    return 0;
+}
+
+
+/**
+ * Return the pid of the previous slibling node.
+ * @return the PageId of the previous sibling node
+ */
+PageId BTLeafNode::getPrevNodePtr() const {
+    return node.prevPid;
+}
+
+/**
+ * Set the pid of the previous slibling node.
+ * @param pid[IN] the PageId of the previous sibling node
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTLeafNode::setPrevNodePtr(PageId pid) {
+    node.prevPid = pid;
     return 0;
 }
 
 
 int *BTLeafNode::getKeys() const {
-    return ((LeafNode *) buffer)->keys;
+    return (int *) node.keys;
 }
 
 RecordId *BTLeafNode::getRecords() const {
-    return ((LeafNode *) buffer)->rids;
+    return (RecordId *) node.rids;
 }
 
 int BTLeafNode::getKeyByEid(int eid) const {
@@ -245,6 +486,25 @@ RecordId BTLeafNode::getRidByEid(int eid) const {
     return getRecords()[eid];
 }
 
+int BTLeafNode::readEntries(int eid, int keys[], RecordId rids[]) const {
+    int n = getKeyCount() - eid;
+    if (n <= 0) return 0;
+    memcpy(keys, getKeys() + eid, n * sizeof(int));
+    if (rids != NULL) memcpy(rids, getRecords() + eid, n * sizeof(RecordId));
+    return n;
+}
+
+int BTLeafNode::countKeysBefore(int searchKey, bool inclusive) const {
+    int *keys = getKeys();
+    int low = 0, high = getKeyCount();
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (keys[mid] < searchKey || (inclusive && keys[mid] == searchKey)) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
 RC BTLeafNode::forward(PageId &pid, int& eid) {
     if(pid < 0) return RC_END_OF_TREE;
     if(++eid >=getKeyCount()) {
@@ -254,12 +514,22 @@ RC BTLeafNode::forward(PageId &pid, int& eid) {
     return 0;
 }
 
+RC BTLeafNode::backward(PageId &pid, int& eid) {
+    if(pid < 0) return RC_END_OF_TREE;
+    if(--eid < 0) {
+        pid = getPrevNodePtr();
+        eid = -1;
+    }
+    return 0;
+}
+
 
 void BTLeafNode::printNode() const {
     int keyCount = getKeyCount();
     int *keys = getKeys();
     RecordId *rids = getRecords();
     PageId next = getNextNodePtr();
+    PageId prev = getPrevNodePtr();
     cout << endl << "#####################  Leaf Node " << getPageId() << " ########################" << endl;
     cout << "keyCount: " << keyCount << endl << "keys: ";
     for (int i = 0; i < keyCount; i++) {
@@ -275,11 +545,14 @@ void BTLeafNode::printNode() const {
     }
     cout << endl;
     cout << "next: " << next << endl;
+    cout << "prev: " << prev << endl;
     cout << "##################################################" << endl << endl;
 }
 
 bool BTLeafNode::isFull() const {
-    return getKeyCount() >= BT_MAX_KEY;
+    if (!packed) return getKeyCount() >= BT_MAX_KEY;
+    return getKeyCount() >= BT_MAX_PACKED_KEY ||
+           (int) sizeof(PackedLeafNode) + getPackedSize() + MAX_PACKED_GROWTH > PageFile::PAGE_SIZE;
 }
 
 
@@ -301,26 +574,31 @@ BTNonLeafNode::BTNonLeafNode(PageId pid, PageFile &pf) : BTreeNode(pid, pf) {
  * @param pid[IN] the PageId to insert
  * @return 0 if successful. Return an error code if the node is full.
  */
-RC BTNonLeafNode::insert(int key, PageId pid) {
+RC BTNonLeafNode::insert(int key, PageId pid, int count) {
     if (isFull()) {
         return RC_NODE_FULL;
     }
 
-    return forceInsert(key, pid);
+    return forceInsert(key, pid, count);
 }
 
 
-RC BTNonLeafNode::forceInsert(int key, PageId pid) {
+RC BTNonLeafNode::forceInsert(int key, PageId pid, int count) {
     int keyCount = getKeyCount();
     int *keys = getKeys();
     PageId *pids = getPages();
+    int *counts = getCounts();
     int i = keyCount;
-    for (; keys[i - 1] > key && i > 0; i--) {
+    for (; i > 0 && keys[i - 1] > key; i--) {
         keys[i] = keys[i - 1];
         pids[i + 1] = pids[i];
+        counts[i + 1] = counts[i];
     }
     keys[i] = key;
     pids[i + 1] = pid;
+    // the new child was split off the child in front of it
+    counts[i + 1] = count;
+    counts[i] -= count;
     setKeyCount(keyCount + 1);
     return write();
 }
@@ -332,27 +610,34 @@ RC BTNonLeafNode::forceInsert(int key, PageId pid) {
  * The middle key after the split is returned in midKey.
  * @param key[IN] the key to insert
  * @param pid[IN] the PageId to insert
+ * @param count[IN] the number of leaf entries under pid
  * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
  * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode &sibling, int &midKey) {
+RC BTNonLeafNode::insertAndSplit(int key, PageId pid, int count, BTNonLeafNode &sibling, int &midKey) {
     // TODO different from leaf node
     int *keys = getKeys(), *siblingKeys = sibling.getKeys();
     PageId *pids = getPages(), *siblingPids = sibling.getPages();
-
-    forceInsert(key, pid);
-    int size = BT_MAX_KEY + 1;
-    midKey = keys[size / 2];
-    int i = size / 2 + 1, j = 0;
+    int *counts = getCounts(), *siblingCounts = sibling.getCounts();
+
+    bool append = key >= keys[getKeyCount() - 1];
+    forceInsert(key, pid, count);
+    int size = BT_MAX_NONLEAF_KEY + 1;
+    // the node keeps the keys in front of midKey
+    int mid = append ? size * BT_APPEND_SPLIT / 100 : size / 2;
+    midKey = keys[mid];
+    int i = mid + 1, j = 0;
     for (; i < size; i++, j++) {
         siblingKeys[j] = keys[i];
         siblingPids[j] = pids[i];
+        siblingCounts[j] = counts[i];
     }
     siblingPids[j] = pids[i];
+    siblingCounts[j] = counts[i];
 
-    setKeyCount((BT_MAX_KEY + 1) / 2);
-    sibling.setKeyCount(BT_MAX_KEY / 2);
+    setKeyCount(mid);
+    sibling.setKeyCount(size - mid - 1);
     sibling.write();
     write();
     return 0;
@@ -373,17 +658,82 @@ RC BTNonLeafNode::locateChildPtr(int searchKey, PageId &pid) {
     return 0;
 }
 
+RC BTNonLeafNode::locateChildPtr(int searchKey, PageId &pid, int &idx) {
+    int keyCount = getKeyCount();
+    // keys inserted in increasing order go behind the last key, so check that first
+    if (keyCount > 0 && searchKey > getKeys()[keyCount - 1]) {
+        idx = keyCount;
+        pid = getPages()[idx];
+        return 0;
+    }
+    idx = -1;
+    if(binarySearch(getKeys(), 0, keyCount - 1, searchKey, idx)==0) idx++;
+    pid = getPages()[idx];
+    return 0;
+}
+
+RC BTNonLeafNode::locateChildPtrByKey(int searchKey, bool inclusive, PageId &pid, int &before) {
+    int keyCount = getKeyCount();
+    int *keys = getKeys();
+    int *counts = getCounts();
+
+    // every entry under pids[i] is no larger than keys[i] and no smaller than
+    // keys[i - 1], so the boundary lies in the first child whose upper key
+    // is not in front of searchKey
+    int i = 0;
+    before = 0;
+    while (i < keyCount && (keys[i] < searchKey || (inclusive && keys[i] == searchKey))) {
+        before += counts[i];
+        i++;
+    }
+    pid = getPages()[i];
+    return 0;
+}
+
+RC BTNonLeafNode::locateChildPtrByRank(int &rank, PageId &pid) {
+    int pidCount = getPidCount();
+    int *counts = getCounts();
+    for (int i = 0; i < pidCount; i++) {
+        if (rank < counts[i]) {
+            pid = getPages()[i];
+            return 0;
+        }
+        rank -= counts[i];
+    }
+    return RC_END_OF_TREE;
+}
+
+RC BTNonLeafNode::adjustCount(int idx, int delta) {
+    getCounts()[idx] += delta;
+    return write();
+}
+
+int BTNonLeafNode::getEntryCount() const {
+    int pidCount = getPidCount();
+    int *counts = getCounts();
+    int total = 0;
+    for (int i = 0; i < pidCount; i++) {
+        total += counts[i];
+    }
+    return total;
+}
+
 /**
  * Initialize the root node with (pid1, key, pid2).
  * @param pid1[IN] the first PageId to insert
+ * @param count1[IN] the number of leaf entries under pid1
  * @param key[IN] the key that should be inserted between the two PageIds
  * @param pid2[IN] the PageId to insert behind the key
+ * @param count2[IN] the number of leaf entries under pid2
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::initializeRoot(PageId pid1, int key, PageId pid2) {
+RC BTNonLeafNode::initializeRoot(PageId pid1, int count1, int key, PageId pid2, int count2) {
     PageId *pids = getPages();
     pids[0] = pid1;
     pids[1] = pid2;
+    int *counts = getCounts();
+    counts[0] = count1;
+    counts[1] = count2;
     int *keys = getKeys();
     keys[0] = key;
     setKeyCount(1);
@@ -394,6 +744,15 @@ RC BTNonLeafNode::initializeRoot(PageId pid1, int key, PageId pid2) {
     return 0;
 }
 
+RC BTNonLeafNode::initialize(const int keys[], const PageId pids[], const int counts[], int n) {
+    if (n < 2 || n > BT_MAX_NONLEAF_KEY + 1) return RC_INVALID_ATTRIBUTE;
+    memcpy(getKeys(), keys, (n - 1) * sizeof(int));
+    memcpy(getPages(), pids, n * sizeof(PageId));
+    memcpy(getCounts(), counts, n * sizeof(int));
+    setKeyCount(n - 1);
+    return write();
+}
+
 /**
  * Return the number of keys stored in the node.
  * @return the number of keys in the node
@@ -414,9 +773,13 @@ PageId *BTNonLeafNode::getPages() const {
     return ((NonLeafNode *) buffer)->pids;
 }
 
+int *BTNonLeafNode::getCounts() const {
+    return ((NonLeafNode *) buffer)->counts;
+}
+
 
 bool BTNonLeafNode::isFull() const {
-    return getKeyCount() >= BT_MAX_KEY;
+    return getKeyCount() >= BT_MAX_NONLEAF_KEY;
 }
 
 int BTNonLeafNode::getPidCount() const {
@@ -428,6 +791,7 @@ void BTNonLeafNode::printNode() const {
     int keyCount = getKeyCount();
     int *keys = getKeys();
     PageId *pids = getPages();
+    int *counts = getCounts();
     cout << endl << "####################  Non Leaf Node " << getPageId() << " #########################" << endl;
     cout << "keyCount: " << keyCount << endl << "keys: ";
     for (int i = 0; i < keyCount; i++) {
@@ -437,6 +801,10 @@ void BTNonLeafNode::printNode() const {
     for (int i = 0; i < keyCount + 1; i++) {
         cout << pids[i] << " ";
     }
+    cout << endl << "counts: ";
+    for (int i = 0; i < keyCount + 1; i++) {
+        cout << counts[i] << " ";
+    }
     cout << endl;
     cout << "##################################################" << endl << endl;
 
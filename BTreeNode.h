@@ -15,19 +15,60 @@
 
 #define BT_MAX_KEY 84
 
+// non-leaf nodes also keep an entry count per child pointer, which costs
+// one key of fan-out to stay within a page
+#define BT_MAX_NONLEAF_KEY 83
+
 typedef struct {
     int keyCount;
     int keys[BT_MAX_KEY];
     RecordId rids[BT_MAX_KEY];
     PageId nextPid;
+    PageId prevPid;
 } LeafNode;
 
+// a leaf node in the packed layout has this in place of keyCount
+#define BT_PACKED_LEAF 0x4b434150
+
+// the header of a leaf node in the packed layout. the other entries follow
+// as varints: the key minus the key in front, and the RecordId minus the
+// RecordId in front counted in records (zigzag-encoded, since RecordIds are
+// not sorted by key). dense keys and sequential RecordIds take a byte each.
+typedef struct {
+    int marker;         // BT_PACKED_LEAF
+    int keyCount;
+    PageId nextPid;
+    PageId prevPid;
+    int size;           // # bytes of the varints behind the header
+    int firstKey;
+    RecordId firstRid;
+} PackedLeafNode;
+
+// every packed entry behind the first takes at least two bytes
+#define BT_MAX_PACKED_KEY (1 + (PageFile::PAGE_SIZE - (int) sizeof(PackedLeafNode)) / 2)
+
+// a leaf node as BTLeafNode holds it in memory, whatever its layout in the page
+typedef struct {
+    int keyCount;
+    int keys[BT_MAX_PACKED_KEY];
+    RecordId rids[BT_MAX_PACKED_KEY];
+    PageId nextPid;
+    PageId prevPid;
+} DecodedLeafNode;
+
 typedef struct {
     int keyCount;
-    int keys[BT_MAX_KEY + 1];
-    PageId pids[BT_MAX_KEY + 2];
+    int keys[BT_MAX_NONLEAF_KEY + 1];
+    PageId pids[BT_MAX_NONLEAF_KEY + 2];
+    int counts[BT_MAX_NONLEAF_KEY + 2];  // # leaf entries under pids[i]
 } NonLeafNode;
 
+// the percentage of the entries a full node keeps when it splits because of
+// an entry behind all of its entries, as keys inserted in increasing order
+// are. the node behind gets the rest and the new entry, so an index loaded
+// in key order ends up with nearly full nodes instead of half full ones
+#define BT_APPEND_SPLIT 90
+
 class BTreeNode {
 public:
 
@@ -37,6 +78,8 @@ public:
     //for loading
     BTreeNode(PageId pid, PageFile &pf);
 
+    virtual ~BTreeNode() {}
+
 
     /**
      * Return the number of keys stored in the node.
@@ -54,7 +97,7 @@ public:
      * @param pf[IN] PageFile to read from
      * @return 0 if successful. Return an error code if there is an error.
      */
-    RC read(PageId pid, const PageFile &pf);
+    virtual RC read(PageId pid, const PageFile &pf);
 
     /**
      * Write the content of the node to the page pid in the PageFile pf.
@@ -62,7 +105,7 @@ public:
      * @param pf[IN] PageFile to write to
      * @return 0 if successful. Return an error code if there is an error.
      */
-    RC write(PageId pid, PageFile &pf);
+    virtual RC write(PageId pid, PageFile &pf);
 
     RC write();
 
@@ -86,16 +129,37 @@ protected:
 
 /**
  * BTLeafNode: The class representing a B+tree leaf node.
+ * The page holds the entries either as plain arrays (LeafNode) or in the
+ * packed layout (PackedLeafNode). read() decodes either one into memory,
+ * and write() encodes the entries in the layout set by setPacked().
  */
 class BTLeafNode : public BTreeNode {
 public:
 
     // For Page creating
-    BTLeafNode(PageFile &pf);
+    BTLeafNode(PageFile &pf, bool packed = false);
 
     // For Page loading
     BTLeafNode(PageId pid, PageFile &pf);
 
+    RC read(PageId pid, const PageFile &pf);
+
+    RC write(PageId pid, PageFile &pf);
+
+    using BTreeNode::write;
+
+    /**
+     * Return whether the node is written in the packed layout.
+     * @return true if the node uses the packed layout
+     */
+    bool isPacked() const;
+
+    /**
+     * Set the layout the node is written in from the next write() on.
+     * @param packed[IN] true for the packed layout
+     */
+    void setPacked(bool packed);
+
 
     /**
     * Insert the (key, rid) pair to the node.
@@ -108,7 +172,9 @@ public:
 
     /**
      * Insert the (key, rid) pair to the node
-     * and split the node half and half with sibling.
+     * and split the node half and half with sibling. If the key is not
+     * smaller than any key in the node, the node keeps BT_APPEND_SPLIT
+     * percent of the entries instead.
      * The first key of the sibling node is returned in siblingKey.
      * Remember that all keys inside a B+tree node should be kept sorted.
      * @param key[IN] the key to insert.
@@ -155,6 +221,19 @@ public:
      */
     RC setNextNodePtr(PageId pid);
 
+    /**
+     * Return the pid of the previous slibling node.
+     * @return the PageId of the previous sibling node
+     */
+    PageId getPrevNodePtr() const;
+
+    /**
+     * Set the previous slibling node PageId.
+     * @param pid[IN] the PageId of the previous sibling node
+     * @return 0 if successful. Return an error code if there is an error.
+     */
+    RC setPrevNodePtr(PageId pid);
+
 
     /**
      * Return the number of keys stored in the node.
@@ -164,22 +243,56 @@ public:
 
     int getKeyByEid(int eid) const;
 
+    /**
+     * Copy the entries from eid to the end of the node.
+     * @param eid[IN] the first entry to copy
+     * @param keys[OUT] the keys of the entries
+     * @param rids[OUT] the RecordIds of the entries. ignored if NULL
+     * @return the number of entries copied
+     */
+    int readEntries(int eid, int keys[], RecordId rids[]) const;
+
     RecordId getRidByEid(int eid) const;
 
+    /**
+     * Return the number of entries whose key is smaller than searchKey
+     * (or smaller than or equal to searchKey if inclusive is set).
+     * @param searchKey[IN] the key to compare against
+     * @param inclusive[IN] whether entries equal to searchKey are counted
+     * @return the number of entries in front of searchKey
+     */
+    int countKeysBefore(int searchKey, bool inclusive) const;
+
     bool isFull() const;
 
     void printNode() const;
 
     RC forward(PageId &pid, int& eid);
 
+    /**
+     * Move (pid, eid) to the entry in front of eid. When the first entry
+     * is passed, pid becomes the previous sibling and eid becomes -1,
+     * which stands for the last entry of that node.
+     */
+    RC backward(PageId &pid, int& eid);
+
 
 private:
+    DecodedLeafNode node;  // the entries of the page
+    bool packed;           // the layout write() uses
+    int encoded;           // # entries in front whose packed varints are the ones in the page buffer
+
     void setKeyCount(int keyCount);
 
     RecordId *getRecords() const;
 
     int *getKeys() const;
 
+    // # bytes the entries behind the first take in the packed layout
+    int getPackedSize() const;
+
+    void splitPacked(int key, const RecordId &rid, BTLeafNode &sibling, bool append);
+
 };
 
 
@@ -196,25 +309,31 @@ public:
     /**
     * Insert a (key, pid) pair to the node.
     * Remember that all keys inside a B+tree node should be kept sorted.
+    * The new child is the right half of a split, so its count entries are
+    * taken away from the child pointer immediately in front of it.
     * @param key[IN] the key to insert
     * @param pid[IN] the PageId to insert
+    * @param count[IN] the number of leaf entries under pid
     * @return 0 if successful. Return an error code if the node is full.
     */
-    RC insert(int key, PageId pid);
+    RC insert(int key, PageId pid, int count);
 
     /**
      * Insert the (key, pid) pair to the node
-     * and split the node half and half with sibling.
+     * and split the node half and half with sibling. If the key is not
+     * smaller than any key in the node, the node keeps BT_APPEND_SPLIT
+     * percent of the keys instead.
      * The sibling node MUST be empty when this function is called.
      * The middle key after the split is returned in midKey.
      * Remember that all keys inside a B+tree node should be kept sorted.
      * @param key[IN] the key to insert
      * @param pid[IN] the PageId to insert
+     * @param count[IN] the number of leaf entries under pid
      * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
      * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
      * @return 0 if successful. Return an error code if there is an error.
      */
-    RC insertAndSplit(int key, PageId pid, BTNonLeafNode &sibling, int &midKey);
+    RC insertAndSplit(int key, PageId pid, int count, BTNonLeafNode &sibling, int &midKey);
 
     /**
      * Given the searchKey, find the child-node pointer to follow and
@@ -226,14 +345,73 @@ public:
      */
     RC locateChildPtr(int searchKey, PageId &pid);
 
+    /**
+     * Same as locateChildPtr(), but also output the slot of the child
+     * pointer so that its entry count can be adjusted.
+     * @param searchKey[IN] the searchKey that is being looked up.
+     * @param pid[OUT] the pointer to the child node to follow.
+     * @param idx[OUT] the slot of pid inside the node.
+     * @return 0 if successful. Return an error code if there is an error.
+     */
+    RC locateChildPtr(int searchKey, PageId &pid, int &idx);
+
+    /**
+     * Find the child that holds the boundary of searchKey and count the
+     * leaf entries under the children in front of it. The child is chosen
+     * so that every entry in front of it is smaller than searchKey
+     * (smaller than or equal to if inclusive is set) and no entry behind it is.
+     * @param searchKey[IN] the key to compare against
+     * @param inclusive[IN] whether entries equal to searchKey count as in front
+     * @param pid[OUT] the pointer to the child node to follow
+     * @param before[OUT] # leaf entries under the children in front of pid
+     * @return 0 if successful. Return an error code if there is an error.
+     */
+    RC locateChildPtrByKey(int searchKey, bool inclusive, PageId &pid, int &before);
+
+    /**
+     * Find the child that holds the rank'th leaf entry of this subtree
+     * (0-based) and turn rank into the position inside that child.
+     * @param rank[IN/OUT] the position of the entry in this node/child
+     * @param pid[OUT] the pointer to the child node to follow
+     * @return 0 if successful. RC_END_OF_TREE if rank is out of range.
+     */
+    RC locateChildPtrByRank(int &rank, PageId &pid);
+
+    /**
+     * Add delta to the entry count of the idx'th child pointer.
+     * @param idx[IN] the slot of the child pointer
+     * @param delta[IN] the number to add
+     * @return 0 if successful. Return an error code if there is an error.
+     */
+    RC adjustCount(int idx, int delta);
+
+    /**
+     * Return the number of leaf entries under this node.
+     * @return the sum of the entry counts of all child pointers
+     */
+    int getEntryCount() const;
+
     /**
      * Initialize the root node with (pid1, key, pid2).
      * @param pid1[IN] the first PageId to insert
+     * @param count1[IN] the number of leaf entries under pid1
      * @param key[IN] the key that should be inserted between the two PageIds
      * @param pid2[IN] the PageId to insert behind the key
+     * @param count2[IN] the number of leaf entries under pid2
+     * @return 0 if successful. Return an error code if there is an error.
+     */
+    RC initializeRoot(PageId pid1, int count1, int key, PageId pid2, int count2);
+
+    /**
+     * Fill the empty node with the children of a bottom-up build.
+     * keys[i] goes between pids[i] and pids[i + 1].
+     * @param keys[IN] the n - 1 keys between the children
+     * @param pids[IN] the children in key order
+     * @param counts[IN] the number of leaf entries under every child
+     * @param n[IN] the number of children. 2 to BT_MAX_NONLEAF_KEY + 1
      * @return 0 if successful. Return an error code if there is an error.
      */
-    RC initializeRoot(PageId pid1, int key, PageId pid2);
+    RC initialize(const int keys[], const PageId pids[], const int counts[], int n);
 
     /**
      * Return the number of keys stored in the node.
@@ -254,9 +432,11 @@ private:
 
     int *getKeys() const;
 
+    int *getCounts() const;
+
     int getPidCount() const;
 
-    RC forceInsert(int key, PageId pid);
+    RC forceInsert(int key, PageId pid, int count);
 
 };
 
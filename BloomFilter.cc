@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include "Bruinbase.h"
+#include "BloomFilter.h"
+
+using std::string;
+using std::vector;
+
+//
+// The filter file is a header page followed by the bit arrays of the
+// stages, back to back. The header page holds # stages and then
+// (capacity, count, # hash functions, # bytes) for every stage.
+//
+
+// # ints in the header page per stage
+static const int STAGE_HEADER_INTS = 4;
+
+// the largest # stages the header page has room for
+static const int MAX_STAGES = (PageFile::PAGE_SIZE / sizeof(int) - 1) / STAGE_HEADER_INTS;
+
+// scramble the bits of x (the finalizer of MurmurHash3)
+static unsigned long long mix(unsigned long long x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+BloomFilter::BloomFilter() : mode('r') {
+}
+
+RC BloomFilter::open(const string &filename, char mode) {
+    RC rc;
+    char page[PageFile::PAGE_SIZE];
+
+    if ((rc = pf.open(filename, mode)) < 0) return rc;
+    this->mode = mode;
+    stages.clear();
+    if (pf.endPid() == 0) {
+        // an empty filter would rule out every row, so a file no LOAD has
+        // committed to has no filter to read yet
+        if (mode == 'w') return 0;
+        pf.close();
+        return RC_INVALID_FILE_FORMAT;
+    }
+
+    if ((rc = pf.read(0, page)) < 0) {
+        pf.close();
+        return rc;
+    }
+    int *header = (int *) page;
+    int stageCount = header[0];
+    if (stageCount < 0 || stageCount > MAX_STAGES) {
+        pf.close();
+        return RC_INVALID_FILE_FORMAT;
+    }
+    stages.resize(stageCount);
+    for (int i = 0; i < stageCount; i++) {
+        int *h = header + 1 + i * STAGE_HEADER_INTS;
+        stages[i].capacity = h[0];
+        stages[i].count = h[1];
+        stages[i].hashCount = h[2];
+        stages[i].bits.resize(h[3]);
+    }
+
+    // copy the bit arrays out of the pages that follow
+    PageId pid = 1;
+    int offset = PageFile::PAGE_SIZE;
+    for (int i = 0; i < stageCount; i++) {
+        for (size_t done = 0; done < stages[i].bits.size();) {
+            if (offset == PageFile::PAGE_SIZE) {
+                if ((rc = pf.read(pid++, page)) < 0) {
+                    pf.close();
+                    return rc;
+                }
+                offset = 0;
+            }
+            size_t n = std::min(stages[i].bits.size() - done, (size_t) (PageFile::PAGE_SIZE - offset));
+            memcpy(&stages[i].bits[done], page + offset, n);
+            done += n;
+            offset += n;
+        }
+    }
+    return 0;
+}
+
+RC BloomFilter::close() {
+    RC rc;
+    char page[PageFile::PAGE_SIZE];
+
+    if (mode == 'w') {
+        memset(page, 0, PageFile::PAGE_SIZE);
+        int *header = (int *) page;
+        header[0] = (int) stages.size();
+        for (size_t i = 0; i < stages.size(); i++) {
+            int *h = header + 1 + i * STAGE_HEADER_INTS;
+            h[0] = stages[i].capacity;
+            h[1] = stages[i].count;
+            h[2] = stages[i].hashCount;
+            h[3] = (int) stages[i].bits.size();
+        }
+        if ((rc = pf.write(0, page)) < 0) return rc;
+
+        PageId pid = 1;
+        int offset = 0;
+        memset(page, 0, PageFile::PAGE_SIZE);
+        for (size_t i = 0; i < stages.size(); i++) {
+            for (size_t done = 0; done < stages[i].bits.size();) {
+                size_t n = std::min(stages[i].bits.size() - done, (size_t) (PageFile::PAGE_SIZE - offset));
+                memcpy(page + offset, &stages[i].bits[done], n);
+                done += n;
+                offset += n;
+                if (offset == PageFile::PAGE_SIZE) {
+                    if ((rc = pf.write(pid++, page)) < 0) return rc;
+                    memset(page, 0, PageFile::PAGE_SIZE);
+                    offset = 0;
+                }
+            }
+        }
+        if (offset > 0 && (rc = pf.write(pid, page)) < 0) return rc;
+    }
+    return pf.close();
+}
+
+void BloomFilter::add(unsigned long long h) {
+    // an item that looks present already would not change any bit
+    if (mayContain(h)) return;
+
+    // past the last stage the header has room for, the last stage just fills up further
+    if (stages.empty() || (stages.back().count >= stages.back().capacity &&
+                           (int) stages.size() < MAX_STAGES && stages.back().capacity <= INT_MAX / 2)) {
+        Stage s;
+        s.capacity = stages.empty() ? BASE_CAPACITY : stages.back().capacity * 2;
+        s.count = 0;
+        s.hashCount = stages.empty() ? BASE_HASH_COUNT : stages.back().hashCount + 1;
+        // k / ln 2 bits per item give a false positive rate of 2^-k at capacity
+        s.bits.resize(((long long) s.capacity * s.hashCount * 1443 / 1000 + 7) / 8);
+        stages.push_back(s);
+    }
+
+    Stage &s = stages.back();
+    for (int i = 0; i < s.hashCount; i++) {
+        unsigned long long b = bitOf(s, h, i);
+        s.bits[b / 8] |= (unsigned char) (1 << (b % 8));
+    }
+    s.count++;
+}
+
+bool BloomFilter::mayContain(unsigned long long h) const {
+    for (size_t j = 0; j < stages.size(); j++) {
+        const Stage &s = stages[j];
+        int i;
+        for (i = 0; i < s.hashCount; i++) {
+            unsigned long long b = bitOf(s, h, i);
+            if (!(s.bits[b / 8] & (1 << (b % 8)))) break;
+        }
+        if (i == s.hashCount) return true;
+    }
+    return false;
+}
+
+int BloomFilter::getCount() const {
+    int count = 0;
+    for (size_t i = 0; i < stages.size(); i++) {
+        count += stages[i].count;
+    }
+    return count;
+}
+
+unsigned long long BloomFilter::hash(int key) {
+    return mix((unsigned long long) (unsigned int) key);
+}
+
+unsigned long long BloomFilter::hash(const string &value) {
+    // FNV-1a, so that the filter files do not depend on the C++ library
+    unsigned long long h = 14695981039346656037ULL;
+    for (size_t i = 0; i < value.size(); i++) {
+        h ^= (unsigned char) value[i];
+        h *= 1099511628211ULL;
+    }
+    return mix(h);
+}
+
+unsigned long long BloomFilter::bitOf(const Stage &s, unsigned long long h, int i) {
+    // double hashing: the i'th function is h1 + i * h2
+    unsigned long long h2 = mix(h ^ 0x9e3779b97f4a7c15ULL) | 1;
+    return (h + i * h2) % (s.bits.size() * 8);
+}
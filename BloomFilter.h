@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef BLOOMFILTER_H
+#define BLOOMFILTER_H
+
+#include <string>
+#include <vector>
+#include "Bruinbase.h"
+#include "PageFile.h"
+
+/**
+ * A Bloom filter over the keys or the values of a table, kept in a side
+ * file next to the table and read into memory as a whole on open().
+ * mayContain() never returns false for an item that was added, so a
+ * false answer proves that no row has the item.
+ *
+ * The number of items is not known up front, so the filter is a chain
+ * of stages. A new stage with twice the capacity and one more hash
+ * function is started whenever the last one is full, which keeps the
+ * overall false positive rate near 2^-(BASE_HASH_COUNT - 1).
+ */
+class BloomFilter {
+public:
+
+    // # items the first stage takes
+    static const int BASE_CAPACITY = 1024;
+
+    // # hash functions of the first stage
+    static const int BASE_HASH_COUNT = 7;
+
+    BloomFilter();
+
+    /**
+     * open the filter file and read the filter into memory.
+     * an empty file can only be opened for write.
+     * @param filename[IN] the filter file name
+     * @param mode[IN] 'r' for read, 'w' for write
+     * @return error code. 0 if no error
+     */
+    RC open(const std::string &filename, char mode);
+
+    /**
+     * write the filter back if it was opened for write and close the file.
+     * the filter stays in memory, so mayContain() still answers afterwards.
+     * @return error code. 0 if no error
+     */
+    RC close();
+
+    /**
+     * add an item.
+     * @param h[IN] the hash of the item from hash()
+     */
+    void add(unsigned long long h);
+
+    /**
+     * @param h[IN] the hash of the item from hash()
+     * @return false if the item was never added
+     */
+    bool mayContain(unsigned long long h) const;
+
+    /**
+     * @return the # items added. items that looked present already are not counted
+     */
+    int getCount() const;
+
+    // the hash of a key
+    static unsigned long long hash(int key);
+
+    // the hash of a value
+    static unsigned long long hash(const std::string &value);
+
+private:
+    struct Stage {
+        int capacity;
+        int count;
+        int hashCount;
+        std::vector<unsigned char> bits;
+    };
+
+    PageFile pf;
+    char mode;
+    std::vector<Stage> stages;
+
+    // the bit for the i'th hash function of h in stage s
+    static unsigned long long bitOf(const Stage &s, unsigned long long h, int i);
+};
+
+#endif /* BLOOMFILTER_H */
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <cstring>
+#include "Bruinbase.h"
+#include "Dictionary.h"
+
+using std::string;
+
+//
+// a dictionary page stores # values in its first four bytes, followed by
+// the values. every value is a length byte and the bytes of the value.
+//
+
+Dictionary::Dictionary() : saved(0) {
+}
+
+RC Dictionary::load(const string &filename) {
+    RC rc;
+    PageFile pf;
+    char page[PageFile::PAGE_SIZE];
+
+    if ((rc = pf.open(filename, 'r')) < 0) return rc;
+
+    values.clear();
+    codes.clear();
+    pageStarts.clear();
+    for (PageId pid = 0; pid < pf.endPid(); pid++) {
+        if ((rc = pf.read(pid, page)) < 0) {
+            pf.close();
+            return rc;
+        }
+        int count;
+        memcpy(&count, page, sizeof(int));
+        pageStarts.push_back((int) values.size());
+
+        const char *p = page + sizeof(int);
+        for (int i = 0; i < count; i++) {
+            unsigned char len = (unsigned char) *p++;
+            codes[string(p, len)] = (int) values.size();
+            values.push_back(string(p, len));
+            p += len;
+        }
+    }
+    saved = (int) values.size();
+    return pf.close();
+}
+
+RC Dictionary::save(const string &filename) {
+    RC rc;
+    PageFile pf;
+    char page[PageFile::PAGE_SIZE];
+
+    if (saved == (int) values.size() && !pageStarts.empty()) return 0;
+    if ((rc = pf.open(filename, 'w')) < 0) return rc;
+
+    // rewrite the last page of the file, which may have room left,
+    // and append the pages for the rest of the new values
+    PageId pid = pageStarts.empty() ? 0 : (PageId) pageStarts.size() - 1;
+    int code = pageStarts.empty() ? 0 : pageStarts.back();
+    pageStarts.resize(pid);
+    do {
+        pageStarts.push_back(code);
+        memset(page, 0, PageFile::PAGE_SIZE);
+        int count = 0;
+        char *p = page + sizeof(int);
+        while (code < (int) values.size() && p + 1 + values[code].size() <= page + PageFile::PAGE_SIZE) {
+            *p++ = (char) values[code].size();
+            memcpy(p, values[code].data(), values[code].size());
+            p += values[code].size();
+            code++;
+            count++;
+        }
+        memcpy(page, &count, sizeof(int));
+        if ((rc = pf.write(pid++, page)) < 0) {
+            pf.close();
+            return rc;
+        }
+    } while (code < (int) values.size());
+
+    saved = (int) values.size();
+    return pf.close();
+}
+
+int Dictionary::getCode(const string &value) const {
+    std::unordered_map<string, int>::const_iterator it = codes.find(value);
+    return it == codes.end() ? -1 : it->second;
+}
+
+int Dictionary::add(const string &value) {
+    std::pair<std::unordered_map<string, int>::iterator, bool> ins = codes.insert(std::make_pair(value, (int) values.size()));
+    if (ins.second) values.push_back(value);
+    return ins.first->second;
+}
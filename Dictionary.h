@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef DICTIONARY_H
+#define DICTIONARY_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "Bruinbase.h"
+#include "PageFile.h"
+
+/**
+ * The distinct values of the value column of a table, kept in a side file
+ * next to the table. Every value is stored once and the records hold its
+ * code, the position of the value in the dictionary. Codes never change,
+ * so two values are equal iff their codes are.
+ */
+class Dictionary {
+public:
+
+    Dictionary();
+
+    /**
+     * read all values of the dictionary file into memory.
+     * @param filename[IN] the dictionary file name
+     * @return error code. 0 if no error
+     */
+    RC load(const std::string &filename);
+
+    /**
+     * write the values added since load() or the last save().
+     * the dictionary file is created if it does not exist.
+     * @param filename[IN] the dictionary file name
+     * @return error code. 0 if no error
+     */
+    RC save(const std::string &filename);
+
+    /**
+     * @param value[IN] a value
+     * @return the code of the value. -1 if the value is not in the dictionary
+     */
+    int getCode(const std::string &value) const;
+
+    /**
+     * add a value to the dictionary unless it is already there.
+     * @param value[IN] the value to add
+     * @return the code of the value
+     */
+    int add(const std::string &value);
+
+    /**
+     * @param code[IN] a code returned by add()
+     * @return the value of the code
+     */
+    const std::string &getValue(int code) const { return values[code]; }
+
+    /**
+     * @return # values in the dictionary
+     */
+    int getCount() const { return (int) values.size(); }
+
+private:
+    std::vector<std::string> values;               // the value of code i at index i
+    std::unordered_map<std::string, int> codes;    // the code of every value
+    std::vector<int> pageStarts;   // the code of the first value in every page of the file
+    int saved;                     // # values in the file
+};
+
+#endif /* DICTIONARY_H */
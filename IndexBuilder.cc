@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <cstdio>
+#include <algorithm>
+#include <atomic>
+#include <queue>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "IndexBuilder.h"
+
+using namespace std;
+
+// an entry of the index
+struct IndexEntry {
+    int key;
+    RecordId rid;
+};
+
+// the entries of a key are in RecordId order, as a LOAD inserts them
+static bool operator<(const IndexEntry &a, const IndexEntry &b) {
+    return a.key < b.key || (a.key == b.key && a.rid < b.rid);
+}
+
+// # entries a merge reads from a run file or writes at a time
+static const int IO_ENTRIES = 4096;
+
+// a sorted run of entries, in a temporary file or in memory
+struct Run {
+    string name;                  // the file of the run. empty if the run is in memory
+    vector<IndexEntry> entries;   // the run, if it is in memory
+};
+
+/**
+ * Reads the entries of a run in order.
+ */
+class RunReader {
+public:
+    RunReader(): file(NULL), entries(NULL), pos(0), end(0), error(false) { };
+    ~RunReader() { if (file != NULL) fclose(file); }
+
+    RC open(const Run &run);
+
+    // false at the end of the run, or if the file cannot be read
+    bool next(IndexEntry &entry);
+
+    // true if the file could not be read to its end
+    bool failed() const { return error; }
+
+private:
+    FILE *file;
+    const vector<IndexEntry> *entries;  // the run in memory. NULL if it is in a file
+    vector<IndexEntry> buffer;          // the entries read from the file last
+    size_t pos, end;
+    bool error;
+
+    // not copyable, because of the file
+    RunReader(const RunReader &);
+    RunReader &operator=(const RunReader &);
+};
+
+// the name of the n'th temporary file
+static string runName(const string &prefix, int n);
+
+// write the entries to a new run file
+static RC writeRun(const vector<IndexEntry> &entries, const string &name);
+
+// sort the entries of the table pages [begin, end) in runs of capacity
+// entries. the runs that fill up go to files, and the last one stays in memory
+static void scan(const RecordFile &rf, PageId begin, PageId end, size_t capacity,
+                 const string &prefix, atomic<int> &files, vector<Run> &runs, RC &rc);
+
+// merge the runs into the file out, or into the index bi if out is NULL
+static RC merge(const vector<Run> &runs, FILE *out, BTreeIndex *bi);
+
+RC IndexBuilder::build(const RecordFile &rf, BTreeIndex &bi, const string &prefix) {
+    RC rc = 0;
+    const RecordId &erid = rf.endRid();
+    int pages = erid.sid > 0 ? erid.pid + 1 : erid.pid;
+
+    int threads = (int) thread::hardware_concurrency();
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    if (threads > pages) threads = pages;
+    if (threads < 1) threads = 1;
+    size_t capacity = MEMORY_BUDGET / sizeof(IndexEntry) / threads;
+
+    // every thread scans a range of the pages. this thread takes the first
+    atomic<int> files(0);
+    vector<vector<Run> > scanned(threads);
+    vector<RC> rcs(threads, 0);
+    vector<thread> workers;
+    for (int t = 1; t < threads; t++) {
+        PageId begin = (PageId) ((long long) pages * t / threads);
+        PageId end = (PageId) ((long long) pages * (t + 1) / threads);
+        workers.push_back(thread([&, t, begin, end]() {
+            scan(rf, begin, end, capacity, prefix, files, scanned[t], rcs[t]);
+        }));
+    }
+    scan(rf, 0, pages / threads, capacity, prefix, files, scanned[0], rcs[0]);
+    vector<Run> runs;
+    for (int t = 0; t < threads; t++) {
+        if (t > 0) workers[t - 1].join();
+        if (rcs[t] < 0) rc = rcs[t];
+        for (unsigned i = 0; i < scanned[t].size(); i++) {
+            runs.push_back(Run());
+            runs.back().name = scanned[t][i].name;
+            runs.back().entries.swap(scanned[t][i].entries);
+        }
+    }
+
+    // merge groups of the run files side by side until one merge can read all runs
+    while (rc == 0 && runs.size() > (size_t) MERGE_FANIN) {
+        size_t inMemory = 0;
+        for (unsigned i = 0; i < runs.size(); i++) inMemory += runs[i].name.empty();
+        if (runs.size() - inMemory < 2) break;
+        vector<Run> next;
+        vector<vector<Run> > groups(1);
+        for (unsigned i = 0; i < runs.size(); i++) {
+            if (runs[i].name.empty()) {
+                // the runs in memory take part in the last merge only
+                next.push_back(Run());
+                next.back().entries.swap(runs[i].entries);
+                continue;
+            }
+            if (groups.back().size() == (size_t) MERGE_FANIN) groups.push_back(vector<Run>());
+            groups.back().push_back(runs[i]);
+        }
+        vector<Run> merged(groups.size());
+        vector<RC> groupRcs(groups.size(), 0);
+        atomic<int> group(0);
+        auto work = [&]() {
+            for (int g; (g = group++) < (int) groups.size();) {
+                if (groups[g].size() == 1) {
+                    merged[g] = groups[g][0];
+                    continue;
+                }
+                merged[g].name = runName(prefix, files++);
+                FILE *out = fopen(merged[g].name.c_str(), "wb");
+                if (out == NULL) {
+                    groupRcs[g] = RC_FILE_OPEN_FAILED;
+                    continue;
+                }
+                groupRcs[g] = merge(groups[g], out, NULL);
+                if (fclose(out) != 0 && groupRcs[g] == 0) groupRcs[g] = RC_FILE_WRITE_FAILED;
+                for (unsigned i = 0; i < groups[g].size(); i++) ::unlink(groups[g][i].name.c_str());
+            }
+        };
+        workers.clear();
+        for (int t = 1; t < threads && t < (int) groups.size(); t++) workers.push_back(thread(work));
+        work();
+        for (unsigned t = 0; t < workers.size(); t++) workers[t].join();
+        for (unsigned g = 0; g < groups.size(); g++) {
+            if (groupRcs[g] < 0) rc = groupRcs[g];
+            next.push_back(merged[g]);
+        }
+        runs.swap(next);
+    }
+
+    if (rc == 0) rc = merge(runs, NULL, &bi);
+    if (rc == 0) rc = bi.bulkFinish();
+
+    // every temporary file, including the ones an error left behind
+    for (int n = 0; n < files; n++) ::unlink(runName(prefix, n).c_str());
+    return rc;
+}
+
+RC RunReader::open(const Run &run) {
+    if (run.name.empty()) {
+        entries = &run.entries;
+        end = entries->size();
+        return 0;
+    }
+    if ((file = fopen(run.name.c_str(), "rb")) == NULL) return RC_FILE_OPEN_FAILED;
+    buffer.resize(IO_ENTRIES);
+    return 0;
+}
+
+bool RunReader::next(IndexEntry &entry) {
+    if (pos == end) {
+        if (file == NULL) return false;
+        pos = 0;
+        end = fread(&buffer[0], sizeof(IndexEntry), IO_ENTRIES, file);
+        if (end == 0) {
+            error = ferror(file) != 0;
+            return false;
+        }
+    }
+    entry = file != NULL ? buffer[pos++] : (*entries)[pos++];
+    return true;
+}
+
+static string runName(const string &prefix, int n) {
+    char suffix[32];
+    sprintf(suffix, "%d.tmp", n);
+    return prefix + suffix;
+}
+
+static RC writeRun(const vector<IndexEntry> &entries, const string &name) {
+    FILE *file = fopen(name.c_str(), "wb");
+    if (file == NULL) return RC_FILE_OPEN_FAILED;
+    size_t written = fwrite(&entries[0], sizeof(IndexEntry), entries.size(), file);
+    if (fclose(file) != 0 || written != entries.size()) return RC_FILE_WRITE_FAILED;
+    return 0;
+}
+
+static void scan(const RecordFile &rf, PageId begin, PageId end, size_t capacity,
+                 const string &prefix, atomic<int> &files, vector<Run> &runs, RC &rc) {
+    vector<IndexEntry> entries;
+    int keys[RecordFile::RECORDS_PER_PAGE];
+
+    entries.reserve(min(capacity, (size_t) (end - begin) * RecordFile::RECORDS_PER_PAGE) + RecordFile::RECORDS_PER_PAGE);
+    rc = 0;
+    for (PageId pid = begin; pid < end; pid++) {
+        int count;
+        if ((rc = rf.readKeys(pid, keys, count)) < 0) return;
+        for (int sid = 0; sid < count; sid++) {
+            IndexEntry entry;
+            entry.key = keys[sid];
+            entry.rid.pid = pid;
+            entry.rid.sid = sid;
+            entries.push_back(entry);
+        }
+        if (entries.size() >= capacity) {
+            sort(entries.begin(), entries.end());
+            runs.push_back(Run());
+            runs.back().name = runName(prefix, files++);
+            if ((rc = writeRun(entries, runs.back().name)) < 0) return;
+            entries.clear();
+        }
+    }
+    if (!entries.empty()) {
+        sort(entries.begin(), entries.end());
+        runs.push_back(Run());
+        runs.back().entries.swap(entries);
+    }
+}
+
+static RC merge(const vector<Run> &runs, FILE *out, BTreeIndex *bi) {
+    RC rc;
+    vector<RunReader> readers(runs.size());
+
+    // the next entry of every run, smallest on top
+    typedef pair<IndexEntry, int> Head;
+    struct Later {
+        bool operator()(const Head &a, const Head &b) const { return b.first < a.first; }
+    };
+    priority_queue<Head, vector<Head>, Later> heads;
+    for (unsigned i = 0; i < runs.size(); i++) {
+        if ((rc = readers[i].open(runs[i])) < 0) return rc;
+        IndexEntry entry;
+        if (readers[i].next(entry)) heads.push(Head(entry, i));
+    }
+
+    vector<IndexEntry> written;
+    written.reserve(IO_ENTRIES);
+    while (!heads.empty()) {
+        Head head = heads.top();
+        heads.pop();
+        if (out == NULL) {
+            if ((rc = bi->bulkInsert(head.first.key, head.first.rid)) < 0) return rc;
+        } else {
+            written.push_back(head.first);
+            if (written.size() == (size_t) IO_ENTRIES) {
+                if (fwrite(&written[0], sizeof(IndexEntry), written.size(), out) != written.size()) {
+                    return RC_FILE_WRITE_FAILED;
+                }
+                written.clear();
+            }
+        }
+        if (readers[head.second].next(head.first)) heads.push(head);
+    }
+    if (!written.empty() && fwrite(&written[0], sizeof(IndexEntry), written.size(), out) != written.size()) {
+        return RC_FILE_WRITE_FAILED;
+    }
+    for (unsigned i = 0; i < readers.size(); i++) {
+        if (readers[i].failed()) return RC_FILE_READ_FAILED;
+    }
+    return 0;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef INDEXBUILDER_H
+#define INDEXBUILDER_H
+
+#include <string>
+#include "Bruinbase.h"
+#include "RecordFile.h"
+#include "BTreeIndex.h"
+
+/**
+ * Builds the B+tree index of a table that has rows already, e.g., for
+ * CREATE INDEX. A few threads scan a part of the table file each and sort
+ * the (key, RecordId) pairs they read in runs that take MEMORY_BUDGET
+ * bytes between them. The runs that fill up go to temporary files. When
+ * there are more runs than one merge reads at once, threads merge groups
+ * of MERGE_FANIN runs into longer ones side by side. The last merge feeds
+ * the pairs in key order to BTreeIndex::bulkInsert().
+ */
+class IndexBuilder {
+public:
+
+    // # bytes of pairs the threads sort in memory at once
+    static const size_t MEMORY_BUDGET = 16 * 1024 * 1024;
+
+    // # threads that scan and merge at most
+    static const int MAX_THREADS = 4;
+
+    // # runs a merge reads at once
+    static const int MERGE_FANIN = 32;
+
+    /**
+     * build the empty index on the keys of the records in the table file.
+     * @param rf[IN] the table file
+     * @param bi[IN/OUT] the empty index
+     * @param prefix[IN] the temporary files are named prefix, a number and ".tmp"
+     * @return error code. 0 if no error
+     */
+    static RC build(const RecordFile &rf, BTreeIndex &bi, const std::string &prefix);
+};
+
+#endif /* INDEXBUILDER_H */
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <algorithm>
+#include <climits>
+#include "Bruinbase.h"
+#include "MemTable.h"
+
+using std::string;
+using std::pair;
+using std::make_pair;
+
+MemTable::MemTable() : indexed(0), saved(0), savedAt(time(NULL)) {
+}
+
+RC MemTable::load(const RecordFile &rf) {
+    RC rc;
+    RecordId rid;
+    int key;
+    string value;
+
+    for (rid.pid = rid.sid = 0; rid < rf.endRid(); ++rid) {
+        if ((rc = rf.read(rid, key, value)) < 0) return rc;
+        append(key, value);
+    }
+    setSaved(getRowCount());
+    return 0;
+}
+
+void MemTable::append(int key, const string &value) {
+    // keep the values as the table file would
+    index.push_back(make_pair(key, getRowCount()));
+    keys.push_back(key);
+    values.push_back(value.substr(0, RecordFile::MAX_VALUE_LENGTH - 1));
+
+    // rows appended in key order keep the index sorted
+    if (indexed == (int) index.size() - 1 && (indexed == 0 || index[indexed - 1].first <= key)) indexed++;
+}
+
+void MemTable::lookup(int minKey, int maxKey, int &first, int &last) const {
+    std::lock_guard<std::mutex> guard(sortLock);
+    if (indexed < (int) index.size()) {
+        // sort the pairs added since the last lookup and merge them in
+        std::sort(index.begin() + indexed, index.end());
+        std::inplace_merge(index.begin(), index.begin() + indexed, index.end());
+        indexed = (int) index.size();
+    }
+    first = std::lower_bound(index.begin(), index.end(), make_pair(minKey, INT_MIN)) - index.begin();
+    last = std::upper_bound(index.begin(), index.end(), make_pair(maxKey, INT_MAX)) - index.begin();
+}
+
+RecordId MemTable::toRid(int row) {
+    RecordId rid;
+    rid.pid = row / RecordFile::RECORDS_PER_PAGE;
+    rid.sid = row % RecordFile::RECORDS_PER_PAGE;
+    return rid;
+}
+
+void MemTable::setSaved(int n) {
+    saved = n;
+    savedAt = time(NULL);
+}
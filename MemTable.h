@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef MEMTABLE_H
+#define MEMTABLE_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <ctime>
+#include <mutex>
+#include "Bruinbase.h"
+#include "RecordFile.h"
+
+/**
+ * A whole table held in memory, with its key index as a sorted array of
+ * (key, row) pairs. Row i is the record at the i'th record id of the table
+ * file, so a snapshot only appends the rows added since the last one.
+ */
+class MemTable {
+public:
+
+    MemTable();
+
+    /**
+     * read all records of the table file into memory.
+     * @param rf[IN] the table file
+     * @return error code. 0 if no error
+     */
+    RC load(const RecordFile &rf);
+
+    /**
+     * add a row at the end of the table.
+     * @param key[IN] the key of the row
+     * @param value[IN] the value of the row
+     */
+    void append(int key, const std::string &value);
+
+    /**
+     * @return # rows in the table
+     */
+    int getRowCount() const { return (int) keys.size(); }
+
+    int getKey(int row) const { return keys[row]; }
+
+    const std::string &getValue(int row) const { return values[row]; }
+
+    /**
+     * find the rows with a key in [minKey, maxKey]. the rows are
+     * getIndexedRow(first), ..., getIndexedRow(last - 1) in key order.
+     * @param minKey[IN] the smallest key to find
+     * @param maxKey[IN] the largest key to find
+     * @param first[OUT] the position of the first row in key order
+     * @param last[OUT] the position behind the last row in key order
+     */
+    void lookup(int minKey, int maxKey, int &first, int &last) const;
+
+    /**
+     * @param pos[IN] a position returned by lookup()
+     * @return the row at the position in key order
+     */
+    int getIndexedRow(int pos) const { return index[pos].second; }
+
+    /**
+     * @param row[IN] a row of the table
+     * @return the record id of the row in the table file
+     */
+    static RecordId toRid(int row);
+
+    /**
+     * @return # rows already in the table file
+     */
+    int getSavedCount() const { return saved; }
+
+    /**
+     * @return the time of the last snapshot
+     */
+    time_t getSavedTime() const { return savedAt; }
+
+    /**
+     * note that the rows before row n are in the table file now.
+     * @param n[IN] # rows in the table file
+     */
+    void setSaved(int n);
+
+private:
+    std::vector<int> keys;            // the key of row i at index i
+    std::vector<std::string> values;  // the value of row i at index i
+
+    // (key, row) of every row. the first indexed pairs are sorted by
+    // key and then row, the ones behind are sorted on the next lookup
+    mutable std::vector<std::pair<int, int> > index;
+    mutable int indexed;
+    mutable std::mutex sortLock;   // readers running at once sort the pairs one at a time
+
+    int saved;
+    time_t savedAt;
+};
+
+#endif /* MEMTABLE_H */
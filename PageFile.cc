@@ -9,33 +9,206 @@
 
 #include "Bruinbase.h"
 #include "PageFile.h"
+#include "WriteAheadLog.h"
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <cstring>
+#include <algorithm>
+#include <climits>
 
 using std::string;
+using std::vector;
+
+//
+// the compressed format
+//
+
+// the first int of the header page of a compressed file
+static const int COMPRESSED_MAGIC = 0x5a504643;
+
+// # pages the translation map may take
+static const int MAX_MAP_PAGES = PageFile::PAGE_SIZE / sizeof(int) - 4;
+
+// the header page of a compressed file
+typedef struct {
+    int magic;
+    PageId epid;       // # pages the file holds
+    int extentCount;
+    int mapPageCount;
+    PageId mapPages[MAX_MAP_PAGES];
+} CompressedHeader;
+
+// # extents a page of the translation map points to
+static const int MAP_ENTRIES = PageFile::PAGE_SIZE / sizeof(PageId);
+
+// # bytes of the pages of an extent
+static const int EXTENT_BYTES = PageFile::EXTENT_PAGES * PageFile::PAGE_SIZE;
+
+// # bytes compress() may write for EXTENT_BYTES of input
+static const int COMPRESS_BOUND = EXTENT_BYTES + EXTENT_BYTES / 255 + 16;
+
+//
+// an LZ77 compressor in the style of LZ4: a token with the literal length
+// and the match length in its two nibbles (15 means more length bytes
+// follow), the literals, and a two-byte offset for the match. the last
+// sequence has literals only.
+//
+
+static const int MIN_MATCH = 4;
+static const int HASH_BITS = 12;
+
+static unsigned int read32(const unsigned char *p) {
+    unsigned int x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+static unsigned char *putLength(unsigned char *op, int length) {
+    for (; length >= 255; length -= 255) *op++ = 255;
+    *op++ = (unsigned char) length;
+    return op;
+}
 
-int PageFile::readCount = 0;
-int PageFile::writeCount = 0;
-int PageFile::cacheClock = 1;
-struct PageFile::cacheStruct PageFile::readCache[PageFile::CACHE_COUNT];
+// compress n bytes of src into dst. return # bytes written
+static int compress(const char *src, int n, char *dst) {
+    const unsigned char *in = (const unsigned char *) src;
+    unsigned char *op = (unsigned char *) dst;
+    int table[1 << HASH_BITS];
+    for (int i = 0; i < (1 << HASH_BITS); i++) table[i] = -1;
+
+    int anchor = 0, ip = 0;
+    while (ip + MIN_MATCH <= n) {
+        unsigned int h = (read32(in + ip) * 2654435761U) >> (32 - HASH_BITS);
+        int ref = table[h];
+        table[h] = ip;
+        if (ref < 0 || ip - ref > 0xffff || read32(in + ref) != read32(in + ip)) {
+            ip++;
+            continue;
+        }
+        int length = MIN_MATCH;
+        while (ip + length < n && in[ref + length] == in[ip + length]) length++;
+
+        int literals = ip - anchor;
+        unsigned char *token = op++;
+        *token = (unsigned char) ((literals < 15 ? literals : 15) << 4);
+        if (literals >= 15) op = putLength(op, literals - 15);
+        memcpy(op, in + anchor, literals);
+        op += literals;
+        *op++ = (unsigned char) ((ip - ref) & 0xff);
+        *op++ = (unsigned char) ((ip - ref) >> 8);
+        int extra = length - MIN_MATCH;
+        *token |= (unsigned char) (extra < 15 ? extra : 15);
+        if (extra >= 15) op = putLength(op, extra - 15);
+        ip += length;
+        anchor = ip;
+    }
+
+    int literals = n - anchor;
+    *op++ = (unsigned char) ((literals < 15 ? literals : 15) << 4);
+    if (literals >= 15) op = putLength(op, literals - 15);
+    memcpy(op, in + anchor, literals);
+    op += literals;
+    return (int) (op - (unsigned char *) dst);
+}
+
+// decompress n bytes of src into dst of capacity bytes. return # bytes written, or -1 if src is corrupt
+static int decompress(const char *src, int n, char *dst, int capacity) {
+    const unsigned char *ip = (const unsigned char *) src, *end = ip + n;
+    unsigned char *out = (unsigned char *) dst, *op = out;
+    while (ip < end) {
+        int token = *ip++;
+        int literals = token >> 4;
+        if (literals == 15) {
+            int b;
+            do {
+                if (ip >= end) return -1;
+                literals += b = *ip++;
+            } while (b == 255);
+        }
+        if (literals > end - ip || literals > capacity - (op - out)) return -1;
+        memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+        if (ip == end) break;
+
+        if (end - ip < 2) return -1;
+        int offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        int length = (token & 15) + MIN_MATCH;
+        if ((token & 15) == 15) {
+            int b;
+            do {
+                if (ip >= end) return -1;
+                length += b = *ip++;
+            } while (b == 255);
+        }
+        if (offset == 0 || offset > op - out || length > capacity - (op - out)) return -1;
+        // the match may overlap the bytes it produces, so copy byte by byte
+        for (const unsigned char *ref = op - offset; length > 0; length--) *op++ = *ref++;
+    }
+    return (int) (op - out);
+}
+
+std::atomic<int> PageFile::readCount(0);
+std::atomic<int> PageFile::writeCount(0);
+struct PageFile::cacheStruct PageFile::readCache[PageFile::CACHE_SHARDS][PageFile::CACHE_COUNT];
+struct PageFile::cacheShard PageFile::cacheShards[PageFile::CACHE_SHARDS];
+std::mutex PageFile::hotLock;
+long long PageFile::hotClock = 0;
+std::map<std::pair<std::string, PageId>, long long> PageFile::hotPages;
+std::map<long long, std::pair<std::string, PageId> > PageFile::hotTicks;
+long long PageFile::version = 0;
+long long PageFile::nextVersion = 1;
+std::mutex PageFile::versionLock;
+std::set<long long> PageFile::writingVersions;
+std::condition_variable PageFile::versionEnded;
+std::map<std::string, std::multiset<long long> > PageFile::snapshots;
+std::map<std::pair<std::string, PageId>, std::map<long long, std::vector<char> > > PageFile::oldPages;
+std::atomic<int> PageFile::oldPageCount(0);
+std::map<std::string, std::map<long long, PageId> > PageFile::oldEnds;
+
+// the version the files this thread opens for reading read, while snapshotDepth > 0
+static thread_local int snapshotDepth = 0;
+static thread_local long long threadSnapshot = 0;
+
+typedef std::lock_guard<std::recursive_mutex> FileGuard;
+typedef std::lock_guard<std::mutex> Guard;
+
+// raise an end page id to at least end, while other threads may raise it, too
+static void raiseEnd(std::atomic<PageId> &pid, PageId end) {
+    PageId seen = pid;
+    while (seen < end && !pid.compare_exchange_weak(seen, end)) { }
+}
 
 PageFile::PageFile() {
     fd = -1;
     epid = 0;
+    compressed = false;
+    fileEnd = 0;
+    memoExtent = -1;
+    snapshot = LATEST;
 }
 
 PageFile::PageFile(const string &filename, char mode) {
     fd = -1;
     epid = 0;
+    compressed = false;
+    fileEnd = 0;
+    memoExtent = -1;
+    snapshot = LATEST;
     open(filename.c_str(), mode);
 }
 
-RC PageFile::open(const string &filename, char mode) {
+PageFile::~PageFile() {
+    if (fd > 0) close();
+}
+
+RC PageFile::open(const string &filename, char mode, bool compressed) {
     RC rc;
     int oflag;
     struct stat statbuf;
+    FileGuard guard(fileLock);
 
     if (fd > 0) return RC_FILE_OPEN_FAILED;
 
@@ -67,29 +240,108 @@ RC PageFile::open(const string &filename, char mode) {
         fd = -1;
         return RC_FILE_OPEN_FAILED;
     }
-    epid = statbuf.st_size / PAGE_SIZE;
+    // a file read at a snapshot ends where it ended then
+    name = filename;
+    PageId end = (PageId) (statbuf.st_size / PAGE_SIZE);
+    if (oflag == O_RDONLY) {
+        Guard versionGuard(versionLock);
+        snapshot = snapshotDepth > 0 ? threadSnapshot : version;
+        snapshots[name].insert(snapshot);
+        std::map<std::string, std::map<long long, PageId> >::iterator ends = oldEnds.find(name);
+        if (ends != oldEnds.end()) {
+            std::map<long long, PageId>::iterator later = ends->second.upper_bound(snapshot);
+            if (later != ends->second.end()) end = later->second;
+        }
+    } else {
+        snapshot = LATEST;
+    }
 
+    // the pages a transaction of this thread wrote are not in the file yet
+    end = std::max(end, WriteAheadLog::fileEnd(name));
+    epid = end;
+    fileEnd = end;
+    this->compressed = false;
+    extents.clear();
+    mapPages.clear();
+    memoExtent = -1;
+
+    if (epid == 0) {
+        if (!compressed || oflag == O_RDONLY) return 0;
+        // a new compressed file starts with an empty header
+        this->compressed = true;
+        if ((rc = writeHeader()) < 0) {
+            close();
+            return rc;
+        }
+        return 0;
+    }
+
+    // a compressed file has the magic number in front
+    int magic;
+    char first[PAGE_SIZE];
+    if (WriteAheadLog::read(name, 0, first) || readOverwritten(0, first)) memcpy(&magic, first, sizeof(magic));
+    else if (::pread(fd, &magic, sizeof(magic), 0) != sizeof(magic)) return 0;
+    if (magic != COMPRESSED_MAGIC) return 0;
+
+    CompressedHeader header;
+    if ((rc = readPhysical(0, &header)) < 0) {
+        close();
+        return rc;
+    }
+    this->compressed = true;
+    epid = header.epid;
+    mapPages.assign(header.mapPages, header.mapPages + header.mapPageCount);
+    for (int i = 0; i < header.mapPageCount; i++) {
+        PageId map[MAP_ENTRIES];
+        if ((rc = readPhysical(mapPages[i], map)) < 0) {
+            close();
+            return rc;
+        }
+        int n = header.extentCount - i * MAP_ENTRIES;
+        extents.insert(extents.end(), map, map + (n < MAP_ENTRIES ? n : MAP_ENTRIES));
+    }
     return 0;
 }
 
 RC PageFile::close() {
+    FileGuard guard(fileLock);
     if (fd <= 0) return RC_FILE_CLOSE_FAILED;
 
+    // evict all cached pages for this file, before another file gets its fd
+    for (int s = 0; s < CACHE_SHARDS; s++) {
+        Guard shardGuard(cacheShards[s].lock);
+        for (int i = 0; i < CACHE_COUNT; i++) {
+            if (readCache[s][i].fd == fd && readCache[s][i].lastAccessed != 0) {
+                readCache[s][i].fd = 0;
+                readCache[s][i].pid = 0;
+                readCache[s][i].lastAccessed = 0;
+            }
+        }
+    }
+
     // close the file
     if (::close(fd) < 0) return RC_FILE_CLOSE_FAILED;
 
-    // evict all cached pages for this file
-    for (int i = 0; i < CACHE_COUNT; i++) {
-        if (readCache[i].fd == fd && readCache[i].lastAccessed != 0) {
-            readCache[i].fd = 0;
-            readCache[i].pid = 0;
-            readCache[i].lastAccessed = 0;
-        }
+    // the pages later versions overwrote may not be needed any more
+    if (snapshot != LATEST) {
+        Guard versionGuard(versionLock);
+        std::multiset<long long> &open = snapshots[name];
+        open.erase(open.find(snapshot));
+        if (open.empty()) snapshots.erase(name);
+        prune(name);
     }
 
     // set the fd and epid to the initial state
     fd = -1;
     epid = 0;
+    name.clear();
+    snapshot = LATEST;
+    compressed = false;
+    fileEnd = 0;
+    extents.clear();
+    mapPages.clear();
+    memoExtent = -1;
+    vector<char>().swap(memo);
     return 0;
 }
 
@@ -97,33 +349,83 @@ PageId PageFile::endPid() const {
     return epid;
 }
 
-RC PageFile::seek(PageId pid) const {
-    return (::lseek(fd, pid * PAGE_SIZE, SEEK_SET) < 0) ? RC_FILE_SEEK_FAILED : 0;
-}
-
 RC PageFile::write(PageId pid, const void *buffer) {
     RC rc;
     if (pid < 0) return RC_INVALID_PID;
 
-    // seek to the location of the page
-    if ((rc = seek(pid)) < 0) return rc;
+    if (!compressed) {
+        if ((rc = writePhysical(pid, buffer)) < 0) return rc;
+        // if the written pid >= end pid, update the end pid
+        raiseEnd(epid, pid + 1);
+        return 0;
+    }
 
-    // write the buffer to the disk page
-    if (::write(fd, buffer, PAGE_SIZE) < 0) return RC_FILE_WRITE_FAILED;
+    FileGuard guard(fileLock);
+    int sealed = (int) extents.size() * EXTENT_PAGES;
+    if (pid < sealed) {
+        // the page is compressed in an extent. write a new version of the extent
+        int extent = pid / EXTENT_PAGES;
+        if ((rc = readExtent(extent)) < 0) return rc;
+        memcpy(&memo[(pid % EXTENT_PAGES) * PAGE_SIZE], buffer, PAGE_SIZE);
+        return writeExtent(extent, &memo[0]);
+    }
 
-    // if the page is in read cache, invalidate it
-    for (int i = 0; i < CACHE_COUNT; i++) {
-        if (readCache[i].fd == fd && readCache[i].pid == pid &&
-            readCache[i].lastAccessed != 0) {
-            readCache[i].fd = 0;
-            readCache[i].pid = 0;
-            readCache[i].lastAccessed = 0;
-            break;
-        }
+    // make room in the tail slots first if the page is behind them
+    while (pid >= (int) (extents.size() + 1) * EXTENT_PAGES) {
+        if ((rc = seal()) < 0) return rc;
     }
+    if ((rc = writePhysical(1 + pid % EXTENT_PAGES, buffer)) < 0) return rc;
+    if (pid >= epid) {
+        epid = pid + 1;
+        return writeHeader();
+    }
+    return 0;
+}
 
-    // if the written pid >= end pid, update the end pid
-    if (pid >= epid) epid = pid + 1;
+PageId PageFile::allocate() {
+    RC rc;
+    char page[PAGE_SIZE];
+
+    memset(page, 0, PAGE_SIZE);
+    if (!compressed) {
+        // the page is taken before it is written
+        PageId pid = epid++;
+        if ((rc = writePhysical(pid, page)) < 0) return rc;
+        return pid;
+    }
+
+    FileGuard guard(fileLock);
+    PageId pid = epid;
+    if ((rc = write(pid, page)) < 0) return rc;
+    return pid;
+}
+
+RC PageFile::read(PageId pid, void *buffer) const {
+    RC rc;
+
+    if (pid < 0 || pid >= epid) return RC_INVALID_PID;
+    if (!compressed) return readPhysical(pid, buffer);
+
+    FileGuard guard(fileLock);
+    if (pid >= (int) extents.size() * EXTENT_PAGES) {
+        return readPhysical(1 + pid % EXTENT_PAGES, buffer);
+    }
+    if ((rc = readExtent(pid / EXTENT_PAGES)) < 0) return rc;
+    memcpy(buffer, &memo[(pid % EXTENT_PAGES) * PAGE_SIZE], PAGE_SIZE);
+    return 0;
+}
+
+RC PageFile::writePhysical(PageId pid, const void *buffer) {
+    // in a transaction, the page goes to the file when the transaction commits
+    if (!WriteAheadLog::write(name, pid, buffer)) {
+        // write the buffer to the disk page
+        if (::pwrite(fd, buffer, PAGE_SIZE, (off_t) pid * PAGE_SIZE) != PAGE_SIZE) return RC_FILE_WRITE_FAILED;
+    }
+
+    // if the page is in read cache, invalidate it
+    uncache(fd, name, pid);
+
+    raiseEnd(fileEnd, pid + 1);
 
     // increase page write count
     writeCount++;
@@ -131,49 +433,347 @@ RC PageFile::write(PageId pid, const void *buffer) {
     return 0;
 }
 
-RC PageFile::read(PageId pid, void *buffer) const {
-    RC rc;
+RC PageFile::readPhysical(PageId pid, void *buffer) const {
+    // a page the transaction of this thread wrote is not in the file yet
+    if (WriteAheadLog::read(name, pid, buffer)) return 0;
+
+    cacheShard &shard = cacheShards[pid % CACHE_SHARDS];
+    cacheStruct *cache = readCache[pid % CACHE_SHARDS];
+    char page[PAGE_SIZE];
+    long long dropped;
+    {
+        Guard guard(shard.lock);
+        dropped = shard.dropped;
+    }
 
-    if (pid < 0 || pid >= epid) return RC_INVALID_PID;
+    // start over whenever a page of the shard was dropped meanwhile, since
+    // it may be this page, written by a version the snapshot does not read
+    for (;;) {
+        // neither is a page a version after the snapshot overwrote
+        if (readOverwritten(pid, buffer)) return 0;
+
+        //
+        // if the page is in cache, read it from there
+        //
+        {
+            Guard guard(shard.lock);
+            if (shard.dropped != dropped) {
+                dropped = shard.dropped;
+                continue;
+            }
+            for (int i = 0; i < CACHE_COUNT; i++) {
+                if (cache[i].fd == fd && cache[i].pid == pid &&
+                    cache[i].lastAccessed != 0) {
+                    memcpy(buffer, cache[i].buffer, PAGE_SIZE);
+                    cache[i].lastAccessed = ++shard.clock;
+                    return 0;
+                }
+            }
+        }
 
-    //
-    // if the page is in cache, read it from there
-    //
-    for (int i = 0; i < CACHE_COUNT; i++) {
-        if (readCache[i].fd == fd && readCache[i].pid == pid &&
-            readCache[i].lastAccessed != 0) {
-            memcpy(buffer, readCache[i].buffer, PAGE_SIZE);
-            readCache[i].lastAccessed = ++cacheClock;
-            return 0;
+        // read the page without holding the lock. the part behind the end
+        // of the file reads as zeros
+        ssize_t n = ::pread(fd, page, PAGE_SIZE, (off_t) pid * PAGE_SIZE);
+        if (n < 0) return RC_FILE_READ_FAILED;
+        memset(page + n, 0, PAGE_SIZE - n);
+
+        {
+            Guard guard(shard.lock);
+            if (shard.dropped != dropped) {
+                dropped = shard.dropped;
+                continue;
+            }
+
+            // find the cache slot to evict
+            int toEvict = 0;
+            for (int i = 0; i < CACHE_COUNT; i++) {
+                if (cache[i].lastAccessed == 0) {
+                    toEvict = i;
+                    break;
+                }
+                if (cache[i].lastAccessed < cache[toEvict].lastAccessed) {
+                    toEvict = i;
+                }
+            }
+            cache[toEvict].fd = fd;
+            cache[toEvict].name = name;
+            cache[toEvict].pid = pid;
+            cache[toEvict].lastAccessed = ++shard.clock;
+            memcpy(cache[toEvict].buffer, page, PAGE_SIZE);
         }
+        break;
+    }
+    memcpy(buffer, page, PAGE_SIZE);
+
+    // increase the page read count
+    readCount++;
+
+    // the page becomes the most recent hot page
+    Guard guard(hotLock);
+    long long &tick = hotPages[std::make_pair(name, pid)];
+    if (tick != 0) hotTicks.erase(tick);
+    tick = ++hotClock;
+    hotTicks[tick] = std::make_pair(name, pid);
+    if ((int) hotTicks.size() > HOT_PAGE_COUNT) {
+        hotPages.erase(hotTicks.begin()->second);
+        hotTicks.erase(hotTicks.begin());
     }
 
-    // seek to the page
-    if ((rc = seek(pid)) < 0) return rc;
+    return 0;
+}
 
-    // find the cache slot to evict
-    int toEvict = 0;
+void PageFile::uncache(int fd, const std::string &filename, PageId pid) {
+    cacheShard &shard = cacheShards[pid % CACHE_SHARDS];
+    cacheStruct *cache = readCache[pid % CACHE_SHARDS];
+    Guard guard(shard.lock);
+    shard.dropped++;
     for (int i = 0; i < CACHE_COUNT; i++) {
-        if (readCache[i].lastAccessed == 0) {
-            toEvict = i;
-            break;
+        if (cache[i].lastAccessed != 0 && cache[i].pid == pid &&
+            (fd >= 0 ? cache[i].fd == fd : cache[i].name == filename)) {
+            cache[i].fd = 0;
+            cache[i].pid = 0;
+            cache[i].lastAccessed = 0;
         }
-        if (readCache[i].lastAccessed < readCache[toEvict].lastAccessed) {
-            toEvict = i;
+    }
+}
+
+bool PageFile::readOverwritten(PageId pid, void *buffer) const {
+    if (oldPageCount == 0 || snapshot == LATEST) return false;
+    Guard guard(versionLock);
+    std::map<std::pair<std::string, PageId>, std::map<long long, std::vector<char> > >::const_iterator page =
+        oldPages.find(std::make_pair(name, pid));
+    if (page == oldPages.end()) return false;
+
+    // the first version after the snapshot overwrote the page the snapshot reads
+    std::map<long long, std::vector<char> >::const_iterator later = page->second.upper_bound(snapshot);
+    if (later == page->second.end()) return false;
+    memcpy(buffer, &later->second[0], PAGE_SIZE);
+    return true;
+}
+
+void PageFile::beginSnapshot() {
+    Guard guard(versionLock);
+    if (snapshotDepth++ > 0) return;
+    threadSnapshot = version;
+    // until the files are open, the snapshot keeps the pages it reads
+    snapshots[std::string()].insert(threadSnapshot);
+}
+
+void PageFile::endSnapshot() {
+    Guard guard(versionLock);
+    if (--snapshotDepth > 0) return;
+    std::multiset<long long> &open = snapshots[std::string()];
+    open.erase(open.find(threadSnapshot));
+    if (open.empty()) snapshots.erase(std::string());
+}
+
+long long PageFile::beginVersion() {
+    Guard guard(versionLock);
+    long long v = nextVersion++;
+    writingVersions.insert(v);
+    return v;
+}
+
+RC PageFile::writeVersion(const std::string &filename, int fd, PageId ppid, const void *buffer, long long v) {
+    // only this thread writes the pages of the version to the file, so the
+    // file does not change between the checks and the writes below
+    PageId before;
+    {
+        Guard guard(versionLock);
+        std::map<long long, PageId> &ends = oldEnds[filename];
+        std::map<long long, PageId>::iterator end = ends.find(v);
+        before = end == ends.end() ? -1 : end->second;
+    }
+
+    // the first page of the version remembers where the file ended before
+    if (before < 0) {
+        struct stat statbuf;
+        if (::fstat(fd, &statbuf) < 0) return RC_FILE_WRITE_FAILED;
+        before = (PageId) (statbuf.st_size / PAGE_SIZE);
+        Guard guard(versionLock);
+        oldEnds[filename][v] = before;
+    }
+
+    // keep the page it overwrites for the files reading an older version,
+    // including the ones opened before the version ends
+    if (ppid < before) {
+        std::vector<char> old(PAGE_SIZE);
+        if (::pread(fd, &old[0], PAGE_SIZE, (off_t) ppid * PAGE_SIZE) != PAGE_SIZE) return RC_FILE_READ_FAILED;
+        Guard guard(versionLock);
+        std::map<long long, std::vector<char> > &versions = oldPages[std::make_pair(filename, ppid)];
+        if (versions.empty()) oldPageCount++;
+        versions[v].swap(old);
+    }
+
+    // the cached copies of the page are stale. a read of the page while it
+    // is written drops the copy it read, too
+    uncache(-1, filename, ppid);
+    if (::pwrite(fd, buffer, PAGE_SIZE, (off_t) ppid * PAGE_SIZE) != PAGE_SIZE) return RC_FILE_WRITE_FAILED;
+    uncache(-1, filename, ppid);
+    return 0;
+}
+
+void PageFile::endVersion(long long v) {
+    std::unique_lock<std::mutex> guard(versionLock);
+    writingVersions.erase(v);
+    version = writingVersions.empty() ? nextVersion - 1 : *writingVersions.begin() - 1;
+    versionEnded.notify_all();
+    while (version < v) versionEnded.wait(guard);
+
+    std::vector<std::string> written;
+    for (std::map<std::string, std::map<long long, PageId> >::iterator it = oldEnds.begin(); it != oldEnds.end(); ++it) {
+        written.push_back(it->first);
+    }
+    for (unsigned i = 0; i < written.size(); i++) prune(written[i]);
+}
+
+void PageFile::prune(const std::string &filename) {
+    // a page a version overwrote is read by the snapshots before the
+    // version, including the ones of the files opened for reading from now on
+    long long oldest = version;
+    std::map<std::string, std::multiset<long long> >::iterator open = snapshots.find(filename);
+    if (open != snapshots.end()) oldest = std::min(oldest, *open->second.begin());
+    open = snapshots.find(std::string());
+    if (open != snapshots.end()) oldest = std::min(oldest, *open->second.begin());
+
+    std::map<std::string, std::map<long long, PageId> >::iterator ends = oldEnds.find(filename);
+    if (ends == oldEnds.end()) return;
+    ends->second.erase(ends->second.begin(), ends->second.upper_bound(oldest));
+    if (ends->second.empty()) oldEnds.erase(ends);
+
+    std::map<std::pair<std::string, PageId>, std::map<long long, std::vector<char> > >::iterator page =
+        oldPages.lower_bound(std::make_pair(filename, (PageId) INT_MIN));
+    while (page != oldPages.end() && page->first.first == filename) {
+        page->second.erase(page->second.begin(), page->second.upper_bound(oldest));
+        if (page->second.empty()) {
+            oldPages.erase(page++);
+            oldPageCount--;
+        } else {
+            ++page;
         }
     }
-    readCache[toEvict].fd = fd;
-    readCache[toEvict].pid = pid;
-    readCache[toEvict].lastAccessed = ++cacheClock;
+}
 
-    // read the page to cache first and copy it to the buffer
-    if (::read(fd, readCache[toEvict].buffer, PAGE_SIZE) < 0) {
-        return RC_FILE_READ_FAILED;
+void PageFile::getHotPages(std::vector<std::pair<std::string, PageId> > &pages) {
+    Guard guard(hotLock);
+    pages.clear();
+    for (std::map<long long, std::pair<std::string, PageId> >::reverse_iterator it = hotTicks.rbegin();
+         it != hotTicks.rend(); ++it) {
+        pages.push_back(it->second);
     }
-    memcpy(buffer, readCache[toEvict].buffer, PAGE_SIZE);
+}
 
-    // increase the page read count
-    readCount++;
+RC PageFile::prefetch(const std::string &filename, const std::vector<PageId> &ppids) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return RC_FILE_OPEN_FAILED;
+    for (unsigned i = 0; i < ppids.size(); i++) {
+        ::posix_fadvise(fd, (off_t) ppids[i] * PAGE_SIZE, PAGE_SIZE, POSIX_FADV_WILLNEED);
+    }
+    ::close(fd);
+    return 0;
+}
+
+RC PageFile::readExtent(int extent) const {
+    RC rc;
+    char first[PAGE_SIZE];
+
+    if (memoExtent == extent) return 0;
 
+    // the extent starts with its compressed size
+    if ((rc = readPhysical(extents[extent], first)) < 0) return rc;
+    int size;
+    memcpy(&size, first, sizeof(int));
+    if (size <= 0 || size > EXTENT_BYTES) return RC_INVALID_FILE_FORMAT;
+
+    vector<char> data(sizeof(int) + size + PAGE_SIZE);
+    memcpy(&data[0], first, PAGE_SIZE);
+    int pages = (sizeof(int) + size + PAGE_SIZE - 1) / PAGE_SIZE;
+    for (int i = 1; i < pages; i++) {
+        if ((rc = readPhysical(extents[extent] + i, &data[i * PAGE_SIZE])) < 0) return rc;
+    }
+
+    memo.resize(EXTENT_BYTES);
+    memoExtent = -1;
+    if (size == EXTENT_BYTES) {
+        // the pages did not compress and are kept as they are
+        memcpy(&memo[0], &data[sizeof(int)], EXTENT_BYTES);
+    } else if (decompress(&data[sizeof(int)], size, &memo[0], EXTENT_BYTES) != EXTENT_BYTES) {
+        return RC_INVALID_FILE_FORMAT;
+    }
+    memoExtent = extent;
     return 0;
 }
+
+RC PageFile::writeExtent(int extent, const char *pages) {
+    RC rc;
+    vector<char> data(sizeof(int) + COMPRESS_BOUND + PAGE_SIZE, 0);
+
+    int size = compress(pages, EXTENT_BYTES, &data[sizeof(int)]);
+    if (size >= EXTENT_BYTES) {
+        size = EXTENT_BYTES;
+        memcpy(&data[sizeof(int)], pages, EXTENT_BYTES);
+    }
+    memcpy(&data[0], &size, sizeof(int));
+
+    // nothing goes into the tail slots, even if some were never written
+    if (fileEnd < 1 + EXTENT_PAGES) fileEnd = 1 + EXTENT_PAGES;
+
+    // a new extent may need a new page in the translation map
+    if (extent == (int) extents.size()) {
+        if (extent % MAP_ENTRIES == 0) {
+            if ((int) mapPages.size() == MAX_MAP_PAGES) return RC_FILE_WRITE_FAILED;
+            mapPages.push_back(fileEnd++);
+        }
+        extents.push_back(-1);
+    }
+
+    // extents are never overwritten in place. the new version goes behind the others
+    PageId start = fileEnd;
+    int count = (sizeof(int) + size + PAGE_SIZE - 1) / PAGE_SIZE;
+    for (int i = 0; i < count; i++) {
+        if ((rc = writePhysical(start + i, &data[i * PAGE_SIZE])) < 0) return rc;
+    }
+    extents[extent] = start;
+
+    PageId map[MAP_ENTRIES];
+    memset(map, 0, sizeof(map));
+    int first = extent - extent % MAP_ENTRIES;
+    for (int i = first; i < (int) extents.size() && i < first + MAP_ENTRIES; i++) {
+        map[i - first] = extents[i];
+    }
+    if ((rc = writePhysical(mapPages[extent / MAP_ENTRIES], map)) < 0) return rc;
+
+    if (memo.empty() || pages != &memo[0]) memo.assign(pages, pages + EXTENT_BYTES);
+    memoExtent = extent;
+    return writeHeader();
+}
+
+RC PageFile::seal() {
+    RC rc;
+    vector<char> pages(EXTENT_BYTES, 0);
+
+    // the pages not written yet are zeros, as in a file with holes
+    int first = (int) extents.size() * EXTENT_PAGES;
+    for (int i = 0; i < EXTENT_PAGES && first + i < epid; i++) {
+        if ((rc = readPhysical(1 + i, &pages[i * PAGE_SIZE])) < 0) return rc;
+    }
+    if ((rc = writeExtent((int) extents.size(), &pages[0])) < 0) return rc;
+    if (epid < first + EXTENT_PAGES) {
+        epid = first + EXTENT_PAGES;
+        return writeHeader();
+    }
+    return 0;
+}
+
+RC PageFile::writeHeader() {
+    CompressedHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = COMPRESSED_MAGIC;
+    header.epid = epid;
+    header.extentCount = (int) extents.size();
+    header.mapPageCount = (int) mapPages.size();
+    for (size_t i = 0; i < mapPages.size(); i++) {
+        header.mapPages[i] = mapPages[i];
+    }
+    return writePhysical(0, &header);
+}
@@ -11,30 +11,68 @@
 #define PAGEFILE_H
 
 #include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include "Bruinbase.h"
 
 typedef int PageId;
 
 /**
  * read/write a file in the unit of a page
+ *
+ * A file created with compression keeps every EXTENT_PAGES pages as one
+ * LZ-compressed extent of variable size, found through a page-translation
+ * map. read() decompresses through the page cache, so users of the class
+ * see ordinary pages. Only the physical pages read count as page reads.
+ *
+ * The page cache is shared by all threads. It is split into shards by page
+ * id, each with a lock of its own that is never held while reading or
+ * writing the file, so threads reading different pages do not wait for
+ * each other. A page read while another thread writes it is not cached.
+ * Threads may share an uncompressed file without a lock. A compressed
+ * file holds a lock of its own while it reads or writes, since its pages
+ * are decompressed into one buffer.
+ *
+ * In a transaction of the write-ahead log, the physical pages the thread
+ * writes wait in the transaction until it commits, and the thread reads
+ * them from there.
+ *
+ * A commit writes its pages as one version. A file opened for reading
+ * reads the pages of the latest version at the time it was opened: the
+ * pages later versions overwrite stay in memory while such a file is open,
+ * so readers see a snapshot and never wait for writers.
  */
 class PageFile {
 public:
 
     static const int PAGE_SIZE = 1024;    // the size of a page is 1KB
 
+    static const int EXTENT_PAGES = 8;    // # pages compressed together
+
     PageFile();
 
     PageFile(const std::string &filename, char mode);
 
+    /**
+     * close the file if it is still open, so that a long-running
+     * server does not run out of file descriptors.
+     */
+    ~PageFile();
+
     /**
      * open a file in read or write mode.
      * when opened in 'w' mode, if the file does not exist, it is created.
      * @param filename[IN] the name of the file to open
      * @param mode[IN] 'r' for read, 'w' for write
+     * @param compressed[IN] whether the pages are stored compressed if the
+     *                       file is created. an existing file keeps its format
      * @return error code. 0 if no error
      */
-    RC open(const std::string &filename, char mode);
+    RC open(const std::string &filename, char mode, bool compressed = false);
 
     /**
      * close the file.
@@ -60,6 +98,13 @@ public:
      */
     RC write(PageId pid, const void *buffer);
 
+    /**
+     * add an empty page at the end of the file. unlike writing to endPid(),
+     * two threads never get the same page.
+     * @return the id of the new page. a negative error code on error
+     */
+    PageId allocate();
+
     /**
      * note the +1 part. The last page id in the file is actually endPid()-1.
      * that is, the last page can be read by "read(endPid()-1, buffer)".
@@ -67,6 +112,11 @@ public:
      */
     PageId endPid() const;
 
+    /**
+     * @return whether the pages are stored compressed
+     */
+    bool isCompressed() const { return compressed; }
+
     /**
      * @return the total # of disk reads
      */
@@ -77,37 +127,157 @@ public:
      */
     static int getPageWriteCount() { return writeCount; }
 
-protected:
     /**
-     * move the file cursor to the beginning of a page.
-     * this is an internal function not exposed to public.
-     * @param pid[IN] page to seek to
+     * the physical pages read from the files most recently, at most
+     * HOT_PAGE_COUNT of them, e.g., to warm up the cache of the OS after
+     * a restart.
+     * @param pages[OUT] the file names and physical pages, the most recent first
+     */
+    static void getHotPages(std::vector<std::pair<std::string, PageId> > &pages);
+
+    /**
+     * ask the OS to read pages of a file in the background.
+     * @param filename[IN] the file name
+     * @param ppids[IN] the physical pages
+     * @return error code. 0 if no error
+     */
+    static RC prefetch(const std::string &filename, const std::vector<PageId> &ppids);
+
+    /**
+     * the files this thread opens for reading until endSnapshot() read one
+     * version, e.g., the index and the table file of a table. calls may nest.
+     */
+    static void beginSnapshot();
+    static void endSnapshot();
+
+    /**
+     * start writing the pages of a new version. called on commit.
+     * @return the version
+     */
+    static long long beginVersion();
+
+    /**
+     * write a page of a version to its file. the files opened for reading
+     * before the version keep reading the page it overwrites.
+     * @param filename[IN] the file name
+     * @param fd[IN] the file, open for writing
+     * @param ppid[IN] the physical page
+     * @param buffer[IN] the page
+     * @param version[IN] the version from beginVersion()
      * @return error code. 0 if no error
      */
-    RC seek(PageId pid) const;
+    static RC writeVersion(const std::string &filename, int fd, PageId ppid, const void *buffer, long long version);
+
+    /**
+     * make a version visible to the files opened from now on. waits until
+     * the versions begun before it are visible, too.
+     * @param version[IN] the version from beginVersion()
+     */
+    static void endVersion(long long version);
 
 private:
     int fd;     // file descriptor of the associated unix file
-    PageId epid;   // (last page id + 1) of the file
+    std::atomic<PageId> epid;   // (last page id + 1) of the file
+    std::string name;  // the file name, which the write-ahead log knows the file by
+    long long snapshot;  // the version the file reads. LATEST for a file open for writing
 
     //
-    // the following set of members implement LRU caching
+    // the following members implement the compressed format. physical page 0
+    // is the header, physical pages 1 to EXTENT_PAGES hold the pages behind
+    // the last extent as they are, and extents and map pages follow.
     //
-    static const int CACHE_COUNT = 10;
+    bool compressed;
+    std::atomic<PageId> fileEnd;   // # physical pages in the file
+    std::vector<PageId> extents;   // the first physical page of every extent
+    std::vector<PageId> mapPages;  // the physical pages of the translation map
+
+    // the pages of extent memoExtent, decompressed
+    mutable int memoExtent;
+    mutable std::vector<char> memo;
+
+    // guards the members of the compressed format. recursive, because
+    // open() closes the file on errors and allocate() calls write()
+    mutable std::recursive_mutex fileLock;
+
+    // read/write a physical page through the cache
+    RC readPhysical(PageId ppid, void *buffer) const;
+
+    // read a physical page a version after the snapshot overwrote. false if none did
+    bool readOverwritten(PageId ppid, void *buffer) const;
+    RC writePhysical(PageId ppid, const void *buffer);
+
+    // decompress an extent into memo
+    RC readExtent(int extent) const;
+
+    // compress the pages of an extent to the end of the file and point the map at them
+    RC writeExtent(int extent, const char *pages);
+
+    // compress the pages behind the last extent into a new extent
+    RC seal();
+
+    RC writeHeader();
 
-    static int cacheClock; // clock tick counter for LRU policy
+    // drop the cached copy of a page, e.g., before and after writing it.
+    // the page of any file of the name if fd is negative
+    static void uncache(int fd, const std::string &filename, PageId pid);
+
+    //
+    // the following set of members implement LRU caching. physical page
+    // pid is cached in shard pid % CACHE_SHARDS
+    //
+    static const int CACHE_SHARDS = 16;
+    static const int CACHE_COUNT = 10;   // # pages a shard caches
 
     // the actual cache data structure
     static struct cacheStruct {
         int fd;              // file id of the cached page
+        std::string name;    // the name of the file
         PageId pid;             // page id of the cached page
         int lastAccessed;    // the last time the cached page was accessed
         //   (lastAccessed == 0) means that the buffer is empty
         char buffer[PAGE_SIZE]; // the buffer used for caching
-    } readCache[CACHE_COUNT];
+    } readCache[CACHE_SHARDS][CACHE_COUNT];
+
+    static struct cacheShard {
+        std::mutex lock;       // guards the shard and its pages in readCache
+        int clock;             // clock tick counter for LRU policy
+        long long dropped;     // # pages dropped. a page read meanwhile may be stale
+    } cacheShards[CACHE_SHARDS];
+
+    // the physical pages read most recently, by the tick of their last read
+    static const int HOT_PAGE_COUNT = 4096;
+    static std::mutex hotLock;      // guards the members below
+    static long long hotClock;
+    static std::map<std::pair<std::string, PageId>, long long> hotPages;
+    static std::map<long long, std::pair<std::string, PageId> > hotTicks;
+
+    //
+    // the following members implement the versions. they are guarded by
+    // versionLock
+    //
+    static const long long LATEST = 0x7fffffffffffffffLL;
+    static std::mutex versionLock;
+    static long long version;        // the latest version whose pages are all in the files
+    static long long nextVersion;    // the version beginVersion() hands out next
+    static std::set<long long> writingVersions;  // the versions begun but not ended
+    static std::condition_variable versionEnded;
+
+    // the snapshots of the files open for reading, by file name. the
+    // snapshots begun by beginSnapshot() are under the empty name
+    static std::map<std::string, std::multiset<long long> > snapshots;
+
+    // the pages versions overwrote, by file and page, then by the version
+    static std::map<std::pair<std::string, PageId>, std::map<long long, std::vector<char> > > oldPages;
+    static std::atomic<int> oldPageCount;   // # pages in oldPages, read without the lock
+
+    // the # physical pages of a file before a version wrote it, by file, then by the version
+    static std::map<std::string, std::map<long long, PageId> > oldEnds;
+
+    // drop the pages no open file of filename reads any more
+    static void prune(const std::string &filename);
 
-    static int readCount;  // total # of page reads
-    static int writeCount; // total # of page writes
+    static std::atomic<int> readCount;  // total # of page reads
+    static std::atomic<int> writeCount; // total # of page writes
 };
 
 #endif // PAGEFILE_H
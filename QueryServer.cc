@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <map>
+#include <vector>
+#include <thread>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "Bruinbase.h"
+#include "SqlEngine.h"
+#include "QueryServer.h"
+
+using namespace std;
+
+static const char PROMPT[] = "Bruinbase> ";
+
+// send all bytes of the buffer to the client
+static RC sendAll(int fd, const char *buffer, size_t size);
+
+QueryServer::QueryServer(int workers)
+        : listenFd(-1), stopping(0), workerCount(workers), done(false) {
+    wakeFds[0] = wakeFds[1] = -1;
+}
+
+QueryServer::~QueryServer() {
+    if (listenFd >= 0) ::close(listenFd);
+    if (!socketPath.empty()) ::unlink(socketPath.c_str());
+    if (wakeFds[0] >= 0) ::close(wakeFds[0]);
+    if (wakeFds[1] >= 0) ::close(wakeFds[1]);
+}
+
+RC QueryServer::listenUnix(const string &path) {
+    struct sockaddr_un addr;
+
+    if (path.size() >= sizeof(addr.sun_path)) return RC_SOCKET_FAILED;
+    if ((listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0)) < 0) return RC_SOCKET_FAILED;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+    ::unlink(path.c_str());
+    if (::bind(listenFd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || ::listen(listenFd, SOMAXCONN) < 0) {
+        ::close(listenFd);
+        listenFd = -1;
+        return RC_SOCKET_FAILED;
+    }
+    socketPath = path;
+    return 0;
+}
+
+RC QueryServer::listenTcp(int port) {
+    struct sockaddr_in addr;
+    int on = 1;
+
+    if ((listenFd = ::socket(AF_INET, SOCK_STREAM, 0)) < 0) return RC_SOCKET_FAILED;
+    ::setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    // only the clients on this machine may connect
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (::bind(listenFd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || ::listen(listenFd, SOMAXCONN) < 0) {
+        ::close(listenFd);
+        listenFd = -1;
+        return RC_SOCKET_FAILED;
+    }
+    return 0;
+}
+
+RC QueryServer::serve() {
+    map<int, Client *> clients;
+    vector<thread> pool;
+    vector<struct pollfd> fds;
+    char buffer[4096];
+
+    if (listenFd < 0 || ::pipe(wakeFds) < 0) return RC_SOCKET_FAILED;
+    for (int i = 0; i < workerCount; i++) {
+        pool.push_back(thread(&QueryServer::work, this));
+    }
+
+    while (!stopping) {
+        // wait for new clients, for the workers, and for the clients no worker has
+        fds.clear();
+        struct pollfd p;
+        p.events = POLLIN;
+        p.fd = listenFd;
+        fds.push_back(p);
+        p.fd = wakeFds[0];
+        fds.push_back(p);
+        {
+            lock_guard<mutex> guard(lock);
+            for (map<int, Client *>::iterator it = clients.begin(); it != clients.end();) {
+                Client *c = it->second;
+                if (c->busy) {
+                    ++it;
+                    continue;
+                }
+                if (c->quit) {
+                    ::close(c->fd);
+                    delete c;
+                    clients.erase(it++);
+                    continue;
+                }
+                p.fd = c->fd;
+                fds.push_back(p);
+                ++it;
+            }
+        }
+        if (::poll(&fds[0], fds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            ::read(wakeFds[0], buffer, sizeof(buffer));
+        }
+        if (fds[0].revents & POLLIN) {
+            int fd = ::accept(listenFd, NULL, NULL);
+            if (fd >= 0) {
+                clients[fd] = new Client(fd);
+                sendAll(fd, PROMPT, strlen(PROMPT));
+            }
+        }
+        for (unsigned i = 2; i < fds.size(); i++) {
+            if (fds[i].revents == 0) continue;
+            Client *c = clients[fds[i].fd];
+            ssize_t n = ::recv(c->fd, buffer, sizeof(buffer), 0);
+            if (n <= 0) {
+                // the client went away
+                ::close(c->fd);
+                clients.erase(c->fd);
+                delete c;
+                continue;
+            }
+            c->input.append(buffer, n);
+            if (c->input.find('\n') == string::npos) continue;
+
+            // the client has a complete command line
+            lock_guard<mutex> guard(lock);
+            c->busy = true;
+            queue.push_back(c);
+            ready.notify_one();
+        }
+    }
+
+    // let the workers finish the commands they run
+    {
+        lock_guard<mutex> guard(lock);
+        done = true;
+        ready.notify_all();
+    }
+    for (unsigned i = 0; i < pool.size(); i++) pool[i].join();
+    for (map<int, Client *>::iterator it = clients.begin(); it != clients.end(); ++it) {
+        ::close(it->second->fd);
+        delete it->second;
+    }
+    return stopping ? 0 : RC_SOCKET_FAILED;
+}
+
+void QueryServer::stop() {
+    stopping = 1;
+    wake();
+}
+
+void QueryServer::wake() {
+    char c = 0;
+    if (wakeFds[1] >= 0) ::write(wakeFds[1], &c, 1);
+}
+
+void QueryServer::work() {
+    for (;;) {
+        Client *c;
+        {
+            unique_lock<mutex> guard(lock);
+            while (queue.empty() && !done) ready.wait(guard);
+            if (queue.empty()) return;
+            c = queue.front();
+            queue.pop_front();
+        }
+        run(*c);
+        {
+            lock_guard<mutex> guard(lock);
+            c->busy = false;
+        }
+        wake();
+    }
+}
+
+void QueryServer::run(Client &client) {
+    // the complete lines. the rest of the input waits for the rest of its line
+    string::size_type end = client.input.rfind('\n') + 1;
+    string commands = client.input.substr(0, end);
+    client.input.erase(0, end);
+    // the scanner wants two NUL characters at the end of the commands
+    commands.append(2, '\0');
+
+    // the results and the error messages go to the client in the order they are printed
+    char *output = NULL;
+    size_t size = 0;
+    FILE *out = ::open_memstream(&output, &size);
+    if (out == NULL) {
+        client.quit = true;
+        return;
+    }
+    client.session.out = client.session.err = out;
+    SqlEngine::execute(&commands[0], commands.size(), client.session);
+    fclose(out);
+
+    if (sendAll(client.fd, output, size) < 0 || client.session.quit) client.quit = true;
+    free(output);
+}
+
+static RC sendAll(int fd, const char *buffer, size_t size) {
+    while (size > 0) {
+        // MSG_NOSIGNAL: a client that went away must not kill the server with SIGPIPE
+        ssize_t n = ::send(fd, buffer, size, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return RC_SOCKET_FAILED;
+        }
+        buffer += n;
+        size -= n;
+    }
+    return 0;
+}
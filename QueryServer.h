@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef QUERYSERVER_H
+#define QUERYSERVER_H
+
+#include <string>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <csignal>
+#include "Bruinbase.h"
+#include "SqlEngine.h"
+
+/**
+ * Runs the commands of many clients at once. A client connects through a
+ * Unix domain socket or a TCP port of localhost and sends its commands as
+ * it would type them at the console. Every command is answered with its
+ * result, followed by the "Bruinbase> " prompt.
+ *
+ * One thread waits for the clients and hands the complete command lines of
+ * a client to a pool of worker threads. A client has at most one worker at
+ * a time, so its commands run in order, while the commands of different
+ * clients run in parallel. All sessions share the tables, the indexes and
+ * the page cache.
+ */
+class QueryServer {
+public:
+
+    /**
+     * @param workers[IN] # worker threads that run commands
+     */
+    QueryServer(int workers);
+
+    ~QueryServer();
+
+    /**
+     * listen on a Unix domain socket.
+     * @param path[IN] the file name of the socket. an old socket file is replaced
+     * @return error code. 0 if no error
+     */
+    RC listenUnix(const std::string &path);
+
+    /**
+     * listen on a TCP port of localhost.
+     * @param port[IN] the port number
+     * @return error code. 0 if no error
+     */
+    RC listenTcp(int port);
+
+    /**
+     * accept clients and run their commands until stop() is called.
+     * @return error code. 0 if no error
+     */
+    RC serve();
+
+    /**
+     * make serve() return once the running commands are done.
+     * may be called from a signal handler.
+     */
+    void stop();
+
+private:
+    /**
+     * a connected client
+     */
+    struct Client {
+        int fd;
+        std::string input;  // what the client sent and no worker took yet
+        bool busy;          // true while a worker runs the commands of the client
+        bool quit;          // true once the client issued QUIT
+        SqlSession session; // kept between the commands, so that its arena is reused
+        Client(int fd): fd(fd), busy(false), quit(false) { };
+    };
+
+    int listenFd;
+    std::string socketPath;        // the socket file to remove at the end. empty for TCP
+    int wakeFds[2];                // workers and stop() write a byte here to wake up serve()
+    volatile sig_atomic_t stopping;
+    int workerCount;
+
+    std::mutex lock;                 // guards the fields below and Client::busy
+    std::condition_variable ready;   // signaled when a client is queued or the server stops
+    std::deque<Client *> queue;      // the clients with complete command lines, in arrival order
+    bool done;
+
+    // the loop of a worker thread
+    void work();
+
+    // run the complete command lines a client sent, and send it the results
+    void run(Client &client);
+
+    // wake up serve()
+    void wake();
+
+    // not copyable
+    QueryServer(const QueryServer &);
+    QueryServer &operator=(const QueryServer &);
+};
+
+#endif /* QUERYSERVER_H */
@@ -10,23 +10,57 @@
 #include "Bruinbase.h"
 #include "RecordFile.h"
 #include <cstring>
+#include <map>
+#include <mutex>
+#include <unistd.h>
 
 
 using std::string;
+using std::map;
+
+// the dictionaries read so far, by file name. a dictionary stays in memory
+// once it is read, so value lookups never read the dictionary file again.
+// a published dictionary never changes: a LOAD publishes a new one instead
+static map<string, std::shared_ptr<const Dictionary> > dictionaries;
+static std::mutex dictionaryLock;   // guards dictionaries
+
+// the name of the dictionary file of a record file: foo.tbl -> foo.dict
+static string dictionaryName(const string &filename);
 
 //
 // helper functions for page manipultation
 //
 
-// compute the pointer to the n'th slot in a page
+// the record count of a PAX page has this bit set
+static const int PAX_PAGE = 0x40000000;
+
+// compute the pointer to the n'th slot in a page of the row layout
 static char *slotPtr(char *page, int n);
 
+// compute the pointer to the key of the n'th slot in a page
+static char *keyPtr(char *page, int n);
+
+// compute the pointer to the value of the n'th slot in a page
+static char *valuePtr(char *page, int n);
+
+// true if the page uses the PAX layout
+static bool isPaxPage(const char *page);
+
+// initialize an empty page of the given layout
+static void initPage(char *page, bool pax);
+
 // read the record in the n'th slot in the page
 static void readSlot(const char *page, int n, int &key, std::string &value);
 
 // write the record to the n'th slot in the page
 static void writeSlot(char *page, int n, int key, const std::string &value);
 
+// read the key and the value code in the n'th slot in the page
+static void readCodeSlot(const char *page, int n, int &key, int &code);
+
+// write the key and the value code to the n'th slot in the page
+static void writeCodeSlot(char *page, int n, int key, int code);
+
 // get # records stored in the page
 static int getRecordCount(const char *page);
 
@@ -96,21 +130,59 @@ bool operator!=(const RecordId &r1, const RecordId &r2) {
 }
 
 
-RecordFile::RecordFile() {
+RecordFile::RecordFile() : mode('r'), pax(false) {
     erid.pid = 0;
     erid.sid = 0;
 }
 
-RecordFile::RecordFile(const string &filename, char mode) {
+RecordFile::RecordFile(const string &filename, char mode) : pax(false) {
     open(filename, mode);
 }
 
-RC RecordFile::open(const string &filename, char mode) {
+RC RecordFile::open(const string &filename, char mode, bool compressed, bool encoded, bool pax) {
     RC rc;
     char page[PageFile::PAGE_SIZE];
 
-    // open the page file
-    if ((rc = pf.open(filename, mode)) < 0) return rc;
+    // open the page file. the codes of an encoded file leave most of
+    // every value slot zero, so its pages are always compressed
+    if ((rc = pf.open(filename, mode, compressed || encoded)) < 0) return rc;
+    this->mode = mode;
+    this->pax = pax;
+
+    // find the dictionary of the values. an empty file being written gets
+    // a new dictionary, or loses a stale one, depending on encoded. the
+    // files open for reading keep the one they have
+    dict.reset();
+    added.reset();
+    dictName = dictionaryName(filename);
+    std::unique_lock<std::mutex> guard(dictionaryLock);
+    map<string, std::shared_ptr<const Dictionary> >::iterator it = dictionaries.find(dictName);
+    if (mode == 'w' && pf.endPid() == 0) {
+        if (it != dictionaries.end()) dictionaries.erase(it);
+        ::unlink(dictName.c_str());
+        if (encoded) {
+            added = std::make_shared<Dictionary>();
+            rc = added->save(dictName);
+        }
+    } else if (it != dictionaries.end()) {
+        dict = it->second;
+        if (mode == 'w') added = std::make_shared<Dictionary>(*dict);
+    } else if (::access(dictName.c_str(), F_OK) == 0) {
+        std::shared_ptr<Dictionary> loaded = std::make_shared<Dictionary>();
+        if ((rc = loaded->load(dictName)) == 0) {
+            dictionaries[dictName] = loaded;
+            if (mode == 'w') added = std::make_shared<Dictionary>(*loaded);
+            else dict = loaded;
+        }
+    }
+    guard.unlock();
+    if (added) dict = added;
+    if (rc < 0) {
+        dict.reset();
+        added.reset();
+        pf.close();
+        return rc;
+    }
 
     //
     // in the rest of this function, we set the end record id
@@ -136,8 +208,10 @@ RC RecordFile::open(const string &filename, char mode) {
         return rc;
     }
 
-    // get # records in the last page
+    // get # records in the last page. the pages appended to an
+    // existing file keep the layout of its last page
     erid.sid = getRecordCount(page);
+    this->pax = isPaxPage(page);
     if (erid.sid >= RECORDS_PER_PAGE) {
         // the last page is full. advance the end record id to the next page.
         erid.pid++;
@@ -148,10 +222,23 @@ RC RecordFile::open(const string &filename, char mode) {
 }
 
 RC RecordFile::close() {
+    RC rc = 0;
+
+    // write the values appended since open(), and hand them to the files
+    // opened from now on. they reach the table file no earlier than that
+    if (added) {
+        rc = added->save(dictName);
+        std::lock_guard<std::mutex> guard(dictionaryLock);
+        dictionaries[dictName] = added;
+    }
+    dict.reset();
+    added.reset();
+
     erid.pid = 0;
     erid.sid = 0;
 
-    return pf.close();
+    RC closed = pf.close();
+    return rc < 0 ? rc : closed;
 }
 
 RC RecordFile::read(const RecordId &rid, int &key, string &value) const {
@@ -167,7 +254,30 @@ RC RecordFile::read(const RecordId &rid, int &key, string &value) const {
     if ((rc = pf.read(rid.pid, page)) < 0) return rc;
 
     // read the record from the slot in the page
-    readSlot(page, rid.sid, key, value);
+    if (dict != NULL) {
+        int code;
+        readCodeSlot(page, rid.sid, key, code);
+        value = dict->getValue(code);
+    } else {
+        readSlot(page, rid.sid, key, value);
+    }
+
+    return 0;
+}
+
+RC RecordFile::readCode(const RecordId &rid, int &key, int &code) const {
+    RC rc;
+    char page[PageFile::PAGE_SIZE];
+
+    if (dict == NULL) return RC_INVALID_FILE_FORMAT;
+
+    // check whether the rid is in the valid range
+    if (rid.pid < 0 || rid.pid > erid.pid) return RC_INVALID_RID;
+    if (rid.sid < 0 || rid.sid >= RecordFile::RECORDS_PER_PAGE) return RC_INVALID_RID;
+    if (rid >= erid) return RC_INVALID_RID;
+
+    if ((rc = pf.read(rid.pid, page)) < 0) return rc;
+    readCodeSlot(page, rid.sid, key, code);
 
     return 0;
 }
@@ -183,11 +293,16 @@ RC RecordFile::append(int key, const std::string &value, RecordId &rid) {
     } else {
         // if this is the first slot of an empty page
         // we can simply initialize the page with zeros
-        memset(page, 0, PageFile::PAGE_SIZE);
+        initPage(page, pax);
     }
 
-    // write the record to the first empty slot
-    writeSlot(page, erid.sid, key, value);
+    // write the record to the first empty slot. an encoded file stores
+    // the code of the value, truncated as writeSlot() would
+    if (dict != NULL) {
+        writeCodeSlot(page, erid.sid, key, added->add(value.substr(0, RecordFile::MAX_VALUE_LENGTH - 1)));
+    } else {
+        writeSlot(page, erid.sid, key, value);
+    }
 
     // the first four bytes in the page stores # records in the page.
     // update this number.
@@ -205,6 +320,26 @@ RC RecordFile::append(int key, const std::string &value, RecordId &rid) {
     return 0;
 }
 
+RC RecordFile::readKeys(PageId pid, int keys[], int &count) const {
+    RC rc;
+    char page[PageFile::PAGE_SIZE];
+
+    // check whether the page has records
+    if (pid < 0 || pid > erid.pid || (pid == erid.pid && erid.sid == 0)) return RC_INVALID_PID;
+
+    if ((rc = pf.read(pid, page)) < 0) return rc;
+    count = getRecordCount(page);
+
+    // the keys of a PAX page are one array
+    if (isPaxPage(page)) {
+        memcpy(keys, keyPtr(page, 0), count * sizeof(int));
+    } else {
+        for (int i = 0; i < count; i++) memcpy(&keys[i], keyPtr(page, i), sizeof(int));
+    }
+
+    return 0;
+}
+
 const RecordId &RecordFile::endRid() const {
     return erid;
 }
@@ -214,14 +349,29 @@ static int getRecordCount(const char *page) {
 
     // the first four bytes of a page contains # records in the page
     memcpy(&count, page, sizeof(int));
-    return count;
+    return count & ~PAX_PAGE;
 }
 
 static void setRecordCount(char *page, int count) {
     // the first four bytes of a page contains # records in the page
+    if (isPaxPage(page)) count |= PAX_PAGE;
     memcpy(page, &count, sizeof(int));
 }
 
+static bool isPaxPage(const char *page) {
+    int count;
+    memcpy(&count, page, sizeof(int));
+    return (count & PAX_PAGE) != 0;
+}
+
+static void initPage(char *page, bool pax) {
+    memset(page, 0, PageFile::PAGE_SIZE);
+    if (pax) {
+        int count = PAX_PAGE;
+        memcpy(page, &count, sizeof(int));
+    }
+}
+
 static char *slotPtr(char *page, int n) {
     // compute the location of the n'th slot in a page.
     // remember that the first four bytes in a page is used to store
@@ -230,30 +380,57 @@ static char *slotPtr(char *page, int n) {
     return (page + sizeof(int)) + (sizeof(int) + RecordFile::MAX_VALUE_LENGTH) * n;
 }
 
-static void readSlot(const char *page, int n, int &key, std::string &value) {
-    // compute the location of the record
-    char *ptr = slotPtr(const_cast<char *>(page), n);
+static char *keyPtr(char *page, int n) {
+    // a PAX page stores the keys of all slots after the record count
+    if (isPaxPage(page)) return (page + sizeof(int)) + sizeof(int) * n;
+    return slotPtr(page, n);
+}
+
+static char *valuePtr(char *page, int n) {
+    // and the values of all slots after the keys
+    if (isPaxPage(page)) {
+        return (page + sizeof(int)) + sizeof(int) * RecordFile::RECORDS_PER_PAGE + RecordFile::MAX_VALUE_LENGTH * n;
+    }
+    return slotPtr(page, n) + sizeof(int);
+}
 
+static void readSlot(const char *page, int n, int &key, std::string &value) {
     // read the key
-    memcpy(&key, ptr, sizeof(int));
+    memcpy(&key, keyPtr(const_cast<char *>(page), n), sizeof(int));
 
     // read the value
-    value.assign(ptr + sizeof(int));
+    value.assign(valuePtr(const_cast<char *>(page), n));
 }
 
 static void writeSlot(char *page, int n, int key, const std::string &value) {
-    // compute the location of the record
-    char *ptr = slotPtr(page, n);
+    // compute the location of the value
+    char *ptr = valuePtr(page, n);
 
     // store the key
-    memcpy(ptr, &key, sizeof(int));
+    memcpy(keyPtr(page, n), &key, sizeof(int));
 
     // store the value.
     if ((int) value.size() >= RecordFile::MAX_VALUE_LENGTH) {
         // when the string is longer than MAX_VALUE_LENGTH, truncate it.
-        memcpy(ptr + sizeof(int), value.c_str(), RecordFile::MAX_VALUE_LENGTH - 1);
-        *(ptr + sizeof(int) + RecordFile::MAX_VALUE_LENGTH - 1) = 0;
+        memcpy(ptr, value.c_str(), RecordFile::MAX_VALUE_LENGTH - 1);
+        *(ptr + RecordFile::MAX_VALUE_LENGTH - 1) = 0;
     } else {
-        strcpy(ptr + sizeof(int), value.c_str());
+        strcpy(ptr, value.c_str());
     }
 }
+
+static void readCodeSlot(const char *page, int n, int &key, int &code) {
+    memcpy(&key, keyPtr(const_cast<char *>(page), n), sizeof(int));
+    memcpy(&code, valuePtr(const_cast<char *>(page), n), sizeof(int));
+}
+
+static void writeCodeSlot(char *page, int n, int key, int code) {
+    memcpy(keyPtr(page, n), &key, sizeof(int));
+    memcpy(valuePtr(page, n), &code, sizeof(int));
+}
+
+static string dictionaryName(const string &filename) {
+    string::size_type dot = filename.rfind('.');
+    if (dot == string::npos || filename.find('/', dot) != string::npos) return filename + ".dict";
+    return filename.substr(0, dot) + ".dict";
+}
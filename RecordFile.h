@@ -11,7 +11,9 @@
 #define RECORDFILE_H
 
 #include <string>
+#include <memory>
 #include "PageFile.h"
+#include "Dictionary.h"
 
 /**
  * The data structure for pointing to a particular record in a RecordFile.
@@ -46,6 +48,18 @@ bool operator!=(const RecordId &r1, const RecordId &r2);
 
 /**
  * read/write a record to a file
+ *
+ * A dictionary-encoded file stores the code of every value in the value
+ * slot and the values themselves in a Dictionary file next to it. read()
+ * and append() translate between the two, so users of the class see
+ * ordinary records unless they ask for the codes. A file open for reading
+ * keeps the dictionary it was opened with. A file open for writing adds
+ * the new values to a copy, which close() hands to the files opened from
+ * then on, so readers never see a dictionary change.
+ *
+ * A page either stores every record as a key followed by its value, or in
+ * the PAX layout, the keys of all slots together followed by the values of
+ * all slots. The slots are the same, so record ids do not depend on the layout.
  */
 class RecordFile {
 public:
@@ -67,9 +81,15 @@ public:
      * when opened in 'w' mode, if the file does not exist, it is created.
      * @param filename[IN] the name of the file to open
      * @param mode[IN] 'r' for read, 'w' for write
+     * @param compressed[IN] whether the pages are stored compressed if the
+     *                       file is created. an existing file keeps its format
+     * @param encoded[IN] whether the values are dictionary-encoded if the
+     *                    file is created. encoded pages are always compressed
+     * @param pax[IN] whether the pages use the PAX layout if the file is created
      * @return error code. 0 if no error
      */
-    RC open(const std::string &filename, char mode);
+    RC open(const std::string &filename, char mode, bool compressed = false, bool encoded = false,
+            bool pax = false);
 
     /**
      * close the file.
@@ -86,6 +106,24 @@ public:
      */
     RC read(const RecordId &rid, int &key, std::string &value) const;
 
+    /**
+     * read a record of a dictionary-encoded file without decoding the value.
+     * @param rid[IN] the id of the record to read
+     * @param key[OUT] the record key
+     * @param code[OUT] the code of the record value
+     * @return error code. 0 if no error
+     */
+    RC readCode(const RecordId &rid, int &key, int &code) const;
+
+    /**
+     * read the keys of all records in a page.
+     * @param pid[IN] the page to read
+     * @param keys[OUT] the keys in slot order. must have room for RECORDS_PER_PAGE keys
+     * @param count[OUT] # records in the page
+     * @return error code. 0 if no error
+     */
+    RC readKeys(PageId pid, int keys[], int &count) const;
+
     /**
      * append a new record at the end of the file.
      * note that RecordFile does not have write() function.
@@ -103,9 +141,33 @@ public:
      */
     const RecordId &endRid() const;
 
+    /**
+     * @return whether the values are dictionary-encoded
+     */
+    bool isEncoded() const { return dict != NULL; }
+
+    /**
+     * @param value[IN] a value
+     * @return the code of the value in a dictionary-encoded file.
+     *         -1 if no record has the value
+     */
+    int getCode(const std::string &value) const { return dict->getCode(value); }
+
+    /**
+     * @param code[IN] a code read by readCode()
+     * @return the value of the code
+     */
+    const std::string &getValue(int code) const { return dict->getValue(code); }
+
 private:
     PageFile pf;     // the PageFile used to store the records
     RecordId erid;   // the last record id of the file + 1
+    char mode;
+    bool pax;        // true if appended pages use the PAX layout
+
+    std::shared_ptr<const Dictionary> dict;   // the dictionary of the values. NULL if the values are stored as they are
+    std::shared_ptr<Dictionary> added;        // the copy of dict append() adds to. NULL if the file is read
+    std::string dictName;  // the dictionary file name
 };
 
 #endif // RECORDFILE_H
@@ -12,43 +12,860 @@
 #include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <queue>
+#include <unordered_map>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <fcntl.h>
+#include <unistd.h>
 #include "Bruinbase.h"
 #include "SqlEngine.h"
 #include "BTreeIndex.h"
+#include "ZoneMap.h"
+#include "BloomFilter.h"
+#include "MemTable.h"
+#include "WriteAheadLog.h"
+#include "IndexBuilder.h"
 
 using namespace std;
 
-// external functions and variables for load file and sql command parsing 
-extern FILE *sqlin;
+// external functions for sql command parsing. the scanner is reentrant
+// and carries the session of the parse as its extra data
+int sqllex_init_extra(SqlSession *session, void **scanner);
 
-int sqlparse(void);
+struct yy_buffer_state;
 
+struct yy_buffer_state *sql_scan_buffer(char *base, size_t size, void *scanner);
+
+void sql_delete_buffer(struct yy_buffer_state *buffer, void *scanner);
+
+int sqllex_destroy(void *scanner);
+
+int sqlparse(void *scanner);
+
+//
+// the commands of many sessions may run at once, one per thread
+//
+
+// the session of the command this thread runs. NULL outside of execute()
+static thread_local SqlSession *session = NULL;
+
+// the stream the results of this thread go to
+static FILE *resultStream() { return session != NULL ? session->out : stdout; }
+
+// the stream the error messages of this thread go to
+static FILE *errorStream() { return session != NULL ? session->err : stderr; }
+
+// a number of its own for every thread, so that the temporary files of
+// commands running at once have different names
+static int threadNumber();
+
+// guards the tables below and the open table and in-memory table caches
+static mutex catalogLock;
+
+// a table in memory is read under a shared lock and written under an
+// exclusive one. the files of a table are read at a snapshot without it
+struct TableLock {
+    shared_mutex lock;
+    int users;        // # guards of the lock. it is dropped with the last one
+    TableLock(): users(0) { };
+};
+static map<string, TableLock *> tableLocks;
+
+// the LOADs of a table run one at a time
+static map<string, mutex *> loadLocks;
+
+static mutex &getLoadLock(const string &table);
+
+/**
+ * Holds the lock of a table while a command runs. A thread that holds the
+ * lock of a table already, e.g., in select() called by select(), does not
+ * take it again.
+ */
+class TableGuard {
+public:
+    TableGuard(const string &table, bool exclusive);
+    ~TableGuard();
+
+private:
+    string table;
+    TableLock *lock;      // NULL if the thread held the lock already
+    bool exclusive;
+
+    static thread_local vector<string> held;  // the tables this thread holds
+};
+
+//
+// helper for printing the result of a SELECT
+//
+
+// print a result row for the attribute in the SELECT clause
+static void printRow(int attr, int key, const string &value);
+
+// true if the attribute in the SELECT clause needs the value column
+static bool readsValue(int attr);
+
+//
+// helpers for evaluating the WHERE clause
+//
+
+// true if the row satisfies all conditions. the value is ignored if no condition is on it
+static bool satisfies(const vector<SelCond> &conds, int key, const string &value);
+
+// true if the row satisfies all conditions of any of the disjuncts
+static bool satisfiesAny(const vector<vector<SelCond> > &disjuncts, int key, const string &value);
+
+// true if a <> condition of cCond rules the key out
+static bool excludedKey(const CombinedCond &cCond, int key);
+
+// the key range [minKey, maxKey] the conditions allow. false if it is empty
+static bool keyRange(const vector<SelCond> &conds, int &minKey, int &maxKey);
+
+// the key ranges of the disjuncts as sorted, disjoint intervals
+static void keyIntervals(const vector<vector<SelCond> > &disjuncts, vector<pair<int, int> > &intervals);
+
+// print the result of a SELECT that no row matches, e.g., 0 for COUNT(*)
+static RC selectNothing(int attr, const string &table, const SelOptions &options);
+
+// false if no record in the zone can satisfy all conditions
+static bool zoneMayMatch(const ZoneMap::Zone &zone, const vector<SelCond> &conds);
+
+// false if the zone map rules out every record of the page for all of the disjuncts
+static bool pageMayMatch(const ZoneMap &zm, PageId pid, const vector<vector<SelCond> > &disjuncts);
+
+//
+// the files of a table stay open between statements, with the index
+// metadata, the zone map and the Bloom filters in memory. a LOAD drops
+// the ones of its table once it commits
+//
+
+/**
+ * the files of a table, opened at one snapshot and shared by the
+ * statements that read it. the statements that still use an OpenTable
+ * the LOAD dropped read the table as it was before the LOAD
+ */
+struct OpenTable {
+    bool indexed;         // true if index is open
+    bool stored;          // true if records is open
+    bool zoned;           // true if zones is open
+    bool keyBloomed;      // true if keyBloom was read
+    bool valueBloomed;    // true if valueBloom was read
+    BTreeIndex index;     // the index on key
+    RecordFile records;   // the table file
+    ZoneMap zones;        // the zone map of the table file
+    BloomFilter keyBloom;     // the Bloom filter of the keys
+    BloomFilter valueBloom;   // the Bloom filter of the values
+
+    ~OpenTable();
+};
+
+static map<string, shared_ptr<OpenTable> > openTables;
+
+// the open files of the table. they stay open until dropOpenTable()
+static shared_ptr<OpenTable> getOpenTable(const string &table);
+
+// forget the open files of the table, e.g., because a LOAD changed them
+static void dropOpenTable(const string &table);
+
+// true if a Bloom filter of the table proves that no row satisfies all conditions
+static bool bloomRulesOut(const OpenTable &files, const vector<SelCond> &conds);
+
+//
+// the tables loaded WITH MEMORY stay in memory and are queried there. a
+// snapshot appends their new rows to the table files once SNAPSHOT_ROWS
+// rows or SNAPSHOT_SECONDS seconds have passed, and when the engine exits
+//
+
+static const int SNAPSHOT_ROWS = 10000;
+static const int SNAPSHOT_SECONDS = 60;
+
+static map<string, MemTable *> memTables;
+static map<string, LoadOptions> snapshotOptions;  // the options the snapshots of a table are written with
+
+// the in-memory table. NULL if the table is not in memory
+static MemTable *getMemTable(const string &table);
+
+// write the rows of an in-memory table added since the last snapshot
+static RC snapshot(const string &table);
+
+/**
+ * Appends rows to a table file and keeps its index, zone map and Bloom
+ * filters up to date.
+ */
+class TableWriter {
+public:
+    TableWriter(): index(false), zoned(false), keyBloomed(false), valueBloomed(false) { };
+
+    /**
+     * open the table file and its side files for appending.
+     * @param table[IN] the table name
+     * @param options[IN] the options in the WITH clause of LOAD
+     * @return error code. 0 if no error
+     */
+    RC open(const string &table, const LoadOptions &options);
+
+    /**
+     * append a row.
+     * @param key[IN] the key of the row
+     * @param value[IN] the value of the row
+     * @return error code. 0 if no error
+     */
+    RC add(int key, const string &value);
+
+    void close();
+
+private:
+    RecordFile rf;
+    BTreeIndex bi;
+    ZoneMap zm;
+    BloomFilter keyBloom, valueBloom;
+    bool index, zoned, keyBloomed, valueBloomed;
+};
+
+// append the rows in a load file to a table in memory or to the table files
+static RC loadRows(const string &table, const string &loadfile, const LoadOptions &options);
+
+// sync a file and give it the name of another, which it replaces
+static RC replaceFile(const string &from, const string &to);
+
+/**
+ * The running state of the aggregate functions in the SELECT clause.
+ */
+struct Aggregate {
+    int count;
+    long long sum;
+    int minKey, maxKey;
+    string minValue, maxValue;
+
+    Aggregate(): count(0), sum(0), minKey(INT_MAX), maxKey(INT_MIN) { };
+
+    /**
+     * add a matching row.
+     * @param key[IN] the key of the row
+     * @param value[IN] the value of the row. NULL if it is not needed
+     */
+    void add(int key, const string *value);
+
+    /**
+     * print the result of the aggregate function.
+     * @param attr[IN] attribute in the SELECT clause (4 - 10)
+     */
+    void print(int attr) const;
+};
+
+// memory the GROUP BY hash table may use before groups are spilled to disk
+static const size_t GROUP_MEMORY_BUDGET = 4 * 1024 * 1024;
+
+// # temporary files the spilled rows are partitioned into
+static const int GROUP_PARTITIONS = 16;
+
+// partitions of partitions are not spilled again past this depth
+static const int GROUP_MAX_DEPTH = 4;
+
+// the partition (out of n) hash h falls in when spilling at the given depth.
+// the depth reseeds the hash so that an overflowing partition splits up again
+static int hashPartition(size_t h, int depth, int n) {
+    unsigned long long x = h + 0x9e3779b97f4a7c15ULL * (depth + 1);
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (int) (x % n);
+}
+
+/**
+ * Aggregates the rows of a GROUP BY. When the rows arrive sorted on the
+ * group column, every group is printed as soon as it is complete.
+ * Otherwise groups are kept in a hash table until it grows over
+ * GROUP_MEMORY_BUDGET. From then on, rows of groups that are not in the
+ * table are spilled to one of GROUP_PARTITIONS temporary RecordFiles by
+ * the hash of their group, and every partition is aggregated on its own
+ * once the in-memory groups are printed.
+ */
+class GroupAggregator {
+public:
+    /**
+     * the LIMIT and OFFSET state shared with the aggregators of the partitions
+     */
+    struct Output {
+        int skipped, emitted;
+        Output(): skipped(0), emitted(0) { };
+    };
+
+    /**
+     * @param attr[IN] the aggregate in the SELECT clause (4 - 10)
+     * @param options[IN] the GROUP BY and LIMIT clauses
+     * @param table[IN] the table name, used to name the spill files
+     * @param sorted[IN] true if the rows arrive sorted on the group column
+     * @param depth[IN] 0 for the scan, n + 1 for a partition of depth n
+     * @param out[IN] the output state. NULL to create one
+     */
+    GroupAggregator(int attr, const SelOptions &options, const string &table,
+                    bool sorted, int depth = 0, Output *out = NULL);
+
+    ~GroupAggregator();
+
+    /**
+     * @return true if no more groups can make it to the output
+     */
+    bool done() const { return sorted && opt.limit >= 0 && out->emitted >= opt.limit; }
+
+    /**
+     * take a matching row.
+     * @param key[IN] the key of the row
+     * @param value[IN] the value of the row. NULL if it is not needed
+     */
+    void add(int key, const string *value);
+
+    /**
+     * print the groups that are still in memory and aggregate the spilled ones.
+     */
+    void finish();
+
+private:
+    struct GroupKey {
+        int key;
+        string value;
+        bool operator==(const GroupKey &g) const { return key == g.key && value == g.value; }
+    };
+
+    struct GroupKeyHash {
+        size_t operator()(const GroupKey &g) const {
+            return std::hash<int>()(g.key) ^ std::hash<string>()(g.value);
+        }
+    };
+
+    typedef std::unordered_map<GroupKey, Aggregate, GroupKeyHash> GroupTable;
+
+    GroupKey makeKey(int key, const string *value) const;
+
+    string partitionName(int p) const;
+
+    void spill(int key, const string *value, const GroupKey &g);
+
+    void emit(const GroupKey &g, const Aggregate &agg);
+
+    int attr;
+    SelOptions opt;
+    string table;
+    bool sorted;
+    int depth;
+    Output *out;
+    bool ownsOut;
+
+    // the group being built when the rows are sorted
+    bool hasCurrent;
+    GroupKey current;
+    Aggregate currentAgg;
+
+    GroupTable groups;
+    size_t memoryUsed;
+    bool spilled;
+    RecordFile partitions[GROUP_PARTITIONS];
+};
+
+/**
+ * Receives the rows that match the WHERE clause and applies the
+ * ORDER BY and LIMIT clauses before printing them. When rows arrive
+ * in the requested order, the first OFFSET rows are skipped and the
+ * scan can stop after LIMIT rows. Otherwise the best OFFSET + LIMIT rows
+ * are kept in a bounded heap. In both cases the value of a row is only
+ * read from the table when the row makes it to the output.
+ */
+class ResultSink {
+public:
+    /**
+     * @param attr[IN] attribute in the SELECT clause
+     * @param table[IN] the table name in the FROM clause
+     * @param options[IN] the GROUP BY, ORDER BY and LIMIT clauses
+     * @param keyOrdered[IN] true if the rows arrive in key order
+     * @param descending[IN] true if that key order is descending
+     */
+    ResultSink(int attr, const string &table, const SelOptions &options, bool keyOrdered, bool descending);
+
+    ~ResultSink() { delete groups; }
+
+    /**
+     * @return true if add() needs the value of every row
+     */
+    bool needsValue() const { return opt.orderAttr == 2 || opt.groupAttr == 2 || attr == 9 || attr == 10; }
+
+    /**
+     * @return true if no more rows can make it to the output
+     */
+    bool done() const {
+        if (groups != NULL) return groups->done();
+        return streaming && opt.limit >= 0 && emitted >= opt.limit && attr < 4;
+    }
+
+    /**
+     * @return true if the rows are printed as they arrive
+     */
+    bool isStreaming() const { return streaming; }
+
+    /**
+     * tell the sink that the first n rows were skipped by the caller.
+     * @param n[IN] # rows skipped
+     */
+    void skip(int n) { skipped += n; }
+
+    /**
+     * take a matching row.
+     * @param key[IN] the key of the row
+     * @param rid[IN] the location of the row in rf
+     * @param value[IN] the value of the row. NULL if it has not been read yet
+     * @param rf[IN] the table to read the value from if it is needed
+     */
+    void add(int key, const RecordId &rid, const string *value, const RecordFile &rf);
+
+    /**
+     * print the rows kept in the heap or the result of the aggregate.
+     * @param rf[IN] the table to read the values from if they are needed
+     */
+    void finish(const RecordFile &rf);
+
+private:
+    struct Row {
+        int key;
+        RecordId rid;
+        string value;
+        bool hasValue;
+        int seq;      // arrival order, used to break ties
+    };
+
+    // orders the rows as requested. the heap top is the worst row.
+    struct RowOrder {
+        int attr;
+        bool desc;
+        bool operator()(const Row &r1, const Row &r2) const {
+            int diff = (attr == 1) ? ((r1.key > r2.key) - (r1.key < r2.key))
+                                   : r1.value.compare(r2.value);
+            if (desc) diff = -diff;
+            return diff != 0 ? diff < 0 : r1.seq < r2.seq;
+        }
+    };
+
+    static RowOrder makeOrder(const SelOptions &options) {
+        RowOrder order;
+        order.attr = options.orderAttr;
+        order.desc = options.desc;
+        return order;
+    }
+
+    int attr;
+    SelOptions opt;
+    bool streaming;
+    int skipped, emitted, count;
+    Aggregate agg;
+    GroupAggregator *groups;
+    RowOrder order;
+    std::priority_queue<Row, std::vector<Row>, RowOrder> heap;
+};
+
+ResultSink::ResultSink(int attr, const string &table, const SelOptions &options, bool keyOrdered, bool descending)
+        : attr(attr), opt(options), skipped(0), emitted(0), count(0), groups(NULL),
+          order(makeOrder(options)), heap(order) {
+    if (opt.offset < 0) opt.offset = 0;
+    streaming = (opt.orderAttr == 0) || (opt.orderAttr == 1 && keyOrdered && opt.desc == descending);
+    if (opt.groupAttr != 0) {
+        // the index hands out the rows of a key group next to each other
+        groups = new GroupAggregator(attr, opt, table, opt.groupAttr == 1 && keyOrdered);
+        streaming = false;
+    }
+}
+
+void ResultSink::add(int key, const RecordId &rid, const string *value, const RecordFile &rf) {
+    count++;
+    if (groups != NULL) {
+        groups->add(key, value);
+        return;
+    }
+    if (attr >= 4) {
+        agg.add(key, value);
+        return;
+    }
+
+    if (streaming) {
+        if (skipped < opt.offset) {
+            skipped++;
+            return;
+        }
+        if (opt.limit >= 0 && emitted >= opt.limit) return;
+        emitted++;
+        string v;
+        if (value != NULL) v = *value;
+        else if (readsValue(attr)) rf.read(rid, key, v);
+        printRow(attr, key, v);
+        return;
+    }
+
+    Row row;
+    row.key = key;
+    row.rid = rid;
+    row.hasValue = (value != NULL);
+    if (value != NULL) row.value = *value;
+    row.seq = count;
+
+    if (opt.limit >= 0) {
+        // keep only the best (offset + limit) rows
+        size_t capacity = (size_t) opt.offset + opt.limit;
+        if (capacity == 0) return;
+        if (heap.size() >= capacity) {
+            if (!order(row, heap.top())) return;
+            heap.pop();
+        }
+    }
+    heap.push(row);
+}
+
+void ResultSink::finish(const RecordFile &rf) {
+    if (groups != NULL) {
+        groups->finish();
+        return;
+    }
+    if (attr >= 4) {
+        agg.print(attr);
+        return;
+    }
+    if (streaming) return;
+
+    std::vector<Row> rows;
+    rows.reserve(heap.size());
+    while (!heap.empty()) {
+        rows.push_back(heap.top());
+        heap.pop();
+    }
+    // the heap hands out the worst row first
+    for (int i = (int) rows.size() - 1 - opt.offset; i >= 0; i--) {
+        Row &row = rows[i];
+        if (!row.hasValue && readsValue(attr)) rf.read(row.rid, row.key, row.value);
+        printRow(attr, row.key, row.value);
+    }
+}
+
+
+
+GroupAggregator::GroupAggregator(int attr, const SelOptions &options, const string &table,
+                                 bool sorted, int depth, Output *out)
+        : attr(attr), opt(options), table(table), sorted(sorted), depth(depth),
+          out(out), ownsOut(out == NULL), hasCurrent(false), memoryUsed(0), spilled(false) {
+    if (ownsOut) this->out = new Output;
+}
+
+GroupAggregator::~GroupAggregator() {
+    if (ownsOut) delete out;
+}
+
+GroupAggregator::GroupKey GroupAggregator::makeKey(int key, const string *value) const {
+    GroupKey g;
+    g.key = (opt.groupAttr == 1) ? key : 0;
+    if (opt.groupAttr == 2 && value != NULL) g.value = *value;
+    return g;
+}
+
+void GroupAggregator::add(int key, const string *value) {
+    GroupKey g = makeKey(key, value);
+
+    if (sorted) {
+        if (!hasCurrent || !(g == current)) {
+            if (hasCurrent) emit(current, currentAgg);
+            current = g;
+            currentAgg = Aggregate();
+            hasCurrent = true;
+        }
+        currentAgg.add(key, value);
+        return;
+    }
+
+    GroupTable::iterator it = groups.find(g);
+    if (it != groups.end()) {
+        it->second.add(key, value);
+        return;
+    }
+    if (memoryUsed >= GROUP_MEMORY_BUDGET && depth < GROUP_MAX_DEPTH) {
+        // no room for a new group. it is aggregated after the scan
+        spill(key, value, g);
+        return;
+    }
+    groups[g].add(key, value);
+    // the node, the group key and (at worst) the MIN/MAX(value) copies
+    memoryUsed += sizeof(GroupKey) + sizeof(Aggregate) + 4 * sizeof(void *) + 3 * g.value.size();
+}
+
+string GroupAggregator::partitionName(int p) const {
+    char suffix[32];
+    sprintf(suffix, ".grp%d_%d_%d.tmp", threadNumber(), depth, p);
+    return table + suffix;
+}
+
+void GroupAggregator::spill(int key, const string *value, const GroupKey &g) {
+    if (!spilled) {
+        for (int p = 0; p < GROUP_PARTITIONS; p++) {
+            ::unlink(partitionName(p).c_str());
+            partitions[p].open(partitionName(p), 'w');
+        }
+        spilled = true;
+    }
+    RecordId rid;
+    partitions[hashPartition(GroupKeyHash()(g), depth, GROUP_PARTITIONS)].append(key, value != NULL ? *value : string(), rid);
+}
+
+void GroupAggregator::emit(const GroupKey &g, const Aggregate &agg) {
+    if (out->skipped < opt.offset) {
+        out->skipped++;
+        return;
+    }
+    if (opt.limit >= 0 && out->emitted >= opt.limit) return;
+    out->emitted++;
+
+    if (opt.groupAttr == 1) fprintf(resultStream(), "%d ", g.key);
+    else fprintf(resultStream(), "'%s' ", g.value.c_str());
+    agg.print(attr);
+}
+
+void GroupAggregator::finish() {
+    if (sorted) {
+        if (hasCurrent) emit(current, currentAgg);
+        return;
+    }
+
+    for (GroupTable::const_iterator it = groups.begin(); it != groups.end(); ++it) {
+        emit(it->first, it->second);
+    }
+    groups.clear();
+    if (!spilled) return;
+
+    // aggregate the partitions one by one
+    for (int p = 0; p < GROUP_PARTITIONS; p++) {
+        GroupAggregator partition(attr, opt, table, false, depth + 1, out);
+        RecordId rid;
+        int key;
+        string value;
+        for (rid.pid = rid.sid = 0; rid < partitions[p].endRid(); ++rid) {
+            if (partitions[p].read(rid, key, value) < 0) break;
+            partition.add(key, &value);
+        }
+        partition.finish();
+        partitions[p].close();
+        ::unlink(partitionName(p).c_str());
+    }
+}
 
 
 RC SqlEngine::run(FILE *commandline) {
+    SqlSession console;
+    RC rc;
+
     fprintf(stdout, "Bruinbase> ");
 
-    // set the command line input and start parsing user input
-    sqlin = commandline;
-    sqlparse();  // sqlparse() is defined in SqlParser.tab.c generated from
+    // start parsing user input
+    rc = execute(commandline, console);
+    shutdown();
+    return rc;
+}
+
+RC SqlEngine::execute(FILE *commands, SqlSession &s) {
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    RC rc = 0;
+
+    // the tokens point into the input, so the scanner takes one line at a
+    // time from a buffer that stays put until the line is parsed
+    while (!s.quit && (length = getline(&line, &capacity, commands)) >= 0) {
+        if ((size_t) length + 2 > capacity) {
+            char *grown = (char *) realloc(line, length + 2);
+            if (grown == NULL) {
+                rc = RC_OUT_OF_MEMORY;
+                break;
+            }
+            line = grown;
+            capacity = length + 2;
+        }
+        line[length] = line[length + 1] = 0;
+        RC status = execute(line, length + 2, s);
+        if (status < 0) rc = status;
+    }
+    free(line);
+    return rc;
+}
+
+RC SqlEngine::execute(char *commands, size_t size, SqlSession &s) {
+    void *scanner;
+    RC rc = 0;
+
+    if (sqllex_init_extra(&s, &scanner) != 0) return RC_OUT_OF_MEMORY;
+    struct yy_buffer_state *buffer = sql_scan_buffer(commands, size, scanner);
+    if (buffer == NULL) {
+        sqllex_destroy(scanner);
+        return RC_OUT_OF_MEMORY;
+    }
+
+    SqlSession *saved = session;
+    session = &s;
+    if (sqlparse(scanner) != 0 && !s.quit) rc = RC_INVALID_COMMAND;
+    // sqlparse() is defined in SqlParser.tab.c generated from
     // SqlParser.y by bison (bison is GNU equivalent of yacc)
+    session = saved;
+
+    // a command cut short by an error leaves its objects in the arena
+    s.arena.reset();
+    s.params = 0;
+    sql_delete_buffer(buffer, scanner);
+    sqllex_destroy(scanner);
+    return rc;
+}
 
+void SqlEngine::shutdown() {
+    vector<string> tables;
+    {
+        lock_guard<mutex> guard(catalogLock);
+        for (map<string, MemTable *>::iterator it = memTables.begin(); it != memTables.end(); ++it) {
+            tables.push_back(it->first);
+        }
+    }
+    // the rows of the in-memory tables that are not in the table files yet
+    for (unsigned i = 0; i < tables.size(); i++) {
+        TableGuard guard(tables[i], true);
+        snapshot(tables[i]);
+    }
+}
+
+RC SqlEngine::saveHotPages(const string &filename) {
+    vector<string> tables;
+    {
+        lock_guard<mutex> guard(catalogLock);
+        for (map<string, shared_ptr<OpenTable> >::iterator it = openTables.begin(); it != openTables.end(); ++it) {
+            if (it->second->stored) tables.push_back(it->first);
+        }
+    }
+    vector<pair<string, PageId> > pages;
+    PageFile::getHotPages(pages);
+
+    FILE *f = fopen(filename.c_str(), "w");
+    if (f == NULL) return RC_FILE_OPEN_FAILED;
+    for (unsigned i = 0; i < tables.size(); i++) fprintf(f, "table %s\n", tables[i].c_str());
+    for (unsigned i = 0; i < pages.size(); i++) fprintf(f, "page %s %d\n", pages[i].first.c_str(), pages[i].second);
+    return fclose(f) == 0 ? 0 : RC_FILE_WRITE_FAILED;
+}
+
+void SqlEngine::closeTables() {
+    map<string, shared_ptr<OpenTable> > tables;
+    {
+        lock_guard<mutex> guard(catalogLock);
+        tables.swap(openTables);
+    }
+    // the files are closed here, while PageFile still knows their snapshots
+    tables.clear();
+}
+
+void SqlEngine::warmUp(const string &filename) {
+    ifstream in(filename.c_str());
+    string line;
+    map<string, vector<PageId> > pages;
+
+    while (getline(in, line)) {
+        char name[1024];
+        PageId pid;
+        if (sscanf(line.c_str(), "table %1023s", name) == 1) {
+            // the files stay open, and the dictionary and the filters in memory
+            getOpenTable(name);
+        } else if (sscanf(line.c_str(), "page %1023s %d", name, &pid) == 2) {
+            pages[name].push_back(pid);
+        }
+    }
+    for (map<string, vector<PageId> >::iterator it = pages.begin(); it != pages.end(); ++it) {
+        PageFile::prefetch(it->first, it->second);
+    }
+}
+
+SqlSession::~SqlSession() {
+    for (map<string, PreparedStatement *>::iterator it = statements.begin(); it != statements.end(); ++it) {
+        delete it->second;
+    }
+}
+
+RC SqlEngine::prepare(const string &name, int attr, const string &table,
+                      const vector<vector<SelCond> > &disjuncts, int params, const SelOptions &options) {
+    if (session == NULL) return RC_INVALID_COMMAND;
+
+    PreparedStatement *ps = new PreparedStatement;
+    ps->attr = attr;
+    ps->table = table;
+    ps->disjuncts = disjuncts;
+    ps->options = options;
+    ps->params = params;
+    // the values of the command are freed when it is done
+    for (unsigned i = 0; i < ps->disjuncts.size(); i++) {
+        for (unsigned j = 0; j < ps->disjuncts[i].size(); j++) {
+            SelCond &cond = ps->disjuncts[i][j];
+            if (cond.param == 0) cond.value = ps->values.copy(cond.value, strlen(cond.value));
+        }
+    }
+
+    PreparedStatement *&slot = session->statements[name];
+    delete slot;
+    slot = ps;
     return 0;
 }
 
+RC SqlEngine::executePrepared(const string &name, const vector<char *> &values) {
+    map<string, PreparedStatement *>::iterator it;
+    if (session == NULL || (it = session->statements.find(name)) == session->statements.end()) {
+        fprintf(errorStream(), "Error: prepared statement %s does not exist\n", name.c_str());
+        return RC_INVALID_COMMAND;
+    }
+    PreparedStatement &ps = *it->second;
+    if ((int) values.size() != ps.params) {
+        fprintf(errorStream(), "Error: %s takes %d parameters\n", name.c_str(), ps.params);
+        return RC_INVALID_COMMAND;
+    }
+
+    // bind the parameters. the values live until the command is done
+    for (unsigned i = 0; i < ps.disjuncts.size(); i++) {
+        for (unsigned j = 0; j < ps.disjuncts[i].size(); j++) {
+            SelCond &cond = ps.disjuncts[i][j];
+            if (cond.param > 0) cond.value = values[cond.param - 1];
+        }
+    }
 
-RC SqlEngine::select(int attr, const string &table, const vector<SelCond> &conds) {
+    return select(ps.attr, ps.table, ps.disjuncts, ps.options);
+}
 
-    PageFile pf;
+RC SqlEngine::deallocate(const string &name) {
+    map<string, PreparedStatement *>::iterator it;
+    if (session == NULL || (it = session->statements.find(name)) == session->statements.end()) {
+        fprintf(errorStream(), "Error: prepared statement %s does not exist\n", name.c_str());
+        return RC_INVALID_COMMAND;
+    }
+    delete it->second;
+    session->statements.erase(it);
+    return 0;
+}
 
-    if(pf.open(table+".idx", 'r')<0) return selectWithoutIndex(attr, table, conds);
 
+RC SqlEngine::select(int attr, const string &table, const vector<SelCond> &conds, const SelOptions &options) {
+
+    TableGuard guard(table, false);
+
+    if (getMemTable(table) != NULL) return selectInMemory(attr, table, vector<vector<SelCond> >(1, conds), options);
+
+    // a definite miss. print the result of no rows without touching the index or the table
+    if (bloomRulesOut(*getOpenTable(table), conds)) return selectNothing(attr, table, options);
+
+    if(!getOpenTable(table)->indexed) return selectWithoutIndex(attr, table, conds, options);
+
+    // the index hands out rows in key order (either way), which lets ORDER BY key LIMIT n stop early
+    bool indexOrdered = options.orderAttr == 1 && options.limit >= 0;
 
     int tempMin, tempMax;
     CombinedCond cCond;
     if(conds.size()<1){
-        if(attr == 2 || attr == 3) return selectWithoutIndex(attr, table, conds);
-        else return selectWithIndex(attr, table, cCond, conds);
+        if((readsValue(attr) || options.groupAttr == 2) && !indexOrdered) return selectWithoutIndex(attr, table, conds, options);
+        else return selectWithIndex(attr, table, cCond, conds, options);
 
     }
 
@@ -59,18 +876,18 @@ RC SqlEngine::select(int attr, const string &table, const vector<SelCond> &conds
             int condValue = atoi(conds[i].value);
             switch(conds[i].comp) {
                 case SelCond::EQ:
-                    if(cCond.hasEqual && condValue != cCond.exactKey) return 0;
+                    if(cCond.hasEqual && condValue != cCond.exactKey) return selectNothing(attr, table, options);
                     cCond.hasEqual = true;
-                    if(cCond.hasNEqual && condValue == cCond.exactKey) return 0;
-                    if(cCond.hasRange && (condValue>cCond.rangeMax||condValue<cCond.rangeMin)) return 0;
+                    if(find(cCond.neKeys.begin(), cCond.neKeys.end(), condValue) != cCond.neKeys.end()) return selectNothing(attr, table, options);
+                    if(cCond.hasRange && (condValue>cCond.rangeMax||condValue<cCond.rangeMin)) return selectNothing(attr, table, options);
                     cCond.exactKey = condValue;
 
                     break;
 
                 case SelCond::NE:
                     cCond.hasNEqual = true;
-                    if(cCond.hasEqual && condValue == cCond.exactKey) return 0;
-                    cCond.exactKey = condValue;
+                    if(cCond.hasEqual && condValue == cCond.exactKey) return selectNothing(attr, table, options);
+                    cCond.neKeys.push_back(condValue);
 
                     break;
 
@@ -79,7 +896,7 @@ RC SqlEngine::select(int attr, const string &table, const vector<SelCond> &conds
                 case SelCond::GE:
                     cCond.hasRange = true;
                     tempMin = condValue;
-                    if(tempMin > cCond.rangeMax) return 0;
+                    if(tempMin > cCond.rangeMax) return selectNothing(attr, table, options);
                     cCond.rangeMin = max(cCond.rangeMin, tempMin);
                     break;
 
@@ -88,7 +905,7 @@ RC SqlEngine::select(int attr, const string &table, const vector<SelCond> &conds
                 case SelCond::LE:
                     cCond.hasRange = true;
                     tempMax = condValue;
-                    if(tempMax < cCond.rangeMin) return 0;
+                    if(tempMax < cCond.rangeMin) return selectNothing(attr, table, options);
                     cCond.rangeMax = min(cCond.rangeMax, tempMax);
                     break;
 
@@ -100,153 +917,602 @@ RC SqlEngine::select(int attr, const string &table, const vector<SelCond> &conds
         }
     }
     if(cCond.hasEqual && cCond.hasNEqual) cCond.hasNEqual = false;
+    sort(cCond.neKeys.begin(), cCond.neKeys.end());
+    cCond.neKeys.erase(unique(cCond.neKeys.begin(), cCond.neKeys.end()), cCond.neKeys.end());
     if(cCond.hasRange && cCond.hasEqual) {
-        if(cCond.exactKey < cCond.rangeMin || cCond.exactKey>cCond.rangeMax) return 0;
+        if(cCond.exactKey < cCond.rangeMin || cCond.exactKey>cCond.rangeMax) return selectNothing(attr, table, options);
     }
-    if((cCond.hasValue && ! cCond.hasKey)||(cCond.hasNEqual && !cCond.hasEqual && !cCond.hasRange)) {
-        return selectWithoutIndex(attr, table, conds);
+    if(((cCond.hasValue && ! cCond.hasKey)||(cCond.hasNEqual && !cCond.hasEqual && !cCond.hasRange)) && !indexOrdered) {
+        return selectWithoutIndex(attr, table, conds, options);
     } else {
-        return selectWithIndex(attr, table, cCond, conds);
+        return selectWithIndex(attr, table, cCond, conds, options);
+    }
+
+}
+
+
+static RC selectNothing(int attr, const string &table, const SelOptions &options) {
+    RecordFile rf;  // never read. the sink gets no rows
+    ResultSink sink(attr, table, options, false, false);
+    sink.finish(rf);
+    return 0;
+}
+
+
+RC SqlEngine::select(int attr, const string &table, const vector<vector<SelCond> > &disjuncts, const SelOptions &options) {
+    TableGuard guard(table, false);
+    if (disjuncts.size() == 1) return select(attr, table, disjuncts[0], options);
+    if (getMemTable(table) != NULL) return selectInMemory(attr, table, disjuncts, options);
+
+    // drop the disjuncts the Bloom filters rule out, e.g., the misses of an IN list
+    shared_ptr<OpenTable> files = getOpenTable(table);
+    vector<vector<SelCond> > live;
+    for (unsigned i = 0; i < disjuncts.size(); i++) {
+        if (!bloomRulesOut(*files, disjuncts[i])) live.push_back(disjuncts[i]);
+    }
+    if (live.size() == 1) return select(attr, table, live[0], options);
+
+    vector<pair<int, int> > intervals;
+    keyIntervals(live, intervals);
+    return selectIntervals(attr, table, live, intervals, options);
+}
+
+
+RC SqlEngine::selectInMemory(int attr, const string &table, const vector<vector<SelCond> > &disjuncts,
+                             const SelOptions &options) {
+    const MemTable &mt = *getMemTable(table);
+    RecordFile rf;  // never read. the sink gets the value of every row
+
+    vector<pair<int, int> > intervals;
+    keyIntervals(disjuncts, intervals);
+
+    // look the intervals up in the sorted index unless one of them is every key
+    bool scan = intervals.size() == 1 && intervals[0].first == INT_MIN && intervals[0].second == INT_MAX;
+    ResultSink sink(attr, table, options, !scan, false);
+    if (scan) {
+        for (int row = 0; row < mt.getRowCount() && !sink.done(); row++) {
+            if (satisfiesAny(disjuncts, mt.getKey(row), mt.getValue(row))) {
+                sink.add(mt.getKey(row), MemTable::toRid(row), &mt.getValue(row), rf);
+            }
+        }
+    } else {
+        for (unsigned i = 0; i < intervals.size() && !sink.done(); i++) {
+            int first, last;
+            mt.lookup(intervals[i].first, intervals[i].second, first, last);
+            for (int pos = first; pos < last && !sink.done(); pos++) {
+                int row = mt.getIndexedRow(pos);
+                if (satisfiesAny(disjuncts, mt.getKey(row), mt.getValue(row))) {
+                    sink.add(mt.getKey(row), MemTable::toRid(row), &mt.getValue(row), rf);
+                }
+            }
+        }
+    }
+    sink.finish(rf);
+    return 0;
+}
+
+
+RC SqlEngine::selectIntervals(int attr, const string &table, const vector<vector<SelCond> > &disjuncts,
+                              const vector<pair<int, int> > &intervals, const SelOptions &options) {
+    shared_ptr<OpenTable> pinned = getOpenTable(table);
+    OpenTable &files = *pinned;
+    BTreeIndex &bi = files.index;
+    const RecordFile &rf = files.records;
+    RecordId rid;
+    RC rc;
+    int key;
+    string value;
+
+    if (!files.stored) {
+        fprintf(errorStream(), "Error: table %s does not exist\n", table.c_str());
+        return RC_FILE_OPEN_FAILED;
+    }
+    bool indexed = files.indexed;
+
+    // true if the rows in the intervals are all results
+    bool rangesOnly = true;
+    bool valueConds = false;
+    for (unsigned i = 0; i < disjuncts.size(); i++) {
+        for (unsigned j = 0; j < disjuncts[i].size(); j++) {
+            if (disjuncts[i][j].attr == 2) valueConds = true;
+            if (disjuncts[i][j].attr == 2 || disjuncts[i][j].comp == SelCond::NE) rangesOnly = false;
+        }
+    }
+    bool countOnly = rangesOnly && attr == 4 && options.groupAttr == 0;
+    bool needsValue = valueConds || readsValue(attr) || options.orderAttr == 2 || options.groupAttr == 2;
+    bool useIndex = indexed;
+    if (indexed && (countOnly || needsValue)) {
+        int rows = 0;
+        for (unsigned i = 0; i < intervals.size(); i++) {
+            int n;
+            bi.count(intervals[i].first, intervals[i].second, n);
+            rows += n;
+        }
+        if (countOnly) {
+            fprintf(resultStream(), "%d\n", rows);
+            return 0;
+        }
+        // going through the index reads a table page per row for the value
+        useIndex = rows < rf.endRid().pid + 1;
+    }
+    ResultSink sink(attr, table, options, useIndex, false);
+    if (useIndex) {
+        // one sorted sweep. the cursor only moves forward, so intervals
+        // that are close together share the leaf nodes on the way
+        IndexCursor cursor;
+        cursor.pid = -1;
+        for (unsigned i = 0; i < intervals.size() && !sink.done(); i++) {
+            bi.relocate(intervals[i].first, cursor);
+            while (!sink.done() && bi.readForward(cursor, key, rid) == 0 && key <= intervals[i].second) {
+                if (needsValue) rf.read(rid, key, value);
+                if (satisfiesAny(disjuncts, key, value)) sink.add(key, rid, needsValue ? &value : NULL, rf);
+            }
+        }
+    } else {
+        const ZoneMap &zm = files.zones;
+        bool zoned = files.zoned;
+        for (rid.pid = rid.sid = 0; rid < rf.endRid() && !sink.done(); ++rid) {
+            if (rid.sid == 0 && zoned && !pageMayMatch(zm, rid.pid, disjuncts)) {
+                // skip to the last slot of the page
+                rid.sid = RecordFile::RECORDS_PER_PAGE - 1;
+                continue;
+            }
+            if ((rc = rf.read(rid, key, value)) < 0) {
+                fprintf(errorStream(), "Error: while reading a tuple from table %s\n", table.c_str());
+                return rc;
+            }
+            if (satisfiesAny(disjuncts, key, value)) sink.add(key, rid, &value, rf);
+        }
+    }
+    sink.finish(rf);
+    return 0;
+}
+
+
+RC SqlEngine::selectWithIndex(int attr, const std::string &table, const CombinedCond& cCond, const vector<SelCond> &conds, const SelOptions &options) {
+    shared_ptr<OpenTable> pinned = getOpenTable(table);
+    OpenTable &files = *pinned;
+    BTreeIndex &bi = files.index;
+    RecordFile &rf = files.records;   // RecordFile containing the table
+    RecordId rid;  // record cursor for table scanning
+    if(!files.indexed) {
+        return RC_FILE_OPEN_FAILED;
+    }
+    if(readsValue(attr) || cCond.hasValue || options.orderAttr == 2 || options.groupAttr == 2){
+        if (!files.stored) {
+            fprintf(errorStream(), "Error: table %s does not exist\n", table.c_str());
+            return RC_FILE_OPEN_FAILED;
+        }
+    }
+    int key;
+    IndexCursor indexCursor;
+    if(attr == 4 && !cCond.hasValue && options.groupAttr == 0) {
+        // answer from the entry counts in the non-leaf nodes
+        int count;
+        if(cCond.hasEqual) {
+            bi.count(cCond.exactKey, cCond.exactKey, count);
+        } else {
+            bi.count(cCond.rangeMin, cCond.rangeMax, count);
+            for(unsigned i = 0; cCond.hasNEqual && i < cCond.neKeys.size(); i++) {
+                int k = cCond.neKeys[i];
+                if(k < cCond.rangeMin || k > cCond.rangeMax) continue;
+                int excluded;
+                bi.count(k, k, excluded);
+                count -= excluded;
+            }
+        }
+        fprintf(resultStream(), "%d\n", count);
+        return 0;
+    }
+    if(attr >= 5 && attr <= 8 && !cCond.hasValue && options.groupAttr == 0) {
+        return aggregateWithIndex(attr, bi, cCond);
+    }
+    // ORDER BY key DESC walks the leaves backward from rangeMax
+    bool backward = options.orderAttr == 1 && options.desc;
+    ResultSink sink(attr, table, options, true, backward);
+    //search starting from rangeMin. an equality condition is the range [exactKey, exactKey]
+    int minKey = cCond.hasEqual ? cCond.exactKey : cCond.rangeMin;
+    int maxKey = cCond.hasEqual ? cCond.exactKey : cCond.rangeMax;
+    key = minKey;
+    if(sink.isStreaming() && attr < 4 && options.offset > 0 && !cCond.hasValue && !cCond.hasNEqual) {
+        // every entry in the range is a result row,
+        // so jump over the OFFSET rows with the entry counts
+        int before = 0;
+        if(backward) {
+            bi.count(INT_MIN, maxKey, before);
+            if(bi.locateByRank(before - 1 - options.offset, indexCursor) < 0) indexCursor.pid = -1;
+        } else {
+            if(minKey > INT_MIN) bi.count(INT_MIN, minKey - 1, before);
+            if(bi.locateByRank(before + options.offset, indexCursor) < 0) indexCursor.pid = -1;
+        }
+        sink.skip(options.offset);
+    } else if(backward) {
+        bi.locateLast(maxKey, indexCursor);
+    } else {
+        bi.locate(key, indexCursor);
+    }
+    while(!sink.done() && (backward ? bi.readBackward(indexCursor, key, rid) == 0 && key >= minKey
+                                    : bi.readForward(indexCursor, key, rid) == 0 && key <= maxKey)) {
+        // key-only predicates first. they need nothing but the index entry
+        if (cCond.hasNEqual && excludedKey(cCond, key)) {
+            continue;
+        }
+        if (cCond.hasValue || sink.needsValue()) {
+            // fetch the record once for all value conditions and hand it on
+            string value;
+            rf.read(rid, key, value);
+            if (cCond.hasValue && !satisfies(conds, key, value)) {
+                continue;
+            }
+            sink.add(key, rid, &value, rf);
+        } else {
+            // the sink reads the value of the rows it prints, if it needs them
+            sink.add(key, rid, NULL, rf);
+        }
+    }
+    sink.finish(rf);
+    return 0;
+}
+
+RC SqlEngine::aggregateWithIndex(int attr, BTreeIndex &bi, const CombinedCond &cCond) {
+    Aggregate agg;
+    IndexCursor cursor;
+    int key;
+    RecordId rid;
+    int minKey = cCond.hasEqual ? cCond.exactKey : cCond.rangeMin;
+    int maxKey = cCond.hasEqual ? cCond.exactKey : cCond.rangeMax;
+    bool skipKey = cCond.hasNEqual && !cCond.hasEqual;
+
+    switch(attr) {
+        case 5:
+            // MIN(key) is the first entry at or behind rangeMin
+            bi.locate(minKey, cursor);
+            while(bi.readForward(cursor, key, rid) == 0 && key <= maxKey) {
+                if(skipKey && excludedKey(cCond, key)) continue;
+                agg.add(key, NULL);
+                break;
+            }
+            break;
+
+        case 6:
+            // MAX(key) is the last entry at or in front of rangeMax
+            bi.locateLast(maxKey, cursor);
+            while(bi.readBackward(cursor, key, rid) == 0 && key >= minKey) {
+                if(skipKey && excludedKey(cCond, key)) continue;
+                agg.add(key, NULL);
+                break;
+            }
+            break;
+
+        case 7:
+        case 8: {
+            // sum the keys a leaf at a time
+            int keys[BT_MAX_PACKED_KEY];
+            int n;
+            bi.locate(minKey, cursor);
+            while(bi.readLeaf(cursor, keys, NULL, n) == 0) {
+                int end = n;
+                while(end > 0 && keys[end - 1] > maxKey) end--;
+                long long sum = 0;
+                for(int i = 0; i < end; i++) {
+                    sum += keys[i];
+                }
+                agg.sum += sum;
+                agg.count += end;
+                if(end < n) break;
+            }
+            // take out the entries of the <> keys with the entry counts
+            for(unsigned i = 0; skipKey && i < cCond.neKeys.size(); i++) {
+                int k = cCond.neKeys[i];
+                if(k < minKey || k > maxKey) continue;
+                int excluded;
+                bi.count(k, k, excluded);
+                agg.sum -= (long long) excluded * k;
+                agg.count -= excluded;
+            }
+            break;
+        }
+    }
+    agg.print(attr);
+    return 0;
+}
+
+void Aggregate::add(int key, const string *value) {
+    count++;
+    sum += key;
+    if (key < minKey) minKey = key;
+    if (key > maxKey) maxKey = key;
+    if (value != NULL) {
+        if (count == 1 || *value < minValue) minValue = *value;
+        if (count == 1 || *value > maxValue) maxValue = *value;
+    }
+}
+
+void Aggregate::print(int attr) const {
+    if (attr != 4 && count == 0) {
+        // aggregates other than COUNT(*) are undefined on no rows
+        fprintf(resultStream(), "NULL\n");
+        return;
+    }
+    switch (attr) {
+        case 4:  // COUNT(*)
+            fprintf(resultStream(), "%d\n", count);
+            break;
+        case 5:  // MIN(key)
+            fprintf(resultStream(), "%d\n", minKey);
+            break;
+        case 6:  // MAX(key)
+            fprintf(resultStream(), "%d\n", maxKey);
+            break;
+        case 7:  // SUM(key)
+            fprintf(resultStream(), "%lld\n", sum);
+            break;
+        case 8:  // AVG(key)
+            fprintf(resultStream(), "%.3f\n", (double) sum / count);
+            break;
+        case 9:  // MIN(value)
+            fprintf(resultStream(), "%s\n", minValue.c_str());
+            break;
+        case 10: // MAX(value)
+            fprintf(resultStream(), "%s\n", maxValue.c_str());
+            break;
+    }
+}
+
+static bool readsValue(int attr) {
+    return attr == 2 || attr == 3 || attr == 9 || attr == 10;
+}
+
+static bool satisfies(const vector<SelCond> &conds, int key, const string &value) {
+    for (unsigned i = 0; i < conds.size(); i++) {
+        int diff = (conds[i].attr == 1) ? key - atoi(conds[i].value)
+                                        : strcmp(value.c_str(), conds[i].value);
+        switch (conds[i].comp) {
+            case SelCond::EQ: if (diff != 0) return false; break;
+            case SelCond::NE: if (diff == 0) return false; break;
+            case SelCond::GT: if (diff <= 0) return false; break;
+            case SelCond::LT: if (diff >= 0) return false; break;
+            case SelCond::GE: if (diff < 0) return false; break;
+            case SelCond::LE: if (diff > 0) return false; break;
+        }
+    }
+    return true;
+}
+
+static bool satisfiesAny(const vector<vector<SelCond> > &disjuncts, int key, const string &value) {
+    for (unsigned i = 0; i < disjuncts.size(); i++) {
+        if (satisfies(disjuncts[i], key, value)) return true;
     }
+    return false;
+}
 
+static bool excludedKey(const CombinedCond &cCond, int key) {
+    return binary_search(cCond.neKeys.begin(), cCond.neKeys.end(), key);
 }
 
+static bool keyRange(const vector<SelCond> &conds, int &minKey, int &maxKey) {
+    minKey = INT_MIN;
+    maxKey = INT_MAX;
+    for (unsigned i = 0; i < conds.size(); i++) {
+        if (conds[i].attr != 1) continue;
+        int k = atoi(conds[i].value);
+        switch (conds[i].comp) {
+            case SelCond::EQ: minKey = max(minKey, k); maxKey = min(maxKey, k); break;
+            case SelCond::GT: if (k == INT_MAX) return false; minKey = max(minKey, k + 1); break;
+            case SelCond::GE: minKey = max(minKey, k); break;
+            case SelCond::LT: if (k == INT_MIN) return false; maxKey = min(maxKey, k - 1); break;
+            case SelCond::LE: maxKey = min(maxKey, k); break;
+            default: break;
+        }
+    }
+    return minKey <= maxKey;
+}
 
-RC SqlEngine::selectWithIndex(int attr, const std::string &table, const CombinedCond& cCond, const vector<SelCond> &conds) {
-    BTreeIndex bi;
-    RecordFile rf;   // RecordFile containing the table
-    RecordId rid;  // record cursor for table scanning
-    int rc;
-    if((rc=bi.open(table+".idx", 'r'))<0) {
-        return rc;
+static void keyIntervals(const vector<vector<SelCond> > &disjuncts, vector<pair<int, int> > &intervals) {
+    vector<pair<int, int> > ranges;
+    for (unsigned i = 0; i < disjuncts.size(); i++) {
+        int minKey, maxKey;
+        if (keyRange(disjuncts[i], minKey, maxKey)) ranges.push_back(make_pair(minKey, maxKey));
     }
-    if(attr == 2 || attr == 3){
-        if ((rc = rf.open(table + ".tbl", 'r')) < 0) {
-            fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
-            return rc;
+    sort(ranges.begin(), ranges.end());
+    intervals.clear();
+    for (unsigned i = 0; i < ranges.size(); i++) {
+        if (!intervals.empty() && (long long) ranges[i].first <= (long long) intervals.back().second + 1) {
+            intervals.back().second = max(intervals.back().second, ranges[i].second);
+        } else {
+            intervals.push_back(ranges[i]);
         }
     }
-    int key;
-    IndexCursor indexCursor;
-    if(cCond.hasEqual){
-        //search with cCond.exactKey
-        key = cCond.exactKey;
-        if((rc = bi.locate(key, indexCursor)) < 0 ) {
-            return rc;
+}
+
+static bool zoneMayMatch(const ZoneMap::Zone &zone, const vector<SelCond> &conds) {
+    string minValue = ZoneMap::toString(zone.minValue);
+    string maxValue = ZoneMap::toString(zone.maxValue);
+    for (unsigned i = 0; i < conds.size(); i++) {
+        if (conds[i].attr == 1) {
+            int k = atoi(conds[i].value);
+            switch (conds[i].comp) {
+                case SelCond::EQ: if (k < zone.minKey || k > zone.maxKey) return false; break;
+                case SelCond::GT: if (zone.maxKey <= k) return false; break;
+                case SelCond::GE: if (zone.maxKey < k) return false; break;
+                case SelCond::LT: if (zone.minKey >= k) return false; break;
+                case SelCond::LE: if (zone.minKey > k) return false; break;
+                default: break;
+            }
         } else {
-            if(attr == 4){
-                fprintf(stdout, "1\n");
-            } else {
-                bi.readForward(indexCursor,key,rid);
-                printResult(attr, key, rid, rf);
+            // maxValue only bounds the value prefixes, so compare the prefix of the condition with it
+            string v = conds[i].value;
+            string prefix = v.substr(0, ZoneMap::VALUE_PREFIX);
+            switch (conds[i].comp) {
+                case SelCond::EQ: if (v < minValue || prefix > maxValue) return false; break;
+                case SelCond::GT:
+                case SelCond::GE: if (prefix > maxValue) return false; break;
+                case SelCond::LT: if (minValue >= v) return false; break;
+                case SelCond::LE: if (minValue > v) return false; break;
+                default: break;
             }
         }
-    } else {
-        //search starting from rangeMin
-        int count = 0;
-        key = cCond.rangeMin;
-        bi.locate(key, indexCursor);
-        while(bi.readForward(indexCursor, key, rid) == 0 && key <= cCond.rangeMax) {
-            if(cCond.hasValue) {
-                string value;
-                for(int i = 0; i < conds.size(); i++) {
-                    rf.read(rid,key, value);
-                    if(conds[i].attr == 1) {
-                        if(conds[i].comp == SelCond::EQ && conds[i].value!=value) {
-                            break;
-                        } else if(conds[i].comp == SelCond::NE && conds[i].value==value) {
-                            break;
-                        } else if(conds[i].comp == SelCond::GT && conds[i].value>=value) {
-                            break;
-                        } else if(conds[i].comp == SelCond::LT && conds[i].value<=value) {
-                            break;
-                        } else if(conds[i].comp == SelCond::GE && conds[i].value>value) {
-                            break;
-                        } else if(conds[i].comp == SelCond::LE && conds[i].value<value) {
-                            break;
-                        }
-                    }
-                    if (attr == 4) count++;
-                    else printResult(attr, key, rid, rf, value);
+    }
+    return true;
+}
 
-                }
+static bool pageMayMatch(const ZoneMap &zm, PageId pid, const vector<vector<SelCond> > &disjuncts) {
+    ZoneMap::Zone zone;
+    if (!zm.getZone(pid, zone)) return true;
+    for (unsigned i = 0; i < disjuncts.size(); i++) {
+        if (zoneMayMatch(zone, disjuncts[i])) return true;
+    }
+    return false;
+}
 
-            }
-            else {
-                if (cCond.hasNEqual && key == cCond.exactKey) {
-                    continue;
-                }
-                if (attr == 4) count++;
-                else printResult(attr, key, rid, rf);
-            }
-        }
-        if(attr == 4){
-            fprintf(stdout, "%d\n", count);
+static bool bloomRulesOut(const OpenTable &files, const vector<SelCond> &conds) {
+    for (unsigned i = 0; i < conds.size(); i++) {
+        if (conds[i].comp != SelCond::EQ) continue;
+        if (!(conds[i].attr == 1 ? files.keyBloomed : files.valueBloomed)) continue;
+        const BloomFilter &filter = conds[i].attr == 1 ? files.keyBloom : files.valueBloom;
+        unsigned long long h = (conds[i].attr == 1) ? BloomFilter::hash(atoi(conds[i].value))
+                                                    : BloomFilter::hash(string(conds[i].value));
+        if (!filter.mayContain(h)) return true;
+    }
+    return false;
+}
+
+static shared_ptr<OpenTable> getOpenTable(const string &table) {
+    lock_guard<mutex> guard(catalogLock);
+    shared_ptr<OpenTable> &files = openTables[table];
+    if (files == NULL) {
+        // the files are read at one snapshot, even if a LOAD commits meanwhile
+        PageFile::beginSnapshot();
+        files.reset(new OpenTable);
+        files->indexed = files->index.open(table + ".idx", 'r') == 0;
+        files->stored = files->records.open(table + ".tbl", 'r') == 0;
+        files->zoned = files->zones.open(table + ".zm", 'r') == 0;
+
+        // the bits of the filters are all in memory now
+        files->keyBloomed = files->keyBloom.open(table + ".kbf", 'r') == 0;
+        if (files->keyBloomed) files->keyBloom.close();
+        files->valueBloomed = files->valueBloom.open(table + ".vbf", 'r') == 0;
+        if (files->valueBloomed) files->valueBloom.close();
+        PageFile::endSnapshot();
+
+        // a table without files is not kept, so that the names queried do not pile up
+        if (!files->stored && !files->indexed) {
+            shared_ptr<OpenTable> none = files;
+            openTables.erase(table);
+            return none;
         }
     }
-    return 0;
+    return files;
 }
 
-RC SqlEngine::printResult(int attr, int key, RecordId& rid, RecordFile& rf) {
-    string value;
-    switch(attr) {
-        case 1:
-            fprintf(stdout, "%d\n", key);
-            break;
+static void dropOpenTable(const string &table) {
+    lock_guard<mutex> guard(catalogLock);
+    openTables.erase(table);
+}
 
-        case 2:
+OpenTable::~OpenTable() {
+    if (indexed) index.close();
+    if (stored) records.close();
+    if (zoned) zones.close();
+}
 
-            rf.read(rid,key, value);
-            fprintf(stdout, "%s\n", value.c_str());
-            break;
-        case 3:
-            rf.read(rid,key, value);
-            fprintf(stdout, "%d '%s'\n", key, value.c_str());
-            break;
-    }
-    return 0;
+static mutex &getLoadLock(const string &table) {
+    lock_guard<mutex> guard(catalogLock);
+    mutex *&l = loadLocks[table];
+    if (l == NULL) l = new mutex;
+    return *l;
 }
 
-RC SqlEngine::printResult(int attr, int key, RecordId& rid, RecordFile& rf, string value) {
+static void printRow(int attr, int key, const string &value) {
     switch(attr) {
         case 1:
-            fprintf(stdout, "%d\n", key);
+            fprintf(resultStream(), "%d\n", key);
             break;
 
         case 2:
-            fprintf(stdout, "%s\n", value.c_str());
+            fprintf(resultStream(), "%s\n", value.c_str());
             break;
         case 3:
-            fprintf(stdout, "%d '%s'\n", key, value.c_str());
+            fprintf(resultStream(), "%d '%s'\n", key, value.c_str());
             break;
     }
-    return 0;
 }
 
 
-RC SqlEngine::selectWithoutIndex(int attr, const std::string &table, const std::vector<SelCond> &cond) {
-    RecordFile rf;   // RecordFile containing the table
+RC SqlEngine::selectWithoutIndex(int attr, const std::string &table, const std::vector<SelCond> &cond, const SelOptions &options) {
+    shared_ptr<OpenTable> pinned = getOpenTable(table);
+    OpenTable &files = *pinned;
+    const RecordFile &rf = files.records;   // RecordFile containing the table
     RecordId rid;  // record cursor for table scanning
 
     RC rc;
     int key;
     string value;
-    int count;
+    int code;
     int diff;
+    ResultSink sink(attr, table, options, false, false);
 
-    // open the table file
-    if ((rc = rf.open(table + ".tbl", 'r')) < 0) {
-        fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
-        return rc;
+    if (!files.stored) {
+        fprintf(errorStream(), "Error: table %s does not exist\n", table.c_str());
+        return RC_FILE_OPEN_FAILED;
     }
 
+    // the zone map lets the scan skip pages with no matching tuple
+    const ZoneMap &zm = files.zones;
+    bool zoned = files.zoned;
+
     // scan the table file from the beginning
     rid.pid = rid.sid = 0;
-    count = 0;
-    while (rid < rf.endRid()) {
+
+    // with dictionary-encoded values, (in)equality on value compares codes
+    // and the value is only decoded for the rows that need it
+    bool encoded = rf.isEncoded();
+    vector<int> codes(cond.size(), -1);
+    for (unsigned i = 0; encoded && i < cond.size(); i++) {
+        if (cond[i].attr != 2 || (cond[i].comp != SelCond::EQ && cond[i].comp != SelCond::NE)) continue;
+        codes[i] = rf.getCode(cond[i].value);
+        // no tuple has a value missing from the dictionary
+        if (codes[i] < 0 && cond[i].comp == SelCond::EQ) rid = rf.endRid();
+    }
+
+    // a query that needs no value before the output reads the keys of a page
+    // at once, and only the values of the tuples that are printed
+    bool keysOnly = !sink.needsValue();
+    int keys[RecordFile::RECORDS_PER_PAGE];
+    int minKey, maxKey;
+    vector<int> excluded;  // the keys of the <> conditions
+    for (unsigned i = 0; i < cond.size(); i++) {
+        if (cond[i].attr == 2) keysOnly = false;
+        else if (cond[i].comp == SelCond::NE) excluded.push_back(atoi(cond[i].value));
+    }
+    if (!keyRange(cond, minKey, maxKey)) rid = rf.endRid();
+
+    while (rid < rf.endRid() && !sink.done()) {
+        ZoneMap::Zone zone;
+        if (rid.sid == 0 && zoned && zm.getZone(rid.pid, zone) && !zoneMayMatch(zone, cond)) {
+            rid.pid++;
+            continue;
+        }
+
+        if (keysOnly) {
+            int count;
+            if ((rc = rf.readKeys(rid.pid, keys, count)) < 0) {
+                fprintf(errorStream(), "Error: while reading a tuple from table %s\n", table.c_str());
+                goto exit_select;
+            }
+            for (; rid.sid < count && !sink.done(); rid.sid++) {
+                if (keys[rid.sid] < minKey || keys[rid.sid] > maxKey) continue;
+                if (find(excluded.begin(), excluded.end(), keys[rid.sid]) != excluded.end()) continue;
+                sink.add(keys[rid.sid], rid, NULL, rf);
+            }
+            rid.pid++;
+            rid.sid = 0;
+            continue;
+        }
+
         // read the tuple
-        if ((rc = rf.read(rid, key, value)) < 0) {
-            fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+        if ((rc = encoded ? rf.readCode(rid, key, code) : rf.read(rid, key, value)) < 0) {
+            fprintf(errorStream(), "Error: while reading a tuple from table %s\n", table.c_str());
             goto exit_select;
         }
 
@@ -258,7 +1524,9 @@ RC SqlEngine::selectWithoutIndex(int attr, const std::string &table, const std::
                     diff = key - atoi(cond[i].value);
                     break;
                 case 2:
-                    diff = strcmp(value.c_str(), cond[i].value);
+                    if (!encoded) diff = strcmp(value.c_str(), cond[i].value);
+                    else if (cond[i].comp == SelCond::EQ || cond[i].comp == SelCond::NE) diff = (code != codes[i]);
+                    else diff = strcmp(rf.getValue(code).c_str(), cond[i].value);
                     break;
             }
 
@@ -286,61 +1554,578 @@ RC SqlEngine::selectWithoutIndex(int attr, const std::string &table, const std::
         }
 
         // the condition is met for the tuple.
-        // increase matching tuple counter
-        count++;
-
-        // print the tuple
-        switch (attr) {
-            case 1:  // SELECT key
-                fprintf(stdout, "%d\n", key);
-                break;
-            case 2:  // SELECT value
-                fprintf(stdout, "%s\n", value.c_str());
-                break;
-            case 3:  // SELECT *
-                fprintf(stdout, "%d '%s'\n", key, value.c_str());
-                break;
-        }
+        if (encoded) value = rf.getValue(code);
+        sink.add(key, rid, &value, rf);
 
         // move to the next tuple
         next_tuple:
         ++rid;
     }
 
-    // print matching tuple count if "select count(*)"
-    if (attr == 4) {
-        fprintf(stdout, "%d\n", count);
-    }
+    // print the rows kept for ORDER BY or the matching tuple count if "select count(*)"
+    sink.finish(rf);
     rc = 0;
 
-    // close the table file and return
+    // the table file stays open for the next statement
     exit_select:
-    rf.close();
     return rc;
 }
 
 
 
 
-RC SqlEngine::load(const string &table, const string &loadfile, bool index) {
-    /* your code here */
-    string line;
-    RC rc;
+//
+// helpers for joining two tables on key
+//
+
+// memory the build side of a hash join may use before both sides are partitioned
+static const size_t JOIN_MEMORY_BUDGET = 4 * 1024 * 1024;
+
+// # temporary files each side of a partitioned hash join is split into
+static const int JOIN_PARTITIONS = 16;
+
+// partitions of partitions are not split again past this depth
+static const int JOIN_MAX_DEPTH = 4;
+
+// estimated # pages an index probe reads that are not cached already
+static const int JOIN_PROBE_PAGES = 2;
+
+// estimated # entries in a leaf node
+static const int JOIN_LEAF_ENTRIES = BT_MAX_KEY * 2 / 3;
+
+/**
+ * One side of a join: the rows of a table (or of a partition of it)
+ * that satisfy the conditions on that table. The rows are read either
+ * through the index in key order or by scanning the table file.
+ */
+class JoinInput {
+public:
+    string table;           // the table. the file name for a partition
+    bool left;              // true for the first table in the FROM clause
+    vector<SelCond> conds;  // conditions on the rows
+    bool needsValue;        // true if the value is printed or has a condition
+    int minKey, maxKey;     // the key range the conditions allow
+    bool indexed;           // true if the table has an index
+    bool ordered;           // true if next() reads through the index
     RecordFile rf;
     BTreeIndex bi;
 
-    if ((rc = rf.open(table + ".tbl", 'w')) < 0) {
-        fprintf(stderr, "Error: open table %s failed\n", table.c_str());
+    JoinInput(): left(true), needsValue(false), minKey(INT_MIN), maxKey(INT_MAX),
+                 indexed(false), ordered(false), stopKey(INT_MAX) { };
+
+    /**
+     * open the table file and the index of the table, if any.
+     * @return error code. 0 if no error
+     */
+    RC open();
+
+    /**
+     * create an empty partition of another side.
+     * @param filename[IN] the partition file
+     * @param side[IN] the side that is partitioned
+     * @return error code. 0 if no error
+     */
+    RC create(const string &filename, const JoinInput &side);
+
+    /**
+     * @return the estimated # rows in the key range
+     */
+    int rows();
+
+    /**
+     * @return the estimated # pages read to get the rows through the index
+     */
+    int indexScanPages() { return rows() / JOIN_LEAF_ENTRIES + 1 + (needsValue ? rows() : 0); }
+
+    /**
+     * @return the # pages read to scan the table file
+     */
+    int tableScanPages() { return rf.endRid().pid + 1; }
+
+    /**
+     * read through the index if that is cheaper than scanning the table.
+     */
+    void chooseScan() { ordered = indexed && indexScanPages() < tableScanPages(); }
+
+    /**
+     * start over from the first row.
+     */
+    void rewind();
+
+    /**
+     * restrict the rows to those with the key. the side must be ordered.
+     * @param key[IN] the key to look for
+     */
+    void seek(int key);
+
+    /**
+     * read the next row.
+     * @param key[OUT] the key of the row
+     * @param value[OUT] the value of the row. only set if needsValue or not ordered
+     * @return false if there are no more rows
+     */
+    bool next(int &key, string &value);
+
+private:
+    IndexCursor cursor;  // the next index entry if ordered
+    RecordId rid;        // the next record if not ordered
+    int stopKey;         // the last key to read if ordered
+};
+
+RC JoinInput::open() {
+    RC rc;
+    // the table file and the index are read at one snapshot
+    PageFile::beginSnapshot();
+    rc = rf.open(table + ".tbl", 'r');
+    indexed = rc == 0 && bi.open(table + ".idx", 'r') == 0;
+    PageFile::endSnapshot();
+    if (rc < 0) {
+        fprintf(errorStream(), "Error: table %s does not exist\n", table.c_str());
         return rc;
     }
+    if (!keyRange(conds, minKey, maxKey)) {
+        // no row can match
+        minKey = INT_MAX;
+        maxKey = INT_MIN;
+    }
+    return 0;
+}
 
-    if (index) {
-        if ((rc = bi.open(table+".idx", 'w')) < 0) {
-            fprintf(stderr, "Error: create index %s failed\n", table.c_str());
-            rf.close();
-            return rc;
+RC JoinInput::create(const string &filename, const JoinInput &side) {
+    table = filename;
+    left = side.left;
+    needsValue = side.needsValue;
+    ::unlink(filename.c_str());
+    return rf.open(filename, 'w');
+}
+
+int JoinInput::rows() {
+    if (indexed) {
+        int n = 0;
+        if (minKey <= maxKey) bi.count(minKey, maxKey, n);
+        return n;
+    }
+    return rf.endRid().pid * RecordFile::RECORDS_PER_PAGE + rf.endRid().sid;
+}
+
+void JoinInput::rewind() {
+    if (ordered) {
+        stopKey = maxKey;
+        if (minKey > maxKey || bi.locate(minKey, cursor) == RC_END_OF_TREE) cursor.pid = -1;
+    } else {
+        rid.pid = rid.sid = 0;
+    }
+}
+
+void JoinInput::seek(int key) {
+    stopKey = key;
+    if (key < minKey || key > maxKey || bi.locate(key, cursor) == RC_END_OF_TREE) cursor.pid = -1;
+}
+
+bool JoinInput::next(int &key, string &value) {
+    RecordId r;
+    for (;;) {
+        if (ordered) {
+            if (bi.readForward(cursor, key, r) != 0 || key > stopKey) return false;
+            if (needsValue && rf.read(r, key, value) < 0) return false;
+        } else {
+            if (!(rid < rf.endRid())) return false;
+            r = rid++;
+            if (rf.read(r, key, value) < 0) return false;
+        }
+        if (satisfies(conds, key, value)) return true;
+    }
+}
+
+/**
+ * Prints the rows of a join.
+ */
+class JoinOutput {
+public:
+    /**
+     * @param attr[IN] 1 - key, 2 - left value, 3 - right value, 4 - *, 5 - count(*)
+     */
+    JoinOutput(int attr): attr(attr), count(0) { };
+
+    /**
+     * @return true if the value of the left (or right) side is printed
+     */
+    bool printsValue(bool left) const { return attr == 4 || attr == (left ? 2 : 3); }
+
+    /**
+     * print a joined row.
+     * @param key[IN] the key of both rows
+     * @param side[IN] the side value is from
+     * @param value[IN] the value of the row on side
+     * @param other[IN] the value of the row on the other side
+     */
+    void emit(int key, const JoinInput &side, const string &value, const string &other);
+
+    /**
+     * print the row count for count(*).
+     */
+    void finish() const { if (attr == 5) fprintf(resultStream(), "%d\n", count); }
+
+private:
+    int attr;
+    int count;
+};
+
+void JoinOutput::emit(int key, const JoinInput &side, const string &value, const string &other) {
+    const string &leftValue = side.left ? value : other;
+    const string &rightValue = side.left ? other : value;
+    count++;
+    switch (attr) {
+        case 1:
+            fprintf(resultStream(), "%d\n", key);
+            break;
+        case 2:
+            fprintf(resultStream(), "%s\n", leftValue.c_str());
+            break;
+        case 3:
+            fprintf(resultStream(), "%s\n", rightValue.c_str());
+            break;
+        case 4:
+            fprintf(resultStream(), "%d '%s' '%s'\n", key, leftValue.c_str(), rightValue.c_str());
+            break;
+    }
+}
+
+// walk both indexes in key order and join the runs of equal keys
+static void mergeJoin(JoinInput &left, JoinInput &right, JoinOutput &out) {
+    int lkey, rkey;
+    string lvalue, rvalue;
+    vector<string> run;
+
+    left.rewind();
+    right.rewind();
+    bool hasLeft = left.next(lkey, lvalue);
+    bool hasRight = right.next(rkey, rvalue);
+    while (hasLeft && hasRight) {
+        if (lkey < rkey) {
+            hasLeft = left.next(lkey, lvalue);
+        } else if (lkey > rkey) {
+            hasRight = right.next(rkey, rvalue);
+        } else {
+            int key = lkey;
+            run.clear();
+            while (hasLeft && lkey == key) {
+                run.push_back(lvalue);
+                hasLeft = left.next(lkey, lvalue);
+            }
+            while (hasRight && rkey == key) {
+                for (unsigned i = 0; i < run.size(); i++) {
+                    out.emit(key, left, run[i], rvalue);
+                }
+                hasRight = right.next(rkey, rvalue);
+            }
+        }
+    }
+}
+
+// look up the key of every outer row in the index of the inner side
+static void indexNestedLoopJoin(JoinInput &outer, JoinInput &inner, JoinOutput &out) {
+    int key, innerKey;
+    string value, innerValue;
+
+    outer.rewind();
+    while (outer.next(key, value)) {
+        inner.seek(key);
+        while (inner.next(innerKey, innerValue)) {
+            out.emit(key, outer, value, innerValue);
+        }
+    }
+}
+
+/**
+ * build a hash table on the rows of build and look up the key of every
+ * row of probe in it. if build does not fit in JOIN_MEMORY_BUDGET, both
+ * sides are partitioned by the hash of the key into temporary files and
+ * the partitions are joined pair by pair.
+ */
+static void hashJoin(JoinInput &build, JoinInput &probe, JoinOutput &out, int depth) {
+    typedef std::unordered_multimap<int, string> JoinTable;
+    JoinTable table;
+    size_t memoryUsed = 0;
+    int key;
+    string value;
+
+    build.rewind();
+    bool fits = true;
+    while (build.next(key, value)) {
+        if (memoryUsed >= JOIN_MEMORY_BUDGET && depth < JOIN_MAX_DEPTH) {
+            fits = false;
+            break;
+        }
+        table.insert(make_pair(key, build.needsValue ? value : string()));
+        memoryUsed += sizeof(int) + sizeof(string) + 4 * sizeof(void *) + value.size();
+    }
+
+    if (fits) {
+        probe.rewind();
+        while (probe.next(key, value)) {
+            pair<JoinTable::const_iterator, JoinTable::const_iterator> match = table.equal_range(key);
+            for (JoinTable::const_iterator it = match.first; it != match.second; ++it) {
+                out.emit(key, probe, value, it->second);
+            }
+        }
+        return;
+    }
+    table.clear();
+
+    JoinInput buildParts[JOIN_PARTITIONS], probeParts[JOIN_PARTITIONS];
+    JoinInput *sides[2] = { &build, &probe };
+    JoinInput *parts[2] = { buildParts, probeParts };
+    for (int s = 0; s < 2; s++) {
+        for (int p = 0; p < JOIN_PARTITIONS; p++) {
+            char name[64];
+            sprintf(name, ".join%d%c%d_%d.tmp", threadNumber(), s == 0 ? 'b' : 'p', depth, p);
+            parts[s][p].create(sides[s]->table + name, *sides[s]);
+        }
+        RecordId rid;
+        sides[s]->rewind();
+        while (sides[s]->next(key, value)) {
+            parts[s][hashPartition(std::hash<int>()(key), depth, JOIN_PARTITIONS)].rf.append(key, value, rid);
+        }
+    }
+    for (int p = 0; p < JOIN_PARTITIONS; p++) {
+        hashJoin(buildParts[p], probeParts[p], out, depth + 1);
+        for (int s = 0; s < 2; s++) {
+            parts[s][p].rf.close();
+            ::unlink(parts[s][p].table.c_str());
+        }
+    }
+}
+
+RC SqlEngine::join(const JoinCol &attr, const string &left, const string &right, const vector<JoinCond> &conds) {
+    JoinInput l, r;
+    bool keyJoin = false;
+    RC rc;
+
+    l.table = left;
+    r.table = right;
+    r.left = false;
+    for (unsigned i = 0; i < conds.size(); i++) {
+        const JoinCond &c = conds[i];
+        if (c.table != NULL && left != c.table && right != c.table) {
+            fprintf(errorStream(), "Error: table %s is not in the FROM clause\n", c.table);
+            return RC_INVALID_ATTRIBUTE;
+        }
+        if (c.cond.value == NULL) {
+            // the join condition is on the two tables of the FROM clause, and nothing else
+            if ((left != c.table || right != c.other) && (right != c.table || left != c.other)) {
+                fprintf(errorStream(), "Error: the join condition must be %s.key = %s.key\n",
+                        left.c_str(), right.c_str());
+                return RC_INVALID_ATTRIBUTE;
+            }
+            keyJoin = true;
+        } else if (c.cond.attr == 1) {
+            // the key is the same on both sides
+            l.conds.push_back(c.cond);
+            r.conds.push_back(c.cond);
+        } else {
+            (left == c.table ? l : r).conds.push_back(c.cond);
+        }
+    }
+    if (!keyJoin) {
+        fprintf(errorStream(), "Error: the WHERE clause needs the join condition %s.key = %s.key\n",
+                left.c_str(), right.c_str());
+        return RC_INVALID_ATTRIBUTE;
+    }
+
+    // the tables are locked in name order, so that two joins never wait for each other.
+    // a table in memory is written by its snapshot, and needs the exclusive lock
+    const string &first = min(left, right), &second = max(left, right);
+    TableGuard firstGuard(first, getMemTable(first) != NULL);
+    TableGuard secondGuard(second, getMemTable(second) != NULL);
+
+    // the join reads the table files, so they need the rows of the tables in memory
+    if (getMemTable(left) != NULL) snapshot(left);
+    if (getMemTable(right) != NULL) snapshot(right);
+    if (attr.table != NULL && left != attr.table && right != attr.table) {
+        fprintf(errorStream(), "Error: table %s is not in the FROM clause\n", attr.table);
+        return RC_INVALID_ATTRIBUTE;
+    }
+
+    // 1 - key, 2 - left value, 3 - right value, 4 - *, 5 - count(*)
+    int outAttr = attr.attr;
+    if (attr.attr == 2) outAttr = (left == attr.table) ? 2 : 3;
+    else if (attr.attr >= 3) outAttr = attr.attr + 1;
+    JoinOutput out(outAttr);
+
+    for (int s = 0; s < 2; s++) {
+        JoinInput &side = (s == 0) ? l : r;
+        side.needsValue = out.printsValue(side.left);
+        for (unsigned i = 0; i < side.conds.size(); i++) {
+            if (side.conds[i].attr == 2) side.needsValue = true;
         }
+        if ((rc = side.open()) < 0) return rc;
+    }
+
+    // estimate the pages each strategy reads and run the cheapest one
+    l.chooseScan();
+    r.chooseScan();
+    int lrows = l.rows(), rrows = r.rows();
+    int lscan = l.ordered ? l.indexScanPages() : l.tableScanPages();
+    int rscan = r.ordered ? r.indexScanPages() : r.tableScanPages();
+    int hashCost = lscan + rscan;
+    if (min(lrows, rrows) * (sizeof(int) + sizeof(string) + 4 * sizeof(void *)) > JOIN_MEMORY_BUDGET) {
+        // both sides are written to and read back from the partitions
+        hashCost *= 3;
+    }
+    int mergeCost = (l.indexed && r.indexed) ? l.indexScanPages() + r.indexScanPages() : INT_MAX;
+    int leftProbeCost = r.indexed ? lscan + lrows * JOIN_PROBE_PAGES : INT_MAX;
+    int rightProbeCost = l.indexed ? rscan + rrows * JOIN_PROBE_PAGES : INT_MAX;
+
+    if (mergeCost <= hashCost && mergeCost <= leftProbeCost && mergeCost <= rightProbeCost) {
+        l.ordered = r.ordered = true;
+        mergeJoin(l, r, out);
+    } else if (leftProbeCost <= hashCost && leftProbeCost <= rightProbeCost) {
+        r.ordered = true;
+        indexNestedLoopJoin(l, r, out);
+    } else if (rightProbeCost <= hashCost) {
+        l.ordered = true;
+        indexNestedLoopJoin(r, l, out);
+    } else if (lrows <= rrows) {
+        hashJoin(l, r, out, 0);
+    } else {
+        hashJoin(r, l, out, 0);
+    }
+    out.finish();
+    return 0;
+}
+
+
+RC SqlEngine::load(const string &table, const string &loadfile, const LoadOptions &options) {
+    /* your code here */
+    RC rc;
+
+    // the LOADs of a table run one at a time. a table in memory changes under
+    // the exclusive lock of the table, but the files change as one version on
+    // commit, and the statements reading them never wait for the LOAD
+    lock_guard<mutex> loadGuard(getLoadLock(table));
+    TableGuard tableGuard(table, options.memory || getMemTable(table) != NULL);
+
+    // the pages of the LOAD reach the table files all together at the end.
+    // on an error, the rows read so far stay loaded as before
+    WriteAheadLog::begin();
+    rc = loadRows(table, loadfile, options);
+    RC logged = WriteAheadLog::commit();
+
+    // the statements from now on open the files again, and see the rows
+    dropOpenTable(table);
+    if (logged < 0) {
+        fprintf(errorStream(), "Error: cannot write the log for table %s\n", table.c_str());
+        return logged;
+    }
+    return rc;
+}
+
+RC SqlEngine::createIndex(const string &table, bool packed) {
+    RC rc;
+
+    // a LOAD or a snapshot would add rows the scan below misses. the
+    // statements reading the table go on at the snapshot they opened it at
+    lock_guard<mutex> loadGuard(getLoadLock(table));
+    TableGuard tableGuard(table, false);
+
+    shared_ptr<OpenTable> pinned = getOpenTable(table);
+    MemTable *mt = getMemTable(table);
+    if (pinned->indexed) {
+        fprintf(errorStream(), "Error: table %s has an index already\n", table.c_str());
+        return RC_INVALID_COMMAND;
+    }
+    if (!pinned->stored && mt == NULL) {
+        fprintf(errorStream(), "Error: table %s does not exist\n", table.c_str());
+        return RC_FILE_OPEN_FAILED;
+    }
+    if (mt != NULL) {
+        // the rows in memory get into the index with the next snapshot
+        lock_guard<mutex> guard(catalogLock);
+        LoadOptions &saved = snapshotOptions[table];
+        saved.index = true;
+        saved.packed = saved.packed || packed;
+        if (!pinned->stored) return 0;
+    }
+
+    // the index is built in a file of its own, outside the log, and only
+    // takes the name of the index once all of it is on disk. the statements
+    // opening the table meanwhile find no index, and so does a restart
+    BTreeIndex bi;
+    char suffix[32];
+    sprintf(suffix, ".idx%d_", threadNumber());
+    string building = table + ".idx.tmp";
+    ::unlink(building.c_str());   // left over from a crash
+    if ((rc = bi.open(building, 'w')) < 0) {
+        fprintf(errorStream(), "Error: create index %s failed\n", table.c_str());
+        return rc;
+    }
+    if (packed) bi.setPackedLeaves();
+    rc = IndexBuilder::build(pinned->records, bi, table + suffix);
+    bi.close();
+    if (rc == 0) rc = replaceFile(building, table + ".idx");
+    if (rc < 0) {
+        // an index missing some rows would turn hits into misses
+        ::unlink(building.c_str());
+        fprintf(errorStream(), "Error: create index %s failed\n", table.c_str());
+        return rc;
+    }
+
+    // the statements from now on open the files again, and use the index
+    dropOpenTable(table);
+    return 0;
+}
+
+static RC replaceFile(const string &from, const string &to) {
+    int fd = ::open(from.c_str(), O_RDONLY);
+    if (fd < 0) return RC_FILE_OPEN_FAILED;
+    int status = ::fsync(fd);
+    ::close(fd);
+    if (status < 0 || ::rename(from.c_str(), to.c_str()) < 0) return RC_FILE_WRITE_FAILED;
+
+    // the new name is durable once the directory is
+    if ((fd = ::open(".", O_RDONLY)) < 0) return RC_FILE_OPEN_FAILED;
+    status = ::fsync(fd);
+    ::close(fd);
+    return status < 0 ? RC_FILE_WRITE_FAILED : 0;
+}
 
+static RC loadRows(const string &table, const string &loadfile, const LoadOptions &options) {
+    string line;
+    RC rc;
+    TableWriter writer;
+
+    // a table in memory takes the rows there and writes them with its next snapshot
+    MemTable *mt = getMemTable(table);
+    if (mt == NULL && options.memory) {
+        RecordFile rf;
+        mt = new MemTable;
+        if (rf.open(table + ".tbl", 'r') == 0) {
+            rc = mt->load(rf);
+            rf.close();
+            if (rc < 0) {
+                fprintf(errorStream(), "Error: while reading a tuple from table %s\n", table.c_str());
+                delete mt;
+                return rc;
+            }
+        }
+        lock_guard<mutex> guard(catalogLock);
+        memTables[table] = mt;
+        snapshotOptions[table].index = ::access((table + ".idx").c_str(), F_OK) == 0;
+    }
+    if (mt != NULL) {
+        // a later LOAD can add an index or filters to the snapshots, but not take them away
+        lock_guard<mutex> guard(catalogLock);
+        LoadOptions &saved = snapshotOptions[table];
+        saved.index = saved.index || options.index;
+        saved.keyBloom = saved.keyBloom || options.keyBloom;
+        saved.valueBloom = saved.valueBloom || options.valueBloom;
+        saved.packed = saved.packed || options.packed;
+        saved.compressed = saved.compressed || options.compressed;
+        saved.encoded = saved.encoded || options.encoded;
+        saved.pax = saved.pax || options.pax;
+    } else if ((rc = writer.open(table, options)) < 0) {
+        return rc;
     }
 
     ifstream lfstream(loadfile.c_str());
@@ -348,26 +2133,177 @@ RC SqlEngine::load(const string &table, const string &loadfile, bool index) {
         while (getline(lfstream, line)) {
             int key;
             string value;
-            if ((rc = parseLoadLine(line, key, value)) < 0) {
-                fprintf(stderr, "Error: while parsing a line from file %s\n", loadfile.c_str());
+            if ((rc = SqlEngine::parseLoadLine(line, key, value)) < 0) {
+                fprintf(errorStream(), "Error: while parsing a line from file %s\n", loadfile.c_str());
                 lfstream.close();
-                rf.close();
+                if (mt == NULL) writer.close();
                 return rc;
             }
-            RecordId rid;
-            rf.append(key, value, rid);
-            if (index) {
-                bi.insert(key, rid);
+            if (mt != NULL) {
+                mt->append(key, value);
+            } else {
+                writer.add(key, value);
             }
         }
     }
 
+    if (mt == NULL) {
+        writer.close();
+    } else if (mt->getRowCount() - mt->getSavedCount() >= SNAPSHOT_ROWS ||
+               time(NULL) - mt->getSavedTime() >= SNAPSHOT_SECONDS) {
+        snapshot(table);
+    }
+    lfstream.close();
+    return 0;
+}
+
+RC TableWriter::open(const string &table, const LoadOptions &options) {
+    RC rc;
+    index = options.index;
+
+    if ((rc = rf.open(table + ".tbl", 'w', options.compressed, options.encoded, options.pax)) < 0) {
+        fprintf(errorStream(), "Error: open table %s failed\n", table.c_str());
+        return rc;
+    }
+
+    // the zone map only speeds up scans. the table loads fine without it
+    zoned = zm.open(table + ".zm", 'w') == 0 && zm.update(rf) == 0;
+
+    // a Bloom filter that missed some rows would turn hits into misses,
+    // so existing filters are always kept up to date
+    keyBloomed = (options.keyBloom || ::access((table + ".kbf").c_str(), F_OK) == 0) &&
+                 keyBloom.open(table + ".kbf", 'w') == 0;
+    valueBloomed = (options.valueBloom || ::access((table + ".vbf").c_str(), F_OK) == 0) &&
+                   valueBloom.open(table + ".vbf", 'w') == 0;
+    bool keyBackfill = keyBloomed && keyBloom.getCount() == 0;
+    bool valueBackfill = valueBloomed && valueBloom.getCount() == 0;
+    if (keyBackfill || valueBackfill) {
+        // a new filter starts with the rows the table has already
+        RecordId rid;
+        int key;
+        string value;
+        for (rid.pid = rid.sid = 0; rid < rf.endRid(); ++rid) {
+            if (rf.read(rid, key, value) < 0) break;
+            if (keyBackfill) keyBloom.add(BloomFilter::hash(key));
+            if (valueBackfill) valueBloom.add(BloomFilter::hash(value));
+        }
+    }
+
+    if (index) {
+        if ((rc = bi.open(table+".idx", 'w')) < 0) {
+            fprintf(errorStream(), "Error: create index %s failed\n", table.c_str());
+            index = false;
+            close();
+            return rc;
+        }
+        if (options.packed) bi.setPackedLeaves();
+    }
+    return 0;
+}
+
+RC TableWriter::add(int key, const string &value) {
+    RC rc;
+    RecordId rid;
+    if ((rc = rf.append(key, value, rid)) < 0) return rc;
+    if (index) {
+        bi.insert(key, rid);
+    }
+    if (zoned) {
+        zm.add(rid, key, value);
+    }
+    if (keyBloomed) {
+        keyBloom.add(BloomFilter::hash(key));
+    }
+    if (valueBloomed) {
+        valueBloom.add(BloomFilter::hash(value));
+    }
+    return 0;
+}
+
+void TableWriter::close() {
     if (index) bi.close();
+    if (zoned) zm.close();
+    if (keyBloomed) keyBloom.close();
+    if (valueBloomed) valueBloom.close();
     rf.close();
-    lfstream.close();
+    index = zoned = keyBloomed = valueBloomed = false;
+}
+
+static MemTable *getMemTable(const string &table) {
+    lock_guard<mutex> guard(catalogLock);
+    map<string, MemTable *>::iterator it = memTables.find(table);
+    return it == memTables.end() ? NULL : it->second;
+}
+
+static RC snapshot(const string &table) {
+    RC rc;
+    TableWriter writer;
+    MemTable *mt = getMemTable(table);
+    LoadOptions options;
+
+    if (mt->getSavedCount() == mt->getRowCount()) {
+        mt->setSaved(mt->getRowCount());
+        return 0;
+    }
+    {
+        lock_guard<mutex> guard(catalogLock);
+        options = snapshotOptions[table];
+    }
+    WriteAheadLog::begin();
+    if ((rc = writer.open(table, options)) < 0) {
+        WriteAheadLog::commit();
+        return rc;
+    }
+    for (int row = mt->getSavedCount(); row < mt->getRowCount(); row++) {
+        if ((rc = writer.add(mt->getKey(row), mt->getValue(row))) < 0) {
+            writer.close();
+            WriteAheadLog::commit();
+            return rc;
+        }
+    }
+    writer.close();
+    if ((rc = WriteAheadLog::commit()) < 0) return rc;
+    dropOpenTable(table);
+    mt->setSaved(mt->getRowCount());
     return 0;
 }
 
+static int threadNumber() {
+    static atomic<int> threads(0);
+    static thread_local int number = threads++;
+    return number;
+}
+
+thread_local vector<string> TableGuard::held;
+
+TableGuard::TableGuard(const string &table, bool exclusive) : table(table), lock(NULL), exclusive(exclusive) {
+    if (find(held.begin(), held.end(), table) != held.end()) return;
+    {
+        lock_guard<mutex> guard(catalogLock);
+        TableLock *&l = tableLocks[table];
+        if (l == NULL) l = new TableLock;
+        l->users++;
+        lock = l;
+    }
+    if (exclusive) lock->lock.lock();
+    else lock->lock.lock_shared();
+    held.push_back(table);
+}
+
+TableGuard::~TableGuard() {
+    if (lock == NULL) return;
+    held.erase(find(held.begin(), held.end(), table));
+    if (exclusive) lock->lock.unlock();
+    else lock->lock.unlock_shared();
+
+    // the locks of the names queried once, e.g., of tables that do not exist, do not pile up
+    lock_guard<mutex> guard(catalogLock);
+    if (--lock->users == 0) {
+        tableLocks.erase(table);
+        delete lock;
+    }
+}
+
 RC SqlEngine::parseLoadLine(const string &line, int &key, string &value) {
     const char *s;
     char c;
@@ -11,10 +11,16 @@
 #define SQLENGINE_H
 
 #include <vector>
+#include <utility>
 #include <climits>
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <map>
 #include "Bruinbase.h"
 #include "RecordFile.h"
 #include "BTreeIndex.h"
+#include "Arena.h"
 
 /**
  * data structure to represent a condition in the WHERE clause
@@ -25,12 +31,71 @@ struct SelCond {
         EQ, NE, LT, GT, LE, GE
     } comp;
     char *value;  // the value to compare
+    int param;    // the # of the ? parameter EXECUTE binds value to. 0 if value is given
+};
+
+/**
+ * data structure to represent the GROUP BY, ORDER BY and LIMIT clauses
+ */
+struct SelOptions {
+    int groupAttr;  // attribute to group by: 0 - none, 1 - key column, 2 - value column
+    int orderAttr;  // attribute to order by: 0 - none, 1 - key column, 2 - value column
+    bool desc;      // true if the rows are ordered descending
+    int limit;      // maximum # rows to print. -1 if there is no LIMIT
+    int offset;     // # rows to skip before printing
+    SelOptions():
+            groupAttr(0),
+            orderAttr(0),
+            desc(false),
+            limit(-1),
+            offset(0) { };
+};
+
+/**
+ * data structure to represent a column of a joined table in the SELECT clause
+ */
+struct JoinCol {
+    char *table;  // the table of the column. NULL if attr is not a column of one table
+    int attr;     // attribute: 1 - key, 2 - value, 3 - *, 4 - count(*)
+};
+
+/**
+ * data structure to represent a condition in the WHERE clause of a join
+ */
+struct JoinCond {
+    char *table;   // the table the condition is on
+    char *other;   // the other table of the join condition. NULL for the other conditions
+    SelCond cond;  // the condition. cond.value is NULL for the join condition <left>.key = <right>.key
+};
+
+/**
+ * data structure to represent the WITH clause of LOAD
+ */
+struct LoadOptions {
+    bool index;       // true to build the B+tree index on key
+    bool keyBloom;    // true to keep a Bloom filter on key
+    bool valueBloom;  // true to keep a Bloom filter on value
+    bool packed;      // true to write the index leaf nodes in the packed layout
+    bool compressed;  // true to compress the pages of a new table
+    bool encoded;     // true to dictionary-encode the values of a new table
+    bool pax;         // true to store the keys and the values of a new table apart in every page
+    bool memory;      // true to keep the table in memory
+    LoadOptions():
+            index(false),
+            keyBloom(false),
+            valueBloom(false),
+            packed(false),
+            compressed(false),
+            encoded(false),
+            pax(false),
+            memory(false) { };
 };
 
 struct CombinedCond{
 
     bool hasKey, hasValue, hasEqual, hasNEqual, hasRange;
     int rangeMin, rangeMax,  exactKey;
+    std::vector<int> neKeys;   // the keys of the <> conditions, sorted and distinct
     std::string exactValue;
     CombinedCond():
             hasKey(false),
@@ -44,6 +109,43 @@ struct CombinedCond{
             exactValue("") { };
 } ;
 
+/**
+ * data structure to represent a SELECT statement of PREPARE. EXECUTE binds
+ * its ? parameters and runs it without parsing it again.
+ */
+struct PreparedStatement {
+    int attr;                                        // attribute in the SELECT clause
+    std::string table;                               // the table name in the FROM clause
+    std::vector<std::vector<SelCond> > disjuncts;    // the conditions of the WHERE clause
+    SelOptions options;                              // the ORDER BY and LIMIT clauses
+    int params;                                      // # ? parameters
+    Arena values;                                    // the values of the conditions
+};
+
+/**
+ * data structure to represent the state of one parse of user commands.
+ * every client has its own, so that the commands of many clients can be
+ * parsed and run at once
+ */
+struct SqlSession {
+    FILE *out;      // the stream the results and the prompts are printed on
+    FILE *err;      // the stream the error messages and the timings are printed on
+    bool quit;      // true once the user issued QUIT
+    clock_t btime;  // the time the running command started
+    int bpagecnt;   // # page reads before the running command
+    Arena arena;    // the parse of the running command. reset after every command
+    int params;     // # ? parameters parsed in the running command
+    std::map<std::string, PreparedStatement *> statements;  // the statements of PREPARE by name
+    SqlSession(FILE *out = stdout, FILE *err = stderr):
+            out(out),
+            err(err),
+            quit(false),
+            btime(0),
+            bpagecnt(0),
+            params(0) { };
+    ~SqlSession();
+};
+
 /**
  * the class that takes, parses, and executes the user commands.
  */
@@ -59,26 +161,147 @@ public:
      */
     static RC run(FILE *commandline);
 
+    /**
+     * executes the user commands in commands until its end or QUIT.
+     * the results and the error messages go to the streams of the session,
+     * and the thread may run the commands of one session at a time.
+     * @param commands[IN] the input stream to get user commands
+     * @param session[IN/OUT] the session the commands are run in
+     * @return error code. 0 if no error
+     */
+    static RC execute(FILE *commands, SqlSession &session);
+
+    /**
+     * executes the user commands in a buffer until its end or QUIT.
+     * the commands are parsed in place, so the buffer is changed.
+     * @param commands[IN/OUT] the user commands, followed by two NUL characters
+     * @param size[IN] # bytes in commands, including the two NUL characters
+     * @param session[IN/OUT] the session the commands are run in
+     * @return error code. 0 if no error
+     */
+    static RC execute(char *commands, size_t size, SqlSession &session);
+
+    /**
+     * write the rows of the in-memory tables that are not in the table
+     * files yet. called when the engine exits.
+     */
+    static void shutdown();
+
+    /**
+     * save the tables open now and the pages read most recently, so that
+     * warmUp() can bring a restarted engine back to speed.
+     * @param filename[IN] the file to save them in
+     * @return error code. 0 if no error
+     */
+    static RC saveHotPages(const std::string &filename);
+
+    /**
+     * close the files of the tables the engine keeps open. called when
+     * the engine exits, after saveHotPages().
+     */
+    static void closeTables();
+
+    /**
+     * open the tables and load the Bloom filters a saved engine had, and
+     * have the OS read its hot pages in the background.
+     * no-op if there is no such file.
+     * @param filename[IN] the file saveHotPages() wrote
+     */
+    static void warmUp(const std::string &filename);
+
     /**
      * executes a SELECT statement.
      * all conditions in conds must be ANDed together.
      * the result of the SELECT is printed on screen.
      * @param attr[IN] attribute in the SELECT clause
-     * (1: key, 2: value, 3: *, 4: count(*))
+     * (1: key, 2: value, 3: *, 4: count(*), 5: min(key), 6: max(key),
+     *  7: sum(key), 8: avg(key), 9: min(value), 10: max(value))
+     * @param table[IN] the table name in the FROM clause
+     * @param conds[IN] list of conditions in the WHERE clause
+     * @param options[IN] the GROUP BY, ORDER BY and LIMIT clauses.
+     * with GROUP BY, attr is the aggregate computed for every group
+     * @return error code. 0 if no error
+     */
+    static RC select(int attr, const std::string &table, const std::vector<SelCond> &conds,
+                     const SelOptions &options = SelOptions());
+
+    /**
+     * executes a SELECT statement whose WHERE clause is an OR of ANDs.
+     * a row is a result if it satisfies all conditions in any of disjuncts.
+     * the result of the SELECT is printed on screen.
+     * @param attr[IN] attribute in the SELECT clause (see above)
+     * @param table[IN] the table name in the FROM clause
+     * @param disjuncts[IN] the conditions ANDed together in every operand of the OR
+     * @param options[IN] the GROUP BY, ORDER BY and LIMIT clauses
+     * @return error code. 0 if no error
+     */
+    static RC select(int attr, const std::string &table, const std::vector<std::vector<SelCond> > &disjuncts,
+                     const SelOptions &options = SelOptions());
+
+    /**
+     * prepare a SELECT statement for EXECUTE in the running session.
+     * a statement of the same name is replaced.
+     * @param name[IN] the name of the statement
+     * @param attr[IN] attribute in the SELECT clause (see above)
      * @param table[IN] the table name in the FROM clause
+     * @param disjuncts[IN] the conditions of the WHERE clause. a condition
+     * with param > 0 takes its value from EXECUTE
+     * @param params[IN] # ? parameters in disjuncts
+     * @param options[IN] the ORDER BY and LIMIT clauses
+     * @return error code. 0 if no error
+     */
+    static RC prepare(const std::string &name, int attr, const std::string &table,
+                      const std::vector<std::vector<SelCond> > &disjuncts, int params, const SelOptions &options);
+
+    /**
+     * executes a statement of PREPARE.
+     * the result of the SELECT is printed on screen.
+     * @param name[IN] the name of the statement
+     * @param values[IN] the values of the ? parameters, in order
+     * @return error code. 0 if no error
+     */
+    static RC executePrepared(const std::string &name, const std::vector<char *> &values);
+
+    /**
+     * drop a statement of PREPARE.
+     * @param name[IN] the name of the statement
+     * @return error code. 0 if no error
+     */
+    static RC deallocate(const std::string &name);
+
+    /**
+     * executes a SELECT statement that joins two tables on key.
+     * all conditions in conds must be ANDed together and one of them
+     * must be the join condition <left>.key = <right>.key.
+     * the result of the SELECT is printed on screen.
+     * @param attr[IN] the column in the SELECT clause
+     * @param left[IN] the first table in the FROM clause
+     * @param right[IN] the second table in the FROM clause
      * @param conds[IN] list of conditions in the WHERE clause
      * @return error code. 0 if no error
      */
-    static RC select(int attr, const std::string &table, const std::vector<SelCond> &conds);
+    static RC join(const JoinCol &attr, const std::string &left, const std::string &right,
+                   const std::vector<JoinCond> &conds);
 
     /**
      * load a table from a load file.
      * @param table[IN] the table name in the LOAD command
      * @param loadfile[IN] the file name of the load file
-     * @param index[IN] true if "WITH INDEX" option was specified
+     * @param options[IN] the options in the WITH clause. Bloom filters
+     * that exist already are kept up to date whether or not they are listed
      * @return error code. 0 if no error
      */
-    static RC load(const std::string &table, const std::string &loadfile, bool index);
+    static RC load(const std::string &table, const std::string &loadfile, const LoadOptions &options);
+
+    /**
+     * build the B+tree index on key of a table that has none. the
+     * statements reading the table keep running meanwhile, and the ones
+     * that start once it is done use the index.
+     * @param table[IN] the table name in the CREATE INDEX command
+     * @param packed[IN] true to write the leaf nodes in the packed layout
+     * @return error code. 0 if no error
+     */
+    static RC createIndex(const std::string &table, bool packed);
 
     /**
      * parse a line from the load file into the (key, value) pair.
@@ -91,13 +314,17 @@ public:
 
 private:
 
-    static RC selectWithIndex(int attr, const std::string &table, const CombinedCond& cCond, const std::vector<SelCond> &conds);
+    static RC selectWithIndex(int attr, const std::string &table, const CombinedCond& cCond, const std::vector<SelCond> &conds, const SelOptions &options);
+
+    static RC selectWithoutIndex(int attr, const std::string &table, const std::vector<SelCond> &conds, const SelOptions &options);
 
-    static RC selectWithoutIndex(int attr, const std::string &table, const std::vector<SelCond> &conds);
+    static RC aggregateWithIndex(int attr, BTreeIndex &bi, const CombinedCond &cCond);
 
-    static RC printResult(int attr, int key, RecordId& rid, RecordFile& rf);
+    static RC selectIntervals(int attr, const std::string &table, const std::vector<std::vector<SelCond> > &disjuncts,
+                              const std::vector<std::pair<int, int> > &intervals, const SelOptions &options);
 
-    static RC printResult(int attr, int key, RecordId& rid, RecordFile& rf, std::string value);
+    static RC selectInMemory(int attr, const std::string &table, const std::vector<std::vector<SelCond> > &disjuncts,
+                             const SelOptions &options);
 
 
 };
@@ -1,6 +1,7 @@
 %{
 #include <cstdio>
 #include <cstring>
+#include <cstdlib>
 #include <sys/times.h>
 #include <unistd.h>
 #include <climits>
@@ -9,43 +10,314 @@
 #include "SqlEngine.h" 
 #include "PageFile.h"
 
-int  sqllex(void);  
-void sqlerror(const char *str) { fprintf(stderr, "Error: %s\n", str); }
-extern "C" { int  sqlwrap() { return 1; } }
+// the scanner is reentrant, and every parse has a scanner of its own
+// that carries the session of the parse
+SqlSession* sqlget_extra(void* scanner);
 
-static void runSelect(int attr, const char* table, const std::vector<SelCond>& conds)
+void sqlerror(void* scanner, const char *str) { fprintf(sqlget_extra(scanner)->err, "Error: %s\n", str); }
+
+static void startTimer(SqlSession* session)
+{
+  struct tms tmsbuf;
+  session->btime = times(&tmsbuf);
+  session->bpagecnt = PageFile::getPageReadCount();
+}
+
+// the page reads of commands of other sessions running at the same time are counted, too
+static void printTimer(SqlSession* session)
 {
   struct tms tmsbuf;
-  clock_t btime, etime;
-  int     bpagecnt, epagecnt;
+  clock_t etime = times(&tmsbuf);
+  int     epagecnt = PageFile::getPageReadCount();
 
-  btime = times(&tmsbuf);
-  bpagecnt = PageFile::getPageReadCount();
-  SqlEngine::select(attr, table, conds);
-  etime = times(&tmsbuf);
-  epagecnt = PageFile::getPageReadCount();
+  fprintf(session->err, "  -- %.3f seconds to run the select command. Read %d pages\n", ((float)(etime - session->btime))/sysconf(_SC_CLK_TCK), epagecnt - session->bpagecnt);
+}
 
-  fprintf(stderr, "  -- %.3f seconds to run the select command. Read %d pages\n", ((float)(etime - btime))/sysconf(_SC_CLK_TCK), epagecnt - bpagecnt);
+// load_option is 0 for INDEX, 1 for BLOOM(key), 2 for BLOOM(value),
+// 3 for PACKED INDEX, 4 for COMPRESSED, 5 for DICTIONARY, 6 for PAX
+// and 7 for MEMORY
+static void setLoadOption(LoadOptions& options, int option)
+{
+  switch (option) {
+    case 0: options.index = true; break;
+    case 3: options.index = options.packed = true; break;
+    case 4: options.compressed = true; break;
+    case 5: options.encoded = true; break;
+    case 6: options.pax = true; break;
+    case 7: options.memory = true; break;
+    case 1: options.keyBloom = true; break;
+    case 2: options.valueBloom = true; break;
+  }
 }
 
 %}
 
+%define api.pure full
+%lex-param {void* scanner}
+%parse-param {void* scanner}
+
+%code requires {
+// a token in the input. the input is parsed in place, so the token is not NUL-terminated
+struct SqlToken {
+  const char* text;
+  int length;
+};
+
+struct Conjunction;
+struct Disjunction;
+struct JoinConjunction;
+struct ValueList;
+}
+
 %union {
   int integer;
+  SqlToken token;
   char* string;
   SelCond* cond;
-  std::vector<SelCond>* conds;
+  Conjunction* conds;
+  Disjunction* disjuncts;
+  SelOptions* options;
+  LoadOptions* loadOptions;
+  JoinCol* column;
+  JoinCond* jcond;
+  JoinConjunction* jconds;
+  ValueList* values;
 }
 
-%token SELECT FROM WHERE LOAD WITH INDEX QUIT COUNT AND OR 
-%token COMMA STAR LF
-%token <string> INTEGER STRING ID
+%token SELECT FROM WHERE LOAD WITH INDEX QUIT COUNT AND OR IN
+%token BLOOM PACKED COMPRESSED DICTIONARY PAX MEMORY ORDER GROUP BY ASC DESC LIMIT OFFSET MIN MAX SUM AVG
+%token PREPARE EXECUTE DEALLOCATE AS PARAM CREATE ON
+%token COMMA DOT STAR LPAREN RPAREN LF
+%token <token> INTEGER STRING ID
 %token EQUAL NEQUAL LESS LESSEQUAL GREATER GREATEREQUAL 
 
-%type <integer> attributes attribute comparator
+%type <integer> attributes attribute aggregate comparator load_option
 %type <string> table value
 %type <cond> condition
-%type <conds> conditions
+%type <conds> in_list
+%type <disjuncts> where_clause disjunction conjunction predicate
+%type <options> select_options order_clause
+%type <loadOptions> load_options
+%type <column> column
+%type <jcond> join_condition
+%type <jconds> join_conditions
+%type <values> value_list
+
+%code {
+int sqllex(YYSTYPE* lvalp, void* scanner);
+
+//
+// the semantic values of a command are allocated from the arena of the
+// session, and freed all at once when the command is done. the conditions
+// of the WHERE clause are lists there
+//
+
+struct CondNode {
+  SelCond cond;
+  CondNode* next;
+};
+
+// conditions ANDed together
+struct Conjunction {
+  CondNode* first;
+  CondNode* last;
+  Conjunction* next;
+};
+
+// conjunctions ORed together
+struct Disjunction {
+  Conjunction* first;
+  Conjunction* last;
+};
+
+struct JoinCondNode {
+  JoinCond cond;
+  JoinCondNode* next;
+};
+
+// join conditions ANDed together
+struct JoinConjunction {
+  JoinCondNode* first;
+  JoinCondNode* last;
+};
+
+struct ValueNode {
+  char* value;
+  ValueNode* next;
+};
+
+// the parameter values of EXECUTE
+struct ValueList {
+  ValueNode* first;
+  ValueNode* last;
+};
+
+static void appendCond(Conjunction* c, CondNode* n)
+{
+  n->next = NULL;
+  if (c->last != NULL) c->last->next = n;
+  else c->first = n;
+  c->last = n;
+}
+
+static void appendConjunction(Disjunction* d, Conjunction* c)
+{
+  c->next = NULL;
+  if (d->last != NULL) d->last->next = c;
+  else d->first = c;
+  d->last = c;
+}
+
+static void appendJoinCond(JoinConjunction* c, JoinCondNode* n)
+{
+  n->next = NULL;
+  if (c->last != NULL) c->last->next = n;
+  else c->first = n;
+  c->last = n;
+}
+
+static void appendValue(ValueList* l, ValueNode* n)
+{
+  n->next = NULL;
+  if (l->last != NULL) l->last->next = n;
+  else l->first = n;
+  l->last = n;
+}
+
+// the arena the objects of the running command are allocated from
+static Arena& arena(void* scanner)
+{
+  return sqlget_extra(scanner)->arena;
+}
+
+// a NUL-terminated copy of the token in the arena
+static char* copyToken(void* scanner, const SqlToken& token)
+{
+  return arena(scanner).copy(token.text, token.length);
+}
+
+// print the prompt after a command, and free the objects of the command
+static void endCommand(void* scanner)
+{
+  fprintf(sqlget_extra(scanner)->out, "Bruinbase> ");
+  arena(scanner).reset();
+  sqlget_extra(scanner)->params = 0;
+}
+
+// the # of the ? parameter a condition on value takes its value from. 0 for a given value
+static int paramOf(void* scanner, const char* value)
+{
+  return value == NULL ? sqlget_extra(scanner)->params : 0;
+}
+
+// false and an error if the command has ? parameters, which only PREPARE takes
+static bool noParams(void* scanner)
+{
+  if (sqlget_extra(scanner)->params == 0) return true;
+  sqlerror(scanner, "? is a parameter of PREPARE only");
+  return false;
+}
+
+// the engine takes the conditions as vectors. the only allocations of the command
+static void toVectors(const Disjunction* disjunction, std::vector<std::vector<SelCond> >& disjuncts)
+{
+  for (const Conjunction* c = disjunction->first; c != NULL; c = c->next) {
+    disjuncts.push_back(std::vector<SelCond>());
+    for (const CondNode* n = c->first; n != NULL; n = n->next) {
+      disjuncts.back().push_back(n->cond);
+    }
+  }
+}
+
+static void runSelect(void* scanner, int attr, const char* table, const Disjunction* disjunction, const SelOptions& options)
+{
+  if (!noParams(scanner)) return;
+  std::vector<std::vector<SelCond> > disjuncts;
+  toVectors(disjunction, disjuncts);
+  startTimer(sqlget_extra(scanner));
+  SqlEngine::select(attr, table, disjuncts, options);
+  printTimer(sqlget_extra(scanner));
+}
+
+static void runPrepare(void* scanner, const char* name, int attr, const char* table, const Disjunction* disjunction, const SelOptions& options)
+{
+  std::vector<std::vector<SelCond> > disjuncts;
+  toVectors(disjunction, disjuncts);
+  SqlEngine::prepare(name, attr, table, disjuncts, sqlget_extra(scanner)->params, options);
+}
+
+static void runExecute(void* scanner, const char* name, const ValueList* list)
+{
+  if (!noParams(scanner)) return;
+  std::vector<char*> values;
+  for (const ValueNode* n = list != NULL ? list->first : NULL; n != NULL; n = n->next) {
+    values.push_back(n->value);
+  }
+  startTimer(sqlget_extra(scanner));
+  SqlEngine::executePrepared(name, values);
+  printTimer(sqlget_extra(scanner));
+}
+
+// a copy of the conditions of c in the arena, followed by the conditions of tail
+static CondNode* copyConds(void* scanner, const Conjunction* c, CondNode* tail, CondNode*& last)
+{
+  CondNode* first = NULL;
+  CondNode** link = &first;
+  last = NULL;
+  for (const CondNode* n = c->first; n != NULL; n = n->next) {
+    last = arena(scanner).create<CondNode>();
+    last->cond = n->cond;
+    *link = last;
+    link = &last->next;
+  }
+  *link = tail;
+  return first;
+}
+
+// the most conjunctions an AND of ORs may expand to. every row is tested
+// against each of them
+static const int MAX_CONJUNCTIONS = 1024;
+
+static int conjunctionCount(const Disjunction* d)
+{
+  int n = 0;
+  for (const Conjunction* c = d->first; c != NULL; c = c->next) n++;
+  return n;
+}
+
+// (a1 OR a2 ...) AND (b1 OR b2 ...) as (a1 AND b1) OR (a1 AND b2) OR ...
+// NULL if that is more than MAX_CONJUNCTIONS conjunctions
+static Disjunction* andDisjuncts(void* scanner, const Disjunction* a, const Disjunction* b)
+{
+  int na = conjunctionCount(a), nb = conjunctionCount(b);
+  if (nb > 0 && na > MAX_CONJUNCTIONS / nb) return NULL;
+  Disjunction* r = arena(scanner).create<Disjunction>();
+  for (const Conjunction* ca = a->first; ca != NULL; ca = ca->next) {
+    for (const Conjunction* cb = b->first; cb != NULL; cb = cb->next) {
+      // the conditions of cb are shared by the copies of the conjunctions of a
+      Conjunction* c = arena(scanner).create<Conjunction>();
+      CondNode* last;
+      c->first = copyConds(scanner, ca, cb->first, last);
+      c->last = cb->last != NULL ? cb->last : last;
+      appendConjunction(r, c);
+    }
+  }
+  return r;
+}
+
+static void runJoin(void* scanner, const JoinCol& attr, const char* left, const char* right, const JoinConjunction* conjunction)
+{
+  if (!noParams(scanner)) return;
+  std::vector<JoinCond> conds;
+  for (const JoinCondNode* n = conjunction->first; n != NULL; n = n->next) {
+    conds.push_back(n->cond);
+  }
+  startTimer(sqlget_extra(scanner));
+  SqlEngine::join(attr, left, right, conds);
+  printTimer(sqlget_extra(scanner));
+}
+}
+
 %%
 
 commands:
@@ -54,91 +326,350 @@ commands:
 	;
 
 command:
-        load_command { fprintf(stdout, "Bruinbase> "); }
-	| select_command { fprintf(stdout, "Bruinbase> "); }
+        load_command { endCommand(scanner); }
+	| select_command { endCommand(scanner); }
+	| prepare_command { endCommand(scanner); }
+	| execute_command { endCommand(scanner); }
+	| deallocate_command { endCommand(scanner); }
+	| create_command { endCommand(scanner); }
 	| quit_command
-	| error LF { fprintf(stdout, "Bruinbase> "); }
-	| LF { fprintf(stdout, "Bruinbase> "); }
+	| error LF { endCommand(scanner); }
+	| LF { endCommand(scanner); }
 	;
 
 quit_command:
-	QUIT { return 0; }
+	QUIT { sqlget_extra(scanner)->quit = true; YYACCEPT; }
 	;
 
 load_command:
 	LOAD table FROM STRING LF { 
-	  SqlEngine::load(std::string($2), std::string($4), false); 
-	  free($2);
-	  free($4);
+	  SqlEngine::load(std::string($2), std::string($4.text, $4.length), LoadOptions()); 
 	}
-	| LOAD table FROM STRING WITH INDEX LF { 
-	  SqlEngine::load(std::string($2), std::string($4), true); 
-	  free($2);
-	  free($4);
+	| LOAD table FROM STRING WITH load_options LF { 
+	  SqlEngine::load(std::string($2), std::string($4.text, $4.length), *$6); 
 	}
 	;
 
+load_options:
+	load_option {
+	  $$ = arena(scanner).create<LoadOptions>();
+	  setLoadOption(*$$, $1);
+	}
+	| load_options COMMA load_option {
+	  setLoadOption(*$1, $3);
+	  $$ = $1;
+	}
+	;
+
+load_option:
+	INDEX { $$ = 0; }
+	| PACKED INDEX { $$ = 3; }
+	| COMPRESSED { $$ = 4; }
+	| DICTIONARY { $$ = 5; }
+	| PAX { $$ = 6; }
+	| MEMORY { $$ = 7; }
+	| BLOOM { $$ = 1; }
+	| BLOOM LPAREN attribute RPAREN { $$ = $3; }
+	;
+
 select_command:
-	SELECT attributes FROM table LF {
-   	        std::vector<SelCond> conds;
-		runSelect($2, $4, conds);
-		free($4);
-	}
-	| SELECT attributes FROM table WHERE conditions LF {
-	        runSelect($2, $4, *$6);
-	  	free($4);
-	  	for (unsigned i = 0; i < $6->size(); i++) {
-		    free((*$6)[i].value);
+	SELECT attributes FROM table where_clause select_options LF {
+	        runSelect(scanner, $2, $4, $5, *$6);
+	}
+	| SELECT attribute COMMA attributes FROM table where_clause GROUP BY attribute select_options LF {
+		if ($2 != $10) sqlerror(scanner, "the first SELECT column must be the GROUP BY column");
+		else if ($4 < 4) sqlerror(scanner, "the second SELECT column must be an aggregate");
+		else if ($11->orderAttr != 0) sqlerror(scanner, "ORDER BY cannot be used with GROUP BY");
+		else {
+		    $11->groupAttr = $10;
+		    runSelect(scanner, $4, $6, $7, *$11);
 		}
-	  	delete $6;
+	}
+	| SELECT attributes FROM table COMMA table WHERE join_conditions LF {
+		JoinCol col = { NULL, $2 };
+		if ($2 == 2) sqlerror(scanner, "value is ambiguous in a join. use <table>.value");
+		else if ($2 > 4) sqlerror(scanner, "count(*) is the only aggregate on a join");
+		else runJoin(scanner, col, $4, $6, $8);
+	}
+	| SELECT column FROM table COMMA table WHERE join_conditions LF {
+		runJoin(scanner, *$2, $4, $6, $8);
+	}
+	;
+
+prepare_command:
+	PREPARE ID AS SELECT attributes FROM table where_clause select_options LF {
+	  runPrepare(scanner, copyToken(scanner, $2), $5, $7, $8, *$9);
+	}
+	;
+
+execute_command:
+	EXECUTE ID LF {
+	  runExecute(scanner, copyToken(scanner, $2), NULL);
+	}
+	| EXECUTE ID LPAREN value_list RPAREN LF {
+	  runExecute(scanner, copyToken(scanner, $2), $4);
+	}
+	;
+
+deallocate_command:
+	DEALLOCATE ID LF {
+	  SqlEngine::deallocate(std::string($2.text, $2.length));
+	}
+	;
+
+create_command:
+	CREATE INDEX ON table LPAREN attribute RPAREN LF {
+	  if ($6 != 1) sqlerror(scanner, "only key can be indexed");
+	  else SqlEngine::createIndex(std::string($4), false);
+	}
+	| CREATE PACKED INDEX ON table LPAREN attribute RPAREN LF {
+	  if ($7 != 1) sqlerror(scanner, "only key can be indexed");
+	  else SqlEngine::createIndex(std::string($5), true);
+	}
+	;
+
+value_list:
+	value {
+	  $$ = arena(scanner).create<ValueList>();
+	  ValueNode* n = arena(scanner).create<ValueNode>();
+	  n->value = $1;
+	  appendValue($$, n);
+	}
+	| value_list COMMA value {
+	  ValueNode* n = arena(scanner).create<ValueNode>();
+	  n->value = $3;
+	  appendValue($1, n);
+	  $$ = $1;
 	}
 	;
 
-conditions:
+where_clause:
+	{
+	  // one conjunction of no conditions: every row
+	  $$ = arena(scanner).create<Disjunction>();
+	  appendConjunction($$, arena(scanner).create<Conjunction>());
+	}
+	| WHERE disjunction { $$ = $2; }
+	;
+
+select_options:
+	order_clause { $$ = $1; }
+	| order_clause LIMIT INTEGER {
+	  $1->limit = atoi(copyToken(scanner, $3));
+	  $$ = $1;
+	}
+	| order_clause LIMIT INTEGER OFFSET INTEGER {
+	  $1->limit = atoi(copyToken(scanner, $3));
+	  $1->offset = atoi(copyToken(scanner, $5));
+	  $$ = $1;
+	}
+	;
+
+order_clause:
+	{ $$ = arena(scanner).create<SelOptions>(); }
+	| ORDER BY attribute {
+	  $$ = arena(scanner).create<SelOptions>();
+	  $$->orderAttr = $3;
+	}
+	| ORDER BY attribute ASC {
+	  $$ = arena(scanner).create<SelOptions>();
+	  $$->orderAttr = $3;
+	}
+	| ORDER BY attribute DESC {
+	  $$ = arena(scanner).create<SelOptions>();
+	  $$->orderAttr = $3;
+	  $$->desc = true;
+	}
+	;
+
+disjunction:
+	conjunction { $$ = $1; }
+	| disjunction OR conjunction {
+	  if ($3->first != NULL) {
+	    if ($1->last != NULL) $1->last->next = $3->first;
+	    else $1->first = $3->first;
+	    $1->last = $3->last;
+	  }
+	  $$ = $1;
+	}
+	;
+
+conjunction:
+	predicate { $$ = $1; }
+	| conjunction AND predicate {
+	  $$ = andDisjuncts(scanner, $1, $3);
+	  if ($$ == NULL) {
+	    sqlerror(scanner, "the WHERE clause has too many combinations of OR and IN conditions");
+	    YYERROR;
+	  }
+	}
+	;
+
+predicate:
 	condition {
-	  std::vector<SelCond>* v = new std::vector<SelCond>;
-	  v->push_back(*$1);
-	  $$ = v;
-          delete $1;
+	  $$ = arena(scanner).create<Disjunction>();
+	  Conjunction* c = arena(scanner).create<Conjunction>();
+	  CondNode* n = arena(scanner).create<CondNode>();
+	  n->cond = *$1;
+	  appendCond(c, n);
+	  appendConjunction($$, c);
 	}
-	| conditions AND condition {
-	  $1->push_back(*$3);
+	| attribute IN LPAREN in_list RPAREN {
+	  // key IN (a, b) as key = a OR key = b
+	  $$ = arena(scanner).create<Disjunction>();
+	  CondNode* n = $4->first;
+	  while (n != NULL) {
+	    CondNode* next = n->next;
+	    Conjunction* c = arena(scanner).create<Conjunction>();
+	    n->cond.attr = $1;
+	    appendCond(c, n);
+	    appendConjunction($$, c);
+	    n = next;
+	  }
+	}
+	| LPAREN disjunction RPAREN { $$ = $2; }
+	;
+
+in_list:
+	value {
+	  $$ = arena(scanner).create<Conjunction>();
+	  CondNode* n = arena(scanner).create<CondNode>();
+	  n->cond.comp = SelCond::EQ;
+	  n->cond.value = $1;
+	  n->cond.param = paramOf(scanner, $1);
+	  appendCond($$, n);
+	}
+	| in_list COMMA value {
+	  CondNode* n = arena(scanner).create<CondNode>();
+	  n->cond.comp = SelCond::EQ;
+	  n->cond.value = $3;
+	  n->cond.param = paramOf(scanner, $3);
+	  appendCond($1, n);
 	  $$ = $1;
-          delete $3;
 	}
 	;
 
 condition:
 	attribute comparator value { 
-	  SelCond* c = new SelCond;
+	  SelCond* c = arena(scanner).create<SelCond>();
 	  c->attr = $1;
 	  c->comp = static_cast<SelCond::Comparator>($2);
 	  c->value = $3;
+	  c->param = paramOf(scanner, $3);
 	  $$ = c;
         }
 	;
 
+join_conditions:
+	join_condition {
+	  $$ = arena(scanner).create<JoinConjunction>();
+	  JoinCondNode* n = arena(scanner).create<JoinCondNode>();
+	  n->cond = *$1;
+	  appendJoinCond($$, n);
+	}
+	| join_conditions AND join_condition {
+	  JoinCondNode* n = arena(scanner).create<JoinCondNode>();
+	  n->cond = *$3;
+	  appendJoinCond($1, n);
+	  $$ = $1;
+	}
+	;
+
+join_condition:
+	column comparator value {
+	  JoinCond* c = arena(scanner).create<JoinCond>();
+	  c->table = $1->table;
+	  c->other = NULL;
+	  c->cond.attr = $1->attr;
+	  c->cond.comp = static_cast<SelCond::Comparator>($2);
+	  c->cond.value = $3;
+	  $$ = c;
+	}
+	| attribute comparator value {
+	  if ($1 != 1) {
+	    sqlerror(scanner, "value is ambiguous in a join. use <table>.value");
+	    YYERROR;
+	  }
+	  JoinCond* c = arena(scanner).create<JoinCond>();
+	  c->table = NULL;
+	  c->other = NULL;
+	  c->cond.attr = 1;
+	  c->cond.comp = static_cast<SelCond::Comparator>($2);
+	  c->cond.value = $3;
+	  $$ = c;
+	}
+	| column EQUAL column {
+	  if ($1->attr != 1 || $3->attr != 1) {
+	    sqlerror(scanner, "tables can only be joined on key");
+	    YYERROR;
+	  }
+	  if (strcmp($1->table, $3->table) == 0) {
+	    sqlerror(scanner, "the join condition must be on two tables");
+	    YYERROR;
+	  }
+	  JoinCond* c = arena(scanner).create<JoinCond>();
+	  c->table = $1->table;
+	  c->other = $3->table;
+	  c->cond.attr = 1;
+	  c->cond.comp = SelCond::EQ;
+	  c->cond.value = NULL;
+	  $$ = c;
+	}
+	;
+
+column:
+	ID DOT attribute {
+	  $$ = arena(scanner).create<JoinCol>();
+	  $$->table = copyToken(scanner, $1);
+	  $$->attr = $3;
+	}
+	;
+
 attributes:
 	attribute { $$ = $1; }
 	| STAR  { $$ = 3; }
 	| COUNT { $$ = 4; }
+	| aggregate { $$ = $1; }
+	;
+
+aggregate:
+	MIN LPAREN attribute RPAREN { $$ = ($3 == 1) ? 5 : 9; }
+	| MAX LPAREN attribute RPAREN { $$ = ($3 == 1) ? 6 : 10; }
+	| SUM LPAREN attribute RPAREN {
+		if ($3 != 1) {
+		    sqlerror(scanner, "SUM() takes the key column only");
+		    YYERROR;
+		}
+		$$ = 7;
+	}
+	| AVG LPAREN attribute RPAREN {
+		if ($3 != 1) {
+		    sqlerror(scanner, "AVG() takes the key column only");
+		    YYERROR;
+		}
+		$$ = 8;
+	}
 	;
 
 attribute:
 	ID { 
-		if (strcasecmp($1, "key") == 0) $$=1;
-		else if (strcasecmp($1, "value") == 0) $$=2;
-		else sqlerror("wrong attribute name. neither key or value");
-		free($1);
+		if ($1.length == 3 && strncasecmp($1.text, "key", 3) == 0) $$=1;
+		else if ($1.length == 5 && strncasecmp($1.text, "value", 5) == 0) $$=2;
+		else sqlerror(scanner, "wrong attribute name. neither key or value");
 	}
 
 value:
-	INTEGER  { $$ = $1; }
-        | STRING { $$ = $1; }
+	INTEGER  { $$ = copyToken(scanner, $1); }
+        | STRING { $$ = copyToken(scanner, $1); }
+	| PARAM {
+	  // EXECUTE gives the value
+	  $$ = NULL;
+	  sqlget_extra(scanner)->params++;
+	}
 	;
 
 table:
-	ID { $$ = $1; }
+	ID { $$ = copyToken(scanner, $1); }
 	;
 
 comparator:
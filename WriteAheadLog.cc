@@ -0,0 +1,568 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <cstring>
+#include <map>
+#include <set>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "WriteAheadLog.h"
+
+using namespace std;
+
+/*
+ * a log record is the pages of one transaction behind a header. every page
+ * is the length of the file name, the file name, the physical page id and
+ * the PAGE_SIZE bytes of the page. a checkpoint record holds the log offset
+ * recovery starts at instead.
+ *
+ * a transaction that outgrows TRANSACTION_BYTES writes its pages to the log
+ * in part records as it goes, and ends with a commit record. both start
+ * with the id of the transaction in front of the pages. recovery redoes
+ * the parts of a transaction only if its commit record is in the log.
+ */
+struct RecordHeader {
+    int magic;
+    unsigned checksum;    // of the pages. a torn record does not match it
+    long long size;       // # bytes of the pages behind the header
+};
+
+static const int RECORD_MAGIC = 0x4c415742;
+static const int PART_MAGIC = 0x50415742;
+static const int COMMIT_MAGIC = 0x43415742;
+static const int CHECKPOINT_MAGIC = 0x4b435042;
+
+// a checkpoint is taken this often, or once the log has grown by CHECKPOINT_BYTES
+static const int CHECKPOINT_SECONDS = 30;
+static const off_t CHECKPOINT_BYTES = 64 * 1024 * 1024;
+
+// # bytes of pages a transaction holds in memory at most. the rest wait in the log
+static const size_t TRANSACTION_BYTES = 16 * 1024 * 1024;
+
+// the pages of a transaction by file name and physical page
+typedef map<string, map<PageId, vector<char> > > Pages;
+
+// the log offsets of the pages a transaction wrote to part records
+typedef map<string, map<PageId, off_t> > LoggedPages;
+
+struct Transaction {
+    Pages pages;          // the pages in memory
+    size_t bytes;         // # bytes of them
+    long long id;         // 0 until a part is in the log
+    off_t firstPart;      // the log offset of the first part
+    LoggedPages logged;   // the pages in the parts and not in memory
+
+    Transaction(): bytes(0), id(0), firstPart(0) { }
+};
+
+// the transaction of this thread. NULL if there is none
+static thread_local Transaction *transaction = NULL;
+static thread_local int depth = 0;   // # begin() calls not committed yet
+
+static int logFd = -1;
+
+static mutex logLock;              // guards the log file and the members below
+static condition_variable flushed; // signaled when a batch is on disk or failed
+static string batch;               // the records no thread has written yet
+static long long appended = 0;     // # bytes of records appended since open()
+static long long durable = 0;      // # bytes of them on disk
+static long long failed = 0;       // # bytes of them written or lost. the lost ones failed
+static off_t logSize = 0;          // # bytes in the log file
+static bool flushing = false;      // true while a thread writes a batch
+static set<string> unsynced;       // the files written since the last checkpoint
+static multiset<long long> applying;  // the ends of the durable records whose pages are not in their files yet
+static condition_variable applied;   // signaled when a record leaves applying
+static bool stale = false;         // true if the pages of a durable transaction never reached their files
+static off_t checkpointed = 0;     // the log size at the last checkpoint
+static bool stopping = false;      // true when the checkpoint thread is to stop
+static condition_variable checkpointWanted;  // signaled when the log has grown or is closing
+static thread checkpointer;
+static long long nextTransaction = 1;  // the id the next transaction with parts gets
+static multiset<off_t> spilling;       // the first parts of the transactions not in their files yet
+
+// FNV-1a
+static unsigned checksum(const char *data, size_t size) {
+    unsigned h = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        h ^= (unsigned char) data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void appendHeader(int magic, const string &body, string &out) {
+    RecordHeader header;
+    header.magic = magic;
+    header.size = (long long) body.size();
+    header.checksum = checksum(body.data(), body.size());
+    out.append((const char *) &header, sizeof(header));
+    out.append(body);
+}
+
+// append a record of the pages. a part or commit record carries the id of
+// its transaction. offsets[IN/OUT] gets where the bytes of every page are,
+// counted from the start of the record, unless it is NULL
+static void appendRecord(int magic, long long id, const Pages &pages, string &out, LoggedPages *offsets) {
+    string body;
+    if (magic != RECORD_MAGIC) body.append((const char *) &id, sizeof(id));
+    for (Pages::const_iterator f = pages.begin(); f != pages.end(); ++f) {
+        int length = (int) f->first.size();
+        for (map<PageId, vector<char> >::const_iterator p = f->second.begin(); p != f->second.end(); ++p) {
+            body.append((const char *) &length, sizeof(length));
+            body.append(f->first);
+            body.append((const char *) &p->first, sizeof(PageId));
+            if (offsets != NULL) (*offsets)[f->first][p->first] = (off_t) (sizeof(RecordHeader) + body.size());
+            body.append(&p->second[0], PageFile::PAGE_SIZE);
+        }
+    }
+    appendHeader(magic, body, out);
+}
+
+// false if the pages are cut short. the id in front of the pages of a
+// part or commit record is skipped
+static bool parseRecord(int magic, const char *data, size_t size, Pages &pages) {
+    const char *p = data;
+    const char *end = data + size;
+    if (magic != RECORD_MAGIC) {
+        if (size < sizeof(long long)) return false;
+        p += sizeof(long long);
+    }
+    while (p < end) {
+        int length;
+        PageId pid;
+        if ((size_t) (end - p) < sizeof(length)) return false;
+        memcpy(&length, p, sizeof(length));
+        p += sizeof(length);
+        if (length <= 0 || (size_t) (end - p) < length + sizeof(pid) + PageFile::PAGE_SIZE) return false;
+        string filename(p, length);
+        p += length;
+        memcpy(&pid, p, sizeof(pid));
+        p += sizeof(pid);
+        pages[filename][pid].assign(p, p + PageFile::PAGE_SIZE);
+        p += PageFile::PAGE_SIZE;
+    }
+    return true;
+}
+
+// write the pages to their files as a version of them. the version is 0
+// during recovery, when no file is open
+static RC writePages(const Pages &pages, long long version) {
+    RC rc = 0;
+    for (Pages::const_iterator f = pages.begin(); f != pages.end(); ++f) {
+        int fd = ::open(f->first.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) return RC_FILE_OPEN_FAILED;
+        for (map<PageId, vector<char> >::const_iterator p = f->second.begin(); p != f->second.end() && rc == 0; ++p) {
+            if (version > 0) {
+                rc = PageFile::writeVersion(f->first, fd, p->first, &p->second[0], version);
+            } else if (::pwrite(fd, &p->second[0], PageFile::PAGE_SIZE, (off_t) p->first * PageFile::PAGE_SIZE) != PageFile::PAGE_SIZE) {
+                rc = RC_FILE_WRITE_FAILED;
+            }
+        }
+        ::close(fd);
+        if (rc < 0) return rc;
+    }
+    return 0;
+}
+
+// write the pages of a transaction that wait in the log, except the ones
+// it wrote again since, to their files as a version of them
+static RC writeLoggedPages(const LoggedPages &logged, const Pages &pages, long long version) {
+    char page[PageFile::PAGE_SIZE];
+    for (LoggedPages::const_iterator f = logged.begin(); f != logged.end(); ++f) {
+        Pages::const_iterator later = pages.find(f->first);
+        int fd = ::open(f->first.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) return RC_FILE_OPEN_FAILED;
+        RC rc = 0;
+        for (map<PageId, off_t>::const_iterator p = f->second.begin(); p != f->second.end() && rc == 0; ++p) {
+            if (later != pages.end() && later->second.count(p->first) > 0) continue;
+            if (::pread(logFd, page, PageFile::PAGE_SIZE, p->second) != PageFile::PAGE_SIZE) rc = RC_FILE_READ_FAILED;
+            else rc = PageFile::writeVersion(f->first, fd, p->first, page, version);
+        }
+        ::close(fd);
+        if (rc < 0) return rc;
+    }
+    return 0;
+}
+
+static RC writeAll(int fd, const string &data) {
+    const char *p = data.data();
+    size_t left = data.size();
+    while (left > 0) {
+        ssize_t n = ::write(fd, p, left);
+        if (n < 0) return RC_FILE_WRITE_FAILED;
+        p += n;
+        left -= n;
+    }
+    return 0;
+}
+
+// wait until the log has the bytes appended up to end on disk. the first
+// thread that finds no write going on writes the records of all threads
+// waiting, and syncs the log once for all of them. called with logLock held
+static RC flush(unique_lock<mutex> &guard, long long end) {
+    while (durable < end) {
+        if (failed >= end) return RC_FILE_WRITE_FAILED;
+        if (flushing) {
+            flushed.wait(guard);
+            continue;
+        }
+        string writing;
+        writing.swap(batch);
+        long long writingEnd = appended;
+        flushing = true;
+        guard.unlock();
+        RC status = writeAll(logFd, writing);
+        if (status == 0 && ::fdatasync(logFd) < 0) status = RC_FILE_WRITE_FAILED;
+        guard.lock();
+        flushing = false;
+        if (status == 0) {
+            durable = writingEnd;
+            logSize += writing.size();
+            if (logSize - checkpointed >= CHECKPOINT_BYTES) checkpointWanted.notify_all();
+        } else {
+            // cut off what made it, so the records behind it are not hidden behind a torn one
+            if (::ftruncate(logFd, logSize) < 0) logSize = -1;
+            failed = writingEnd;
+        }
+        flushed.notify_all();
+    }
+    return 0;
+}
+
+// move the pages of the transaction of this thread to a part record in the
+// log. on an error, they stay in memory
+static void spill(Transaction &t) {
+    string record;
+    LoggedPages offsets;
+    unique_lock<mutex> guard(logLock);
+    if (t.id == 0) t.id = nextTransaction++;
+    appendRecord(PART_MAGIC, t.id, t.pages, record, &offsets);
+    batch += record;
+    long long end = appended += record.size();
+    // a checkpoint waits until the part is in spilling
+    applying.insert(end);
+    RC rc = flush(guard, end);
+    off_t start = logSize - (off_t) (durable - (end - (long long) record.size()));
+    // the part stays in the log until the transaction is in the files
+    if (rc == 0 && t.logged.empty()) {
+        t.firstPart = start;
+        spilling.insert(start);
+    }
+    applying.erase(applying.find(end));
+    applied.notify_all();
+    guard.unlock();
+    if (rc < 0) return;
+    for (LoggedPages::iterator f = offsets.begin(); f != offsets.end(); ++f) {
+        for (map<PageId, off_t>::iterator p = f->second.begin(); p != f->second.end(); ++p) {
+            t.logged[f->first][p->first] = start + p->second;
+        }
+    }
+    t.pages.clear();
+    t.bytes = 0;
+}
+
+// forget the transaction of this thread
+static void endTransaction(Transaction *t) {
+    if (!t->logged.empty()) {
+        lock_guard<mutex> guard(logLock);
+        spilling.erase(spilling.find(t->firstPart));
+    }
+    delete t;
+}
+
+static RC syncFiles(const set<string> &files) {
+    for (set<string>::const_iterator it = files.begin(); it != files.end(); ++it) {
+        int fd = ::open(it->c_str(), O_RDONLY);
+        if (fd < 0) return RC_FILE_OPEN_FAILED;
+        int rc = ::fsync(fd);
+        ::close(fd);
+        if (rc < 0) return RC_FILE_WRITE_FAILED;
+    }
+    return 0;
+}
+
+// take a checkpoint every CHECKPOINT_SECONDS, or sooner if the log grows fast
+static void checkpointLoop() {
+    unique_lock<mutex> guard(logLock);
+    while (!stopping) {
+        checkpointWanted.wait_for(guard, chrono::seconds(CHECKPOINT_SECONDS));
+        if (stopping) break;
+        guard.unlock();
+        WriteAheadLog::checkpoint();
+        guard.lock();
+    }
+}
+
+RC WriteAheadLog::open(const string &filename) {
+    RC rc;
+    lock_guard<mutex> guard(logLock);
+    if (logFd >= 0) return RC_FILE_OPEN_FAILED;
+
+    // records are only ever appended
+    int fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) return RC_FILE_OPEN_FAILED;
+
+    // find the committed transactions, one record at a time. the records
+    // behind a torn one were never committed
+    struct stat statbuf;
+    if (::fstat(fd, &statbuf) < 0) {
+        ::close(fd);
+        return RC_FILE_OPEN_FAILED;
+    }
+    struct Found {
+        off_t pos;
+        RecordHeader header;
+        long long id;     // the transaction of a part or commit record
+    };
+    vector<Found> records;
+    vector<char> body;
+    long long redoStart = 0;
+    off_t pos = 0;
+    Found found;
+    while (::pread(fd, &found.header, sizeof(RecordHeader), pos) == (ssize_t) sizeof(RecordHeader)) {
+        const RecordHeader &header = found.header;
+        if ((header.magic != RECORD_MAGIC && header.magic != PART_MAGIC && header.magic != COMMIT_MAGIC &&
+             header.magic != CHECKPOINT_MAGIC) || header.size < 0 ||
+            header.size > statbuf.st_size - pos - (off_t) sizeof(RecordHeader)) break;
+        body.resize(header.size + 1);
+        if (::pread(fd, &body[0], header.size, pos + sizeof(RecordHeader)) != header.size ||
+            checksum(&body[0], header.size) != header.checksum) break;
+        found.pos = pos;
+        found.id = 0;
+        if (header.magic == CHECKPOINT_MAGIC) {
+            if (header.size == sizeof(redoStart)) memcpy(&redoStart, &body[0], sizeof(redoStart));
+        } else {
+            if (header.magic != RECORD_MAGIC && header.size >= (long long) sizeof(found.id)) {
+                memcpy(&found.id, &body[0], sizeof(found.id));
+            }
+            records.push_back(found);
+        }
+        pos += sizeof(RecordHeader) + header.size;
+    }
+
+    // redo the ones the last checkpoint does not have in the files. the
+    // parts of a transaction go first, when its commit record comes up
+    set<string> written;
+    for (size_t i = 0; i < records.size(); i++) {
+        if ((long long) records[i].pos < redoStart || records[i].header.magic == PART_MAGIC) continue;
+        vector<size_t> redo;
+        if (records[i].header.magic == COMMIT_MAGIC) {
+            for (size_t j = 0; j < i; j++) {
+                if ((long long) records[j].pos >= redoStart && records[j].header.magic == PART_MAGIC &&
+                    records[j].id == records[i].id) redo.push_back(j);
+            }
+        }
+        redo.push_back(i);
+        for (size_t k = 0; k < redo.size(); k++) {
+            const Found &record = records[redo[k]];
+            Pages pages;
+            body.resize(record.header.size + 1);
+            if (::pread(fd, &body[0], record.header.size, record.pos + sizeof(RecordHeader)) != record.header.size ||
+                !parseRecord(record.header.magic, &body[0], record.header.size, pages)) break;
+            if ((rc = writePages(pages, 0)) < 0) {
+                ::close(fd);
+                return rc;
+            }
+            for (Pages::iterator f = pages.begin(); f != pages.end(); ++f) written.insert(f->first);
+        }
+    }
+    vector<char>().swap(body);
+
+    // the files have the transactions now, and the log starts over
+    if ((rc = syncFiles(written)) < 0 || ::ftruncate(fd, 0) < 0 || ::fsync(fd) < 0) {
+        ::close(fd);
+        return rc < 0 ? rc : RC_FILE_WRITE_FAILED;
+    }
+    logFd = fd;
+    batch.clear();
+    appended = durable = failed = 0;
+    logSize = 0;
+    unsynced.clear();
+    applying.clear();
+    spilling.clear();
+    nextTransaction = 1;
+    stale = false;
+    checkpointed = 0;
+    stopping = false;
+    checkpointer = thread(checkpointLoop);
+    return 0;
+}
+
+RC WriteAheadLog::close() {
+    RC rc;
+    {
+        lock_guard<mutex> guard(logLock);
+        if (logFd < 0) return 0;
+        stopping = true;
+        checkpointWanted.notify_all();
+    }
+    checkpointer.join();
+
+    lock_guard<mutex> guard(logLock);
+
+    // once the files are on disk, the log has nothing they do not have
+    if ((rc = syncFiles(unsynced)) == 0 && (::ftruncate(logFd, 0) < 0 || ::fsync(logFd) < 0)) {
+        rc = RC_FILE_WRITE_FAILED;
+    }
+    ::close(logFd);
+    logFd = -1;
+    unsynced.clear();
+    return rc;
+}
+
+void WriteAheadLog::begin() {
+    if (logFd < 0) return;
+    if (depth++ == 0) transaction = new Transaction;
+}
+
+void WriteAheadLog::abort() {
+    // parts without a commit record are never redone
+    if (transaction != NULL) endTransaction(transaction);
+    transaction = NULL;
+    depth = 0;
+}
+
+RC WriteAheadLog::commit() {
+    RC rc = 0;
+    // a transaction begun in a transaction is part of it
+    if (transaction == NULL || --depth > 0) return 0;
+    Transaction *t = transaction;
+    transaction = NULL;
+    if (t->pages.empty() && t->logged.empty()) {
+        delete t;
+        return 0;
+    }
+
+    // the pages in memory go to the log behind the parts, with the commit
+    string record;
+    long long end;
+    appendRecord(t->logged.empty() ? RECORD_MAGIC : COMMIT_MAGIC, t->id, t->pages, record, NULL);
+    {
+        unique_lock<mutex> guard(logLock);
+        batch += record;
+        end = appended += record.size();
+        // a checkpoint waits for the pages to be in their files
+        applying.insert(end);
+        rc = flush(guard, end);
+        if (rc < 0) {
+            applying.erase(applying.find(end));
+            applied.notify_all();
+        }
+    }
+    string().swap(record);
+    if (rc < 0) {
+        endTransaction(t);
+        return rc;
+    }
+
+    // the pages are safe in the log. the files may get them now, and the
+    // readers see them once the versions before are in the files, too
+    long long version = PageFile::beginVersion();
+    rc = writeLoggedPages(t->logged, t->pages, version);
+    if (rc == 0) rc = writePages(t->pages, version);
+    PageFile::endVersion(version);
+    {
+        lock_guard<mutex> guard(logLock);
+        if (rc == 0) {
+            for (Pages::iterator f = t->pages.begin(); f != t->pages.end(); ++f) unsynced.insert(f->first);
+            for (LoggedPages::iterator f = t->logged.begin(); f != t->logged.end(); ++f) unsynced.insert(f->first);
+        } else {
+            // the log must keep the transaction, so that a restart writes its pages
+            stale = true;
+        }
+        applying.erase(applying.find(end));
+        applied.notify_all();
+    }
+    endTransaction(t);
+    return rc;
+}
+
+RC WriteAheadLog::checkpoint() {
+    RC rc;
+    set<string> files;
+    off_t redoStart;
+    {
+        // the transactions in the log so far are in the files, except for the
+        // ones still writing their pages. the checkpoint waits for those, but
+        // not for the ones logged later
+        unique_lock<mutex> guard(logLock);
+        if (logFd < 0) return 0;
+        if (stale) return RC_FILE_WRITE_FAILED;
+        long long logged = durable;
+        while (!applying.empty() && *applying.begin() <= logged) applied.wait(guard);
+        redoStart = logSize - (durable - logged);
+        // nor the parts of the transactions that did not commit yet
+        if (!spilling.empty() && *spilling.begin() < redoStart) redoStart = *spilling.begin();
+        files.swap(unsynced);
+    }
+
+    // sync the files one by one while the transactions go on
+    if ((rc = syncFiles(files)) < 0) {
+        lock_guard<mutex> guard(logLock);
+        unsynced.insert(files.begin(), files.end());
+        return rc;
+    }
+
+    lock_guard<mutex> guard(logLock);
+    checkpointed = redoStart;
+    if (logSize == redoStart && !flushing && batch.empty()) {
+        // nothing was logged since. the log starts over
+        if (::ftruncate(logFd, 0) < 0) return RC_FILE_WRITE_FAILED;
+        logSize = checkpointed = 0;
+    } else {
+        // recovery skips the records before redoStart. the record goes to
+        // the log with the next commit, and until then recovery redoes more
+        long long start = redoStart;
+        appendHeader(CHECKPOINT_MAGIC, string((const char *) &start, sizeof(start)), batch);
+        appended += sizeof(RecordHeader) + sizeof(start);
+    }
+    return 0;
+}
+
+bool WriteAheadLog::read(const string &filename, PageId ppid, void *buffer) {
+    if (transaction == NULL) return false;
+    Pages::iterator f = transaction->pages.find(filename);
+    if (f != transaction->pages.end()) {
+        map<PageId, vector<char> >::iterator p = f->second.find(ppid);
+        if (p != f->second.end()) {
+            memcpy(buffer, &p->second[0], PageFile::PAGE_SIZE);
+            return true;
+        }
+    }
+
+    // a page of a part is read back from the log
+    LoggedPages::iterator l = transaction->logged.find(filename);
+    if (l == transaction->logged.end()) return false;
+    map<PageId, off_t>::iterator p = l->second.find(ppid);
+    if (p == l->second.end()) return false;
+    return ::pread(logFd, buffer, PageFile::PAGE_SIZE, p->second) == PageFile::PAGE_SIZE;
+}
+
+bool WriteAheadLog::write(const string &filename, PageId ppid, const void *buffer) {
+    if (transaction == NULL) return false;
+    const char *page = (const char *) buffer;
+    vector<char> &held = transaction->pages[filename][ppid];
+    if (held.empty()) transaction->bytes += PageFile::PAGE_SIZE;
+    held.assign(page, page + PageFile::PAGE_SIZE);
+    if (transaction->bytes >= TRANSACTION_BYTES) spill(*transaction);
+    return true;
+}
+
+PageId WriteAheadLog::fileEnd(const string &filename) {
+    if (transaction == NULL) return 0;
+    PageId end = 0;
+    Pages::iterator f = transaction->pages.find(filename);
+    if (f != transaction->pages.end() && !f->second.empty()) end = f->second.rbegin()->first + 1;
+    LoggedPages::iterator l = transaction->logged.find(filename);
+    if (l != transaction->logged.end() && !l->second.empty()) end = max(end, l->second.rbegin()->first + 1);
+    return end;
+}
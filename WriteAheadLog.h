@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef WRITEAHEADLOG_H
+#define WRITEAHEADLOG_H
+
+#include <string>
+#include "Bruinbase.h"
+#include "PageFile.h"
+
+/**
+ * The write-ahead log makes the page writes of a transaction, e.g., a LOAD,
+ * durable and atomic. Between begin() and commit(), PageFile holds the
+ * pages a thread writes in its transaction instead of writing them to their
+ * files. commit() appends the pages to the log as one record, waits until
+ * the record is on disk and only then writes the pages to their files, as
+ * one version of them that readers see all at once.
+ * After a crash, open() writes the pages of the records in the log to the
+ * files again, so a transaction is either in the files as a whole or not at
+ * all. A torn record at the end of the log is an uncommitted transaction.
+ *
+ * A transaction keeps at most 16MB of pages in memory. Beyond that, it
+ * appends them to the log as a part record and reads them back from there,
+ * and commit() ends it with a commit record. Recovery redoes the parts of
+ * a transaction only if its commit record made it to the log.
+ *
+ * Group commit: the threads committing at the same time append their
+ * records to one buffer, and one of them writes the buffer and syncs the
+ * log for all, so many transactions share one fsync.
+ *
+ * The pages are physical pages of the files, written as they are, so
+ * writing them again during recovery is harmless. The files are not synced
+ * on commit. A thread takes a fuzzy checkpoint every 30 seconds, or sooner
+ * once the log has grown by 64MB: it syncs the files written since the last
+ * one while transactions go on, and logs where recovery starts from now on.
+ * The log is emptied when nothing was logged meanwhile. close() syncs the
+ * files and empties the log.
+ */
+class WriteAheadLog {
+public:
+
+    /**
+     * open the log, redo the transactions in it and empty it.
+     * without an open log, transactions write their pages right away.
+     * @param filename[IN] the log file name
+     * @return error code. 0 if no error
+     */
+    static RC open(const std::string &filename);
+
+    /**
+     * sync the files the committed transactions wrote and empty the log.
+     * @return error code. 0 if no error
+     */
+    static RC close();
+
+    /**
+     * sync the files the committed transactions wrote, so that recovery
+     * need not redo them. transactions may commit meanwhile.
+     * @return error code. 0 if no error
+     */
+    static RC checkpoint();
+
+    /**
+     * begin a transaction in this thread. no-op if the log is not open.
+     * a transaction begun in a transaction is part of it, and its commit()
+     * only ends the inner one.
+     */
+    static void begin();
+
+    /**
+     * make the pages of the transaction of this thread durable and write
+     * them to their files.
+     * @return error code. 0 if no error. on an error, the pages are dropped
+     */
+    static RC commit();
+
+    /**
+     * drop the pages of the transaction of this thread, so that none of
+     * them reach their files. a transaction it was begun in is dropped, too.
+     */
+    static void abort();
+
+    /**
+     * the page of the file the transaction of this thread wrote. called by PageFile.
+     * @param filename[IN] the file name
+     * @param ppid[IN] the physical page
+     * @param buffer[OUT] the page. untouched if the transaction did not write it
+     * @return true if the transaction wrote the page
+     */
+    static bool read(const std::string &filename, PageId ppid, void *buffer);
+
+    /**
+     * hold a page in the transaction of this thread. called by PageFile.
+     * @param filename[IN] the file name
+     * @param ppid[IN] the physical page
+     * @param buffer[IN] the page
+     * @return true if the page is held. false if there is no transaction
+     */
+    static bool write(const std::string &filename, PageId ppid, const void *buffer);
+
+    /**
+     * @param filename[IN] the file name
+     * @return # physical pages of the file counting the pages held by the
+     * transaction of this thread. 0 if it holds none
+     */
+    static PageId fileEnd(const std::string &filename);
+};
+
+#endif /* WRITEAHEADLOG_H */
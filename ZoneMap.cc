@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <cstring>
+#include <algorithm>
+#include "Bruinbase.h"
+#include "ZoneMap.h"
+
+using std::string;
+
+// copy the first VALUE_PREFIX bytes of value into a zone bound
+static void setBound(char bound[ZoneMap::VALUE_PREFIX], const string &value) {
+    memset(bound, 0, ZoneMap::VALUE_PREFIX);
+    memcpy(bound, value.data(), std::min<size_t>(value.size(), ZoneMap::VALUE_PREFIX));
+}
+
+ZoneMap::ZoneMap() : mode('r'), firstDirty(0) {
+}
+
+RC ZoneMap::open(const string &filename, char mode) {
+    RC rc;
+    char page[PageFile::PAGE_SIZE];
+
+    if ((rc = pf.open(filename, mode)) < 0) return rc;
+    this->mode = mode;
+    zones.clear();
+
+    for (PageId pid = 0; pid < pf.endPid(); pid++) {
+        if ((rc = pf.read(pid, page)) < 0) {
+            pf.close();
+            return rc;
+        }
+        int count;
+        memcpy(&count, page, sizeof(int));
+        const Zone *z = (const Zone *) (page + sizeof(int));
+        zones.insert(zones.end(), z, z + count);
+    }
+    firstDirty = (PageId) zones.size();
+    return 0;
+}
+
+RC ZoneMap::close() {
+    RC rc;
+    char page[PageFile::PAGE_SIZE];
+
+    if (mode == 'w') {
+        // rewrite the zone map pages from the one with the first changed zone
+        for (int first = firstDirty - firstDirty % ZONES_PER_PAGE; first < (int) zones.size(); first += ZONES_PER_PAGE) {
+            int count = (int) zones.size() - first;
+            if (count > ZONES_PER_PAGE) count = ZONES_PER_PAGE;
+            memset(page, 0, PageFile::PAGE_SIZE);
+            memcpy(page, &count, sizeof(int));
+            memcpy(page + sizeof(int), &zones[first], count * sizeof(Zone));
+            if ((rc = pf.write(first / ZONES_PER_PAGE, page)) < 0) return rc;
+        }
+    }
+    zones.clear();
+    return pf.close();
+}
+
+RC ZoneMap::add(const RecordId &rid, int key, const string &value) {
+    if (rid.pid > (PageId) zones.size()) return RC_INVALID_PID;
+
+    if (rid.pid == (PageId) zones.size()) {
+        Zone z;
+        z.minKey = z.maxKey = key;
+        setBound(z.minValue, value);
+        setBound(z.maxValue, value);
+        zones.push_back(z);
+    } else {
+        Zone &z = zones[rid.pid];
+        if (key < z.minKey) z.minKey = key;
+        if (key > z.maxKey) z.maxKey = key;
+        if (value < toString(z.minValue)) setBound(z.minValue, value);
+        if (value.substr(0, VALUE_PREFIX) > toString(z.maxValue)) setBound(z.maxValue, value);
+    }
+    if (rid.pid < firstDirty) firstDirty = rid.pid;
+    return 0;
+}
+
+RC ZoneMap::update(const RecordFile &rf) {
+    RC rc;
+    RecordId rid;
+    int key;
+    string value;
+
+    for (rid.pid = getPageCount(), rid.sid = 0; rid < rf.endRid(); ++rid) {
+        if ((rc = rf.read(rid, key, value)) < 0) return rc;
+        if ((rc = add(rid, key, value)) < 0) return rc;
+    }
+    return 0;
+}
+
+bool ZoneMap::getZone(PageId pid, Zone &zone) const {
+    if (pid < 0 || pid >= (PageId) zones.size()) return false;
+    zone = zones[pid];
+    return true;
+}
+
+string ZoneMap::toString(const char bound[VALUE_PREFIX]) {
+    return string(bound, strnlen(bound, VALUE_PREFIX));
+}
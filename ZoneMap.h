@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef ZONEMAP_H
+#define ZONEMAP_H
+
+#include <string>
+#include <vector>
+#include "Bruinbase.h"
+#include "PageFile.h"
+#include "RecordFile.h"
+
+/**
+ * The key and value ranges of every page of a RecordFile, kept in a
+ * side file next to the table. A scan looks up the zone of a page before
+ * reading it and skips the page if no record in the range can match.
+ */
+class ZoneMap {
+public:
+
+    // # leading bytes of the values kept in a zone
+    static const int VALUE_PREFIX = 8;
+
+    /**
+     * the ranges of one table page. the value bounds are prefixes, so
+     * minValue is not larger than any value in the page and maxValue is not
+     * smaller than the first VALUE_PREFIX bytes of any value in the page.
+     */
+    struct Zone {
+        int minKey;
+        int maxKey;
+        char minValue[VALUE_PREFIX];  // not NULL-terminated if VALUE_PREFIX long
+        char maxValue[VALUE_PREFIX];
+    };
+
+    // # zones per page of the zone map file
+    static const int ZONES_PER_PAGE = (PageFile::PAGE_SIZE - sizeof(int)) / sizeof(Zone);
+    // the first four bytes of a page store # zones in the page
+
+    ZoneMap();
+
+    /**
+     * open the zone map file and read all zones into memory.
+     * @param filename[IN] the zone map file name
+     * @param mode[IN] 'r' for read, 'w' for write
+     * @return error code. 0 if no error
+     */
+    RC open(const std::string &filename, char mode);
+
+    /**
+     * write the zones changed since open() and close the file.
+     * @return error code. 0 if no error
+     */
+    RC close();
+
+    /**
+     * @return the # table pages that have a zone
+     */
+    PageId getPageCount() const { return (PageId) zones.size(); }
+
+    /**
+     * widen the zone of the page of rid so that it covers the record.
+     * @param rid[IN] the record id of a record appended to the table
+     * @param key[IN] the key of the record
+     * @param value[IN] the value of the record
+     * @return error code. 0 if no error
+     */
+    RC add(const RecordId &rid, int key, const std::string &value);
+
+    /**
+     * add the records of the table pages that have no zone yet,
+     * e.g., because they were written before the zone map existed.
+     * @param rf[IN] the table file
+     * @return error code. 0 if no error
+     */
+    RC update(const RecordFile &rf);
+
+    /**
+     * @param pid[IN] a table page
+     * @param zone[OUT] the zone of the page
+     * @return false if the page has no zone
+     */
+    bool getZone(PageId pid, Zone &zone) const;
+
+    /**
+     * @param bound[IN] minValue or maxValue of a zone
+     * @return the bound as a string
+     */
+    static std::string toString(const char bound[VALUE_PREFIX]);
+
+private:
+    PageFile pf;
+    char mode;
+    std::vector<Zone> zones;  // the zone of table page i at index i
+    PageId firstDirty;        // the first zone changed since open()
+};
+
+#endif /* ZONEMAP_H */
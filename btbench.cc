@@ -0,0 +1,149 @@
+/**
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+/*
+ * btbench: many threads looking up and inserting keys in one shared
+ * B+tree index. Prints the throughput, and checks the index afterwards.
+ *
+ *   usage: btbench [threads [operations [insert percentage [index file]]]]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "Bruinbase.h"
+#include "BTreeIndex.h"
+
+using namespace std;
+
+static const int PRELOAD = 20000;  // # keys in the index before the threads start
+
+/**
+ * the work of one thread. the thread inserts the keys t, t + threads,
+ * t + 2*threads, ... above PRELOAD, so that no two threads insert the same key,
+ * and looks up keys that are in the index already.
+ */
+static void work(BTreeIndex *index, int t, int threads, int ops, int insertPct,
+                 int *inserted, long long *found) {
+    unsigned int seed = (unsigned int) t * 7919 + 1;
+    int next = PRELOAD + t;
+    *inserted = 0;
+    *found = 0;
+    for (int i = 0; i < ops; i++) {
+        if ((int) (rand_r(&seed) % 100) < insertPct) {
+            RecordId rid;
+            rid.pid = next / RecordFile::RECORDS_PER_PAGE;
+            rid.sid = next % RecordFile::RECORDS_PER_PAGE;
+            if (index->insert(next, rid) == 0) (*inserted)++;
+            next += threads;
+        } else {
+            // a key below PRELOAD is always there
+            int key = rand_r(&seed) % PRELOAD;
+            IndexCursor cursor;
+            if (index->locate(key, cursor) != 0) {
+                fprintf(stderr, "thread %d: key %d not found\n", t, key);
+                continue;
+            }
+            // read a short range behind the key, like a range query would
+            int k;
+            RecordId rid;
+            for (int j = 0; j < 10 && index->readForward(cursor, k, rid) == 0; j++) (*found)++;
+        }
+    }
+}
+
+/**
+ * scan the whole index and check that the keys are in order, and that
+ * every key inserted by the threads can be found.
+ */
+static RC check(BTreeIndex &index, const vector<int> &inserted) {
+    IndexCursor cursor;
+    int key, last = -1, n = 0, count = PRELOAD;
+    RecordId rid;
+    int threads = (int) inserted.size();
+
+    index.locate(0, cursor);
+    while (index.readForward(cursor, key, rid) == 0) {
+        if (key <= last) {
+            fprintf(stderr, "key %d after key %d\n", key, last);
+            return RC_INVALID_ATTRIBUTE;
+        }
+        last = key;
+        n++;
+    }
+    for (int t = 0; t < threads; t++) {
+        count += inserted[t];
+        for (int i = 0; i < inserted[t]; i++) {
+            int k = PRELOAD + t + i * threads;
+            if (index.locate(k, cursor) != 0) {
+                fprintf(stderr, "key %d not found\n", k);
+                return RC_NO_SUCH_RECORD;
+            }
+        }
+    }
+    if (n != count) {
+        fprintf(stderr, "%d keys in the index, %d expected\n", n, count);
+        return RC_INVALID_ATTRIBUTE;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    int ops = argc > 2 ? atoi(argv[2]) : 100000;
+    int insertPct = argc > 3 ? atoi(argv[3]) : 20;
+    string filename = argc > 4 ? argv[4] : "btbench.idx";
+    RC rc;
+
+    if (threads < 1 || ops < 0 || insertPct < 0 || insertPct > 100) {
+        fprintf(stderr, "usage: %s [threads [operations [insert percentage [index file]]]]\n", argv[0]);
+        return 1;
+    }
+
+    unlink(filename.c_str());
+    BTreeIndex index;
+    if ((rc = index.open(filename, 'w')) < 0) {
+        fprintf(stderr, "Error: cannot open %s\n", filename.c_str());
+        return 1;
+    }
+    for (int key = 0; key < PRELOAD; key++) {
+        RecordId rid;
+        rid.pid = key / RecordFile::RECORDS_PER_PAGE;
+        rid.sid = key % RecordFile::RECORDS_PER_PAGE;
+        index.insert(key, rid);
+    }
+
+    // every thread does ops / threads operations
+    vector<thread> pool;
+    vector<int> inserted(threads);
+    vector<long long> found(threads);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int t = 0; t < threads; t++) {
+        pool.push_back(thread(work, &index, t, threads, ops / threads, insertPct, &inserted[t], &found[t]));
+    }
+    for (int t = 0; t < threads; t++) pool[t].join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    int count = 0;
+    long long reads = 0;
+    for (int t = 0; t < threads; t++) {
+        count += inserted[t];
+        reads += found[t];
+    }
+    fprintf(stdout, "%d threads, %d operations, %d%% inserts: %.3f s, %.0f operations/s\n",
+            threads, ops / threads * threads, insertPct, seconds, (ops / threads * threads) / (seconds > 0 ? seconds : 1e-9));
+    fprintf(stdout, "  %d keys inserted, %lld entries read\n", count, reads);
+
+    rc = check(index, inserted);
+    fprintf(stdout, "  index check: %s\n", rc == 0 ? "ok" : "FAILED");
+    index.close();
+    unlink(filename.c_str());
+    return rc == 0 ? 0 : 1;
+}
@@ -0,0 +1,260 @@
+"""
+e2e: end-to-end checks of a Bruinbase binary.
+
+Runs SELECTs with ORDER BY, LIMIT and OFFSET, aggregates, GROUP BY and
+joins on a table with an index and on the same table without one, and
+compares both results with the ones computed here. Then kills a server
+with SIGKILL during and after a LOAD, restarts it, and checks that the
+log recovery left every row of the LOAD in the table or none of them.
+
+  usage: python3 e2e.py [bruinbase binary]
+
+The checks run in a temporary directory. Exits with 1 if a check failed.
+"""
+
+import os
+import random
+import shutil
+import signal
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+BINARY = os.path.abspath(sys.argv[1] if len(sys.argv) > 1 else './bruinbase')
+PROMPT = 'Bruinbase> '
+
+failures = []
+checks = 0
+
+
+def check(name, got, expected):
+    global checks
+    checks += 1
+    if got != expected:
+        failures.append(name)
+        if len(failures) <= 10:
+            if isinstance(got, list):
+                got, expected = got[:10], expected[:10]
+            print('FAILED: %s\n  got      %r\n  expected %r' % (name, got, expected))
+
+
+def write_table(path, rows):
+    with open(path, 'w') as f:
+        for key, value in rows:
+            f.write('%d,"%s"\n' % (key, value))
+
+
+def run_commands(directory, commands):
+    """run the commands on the console and return the output lines of each and the error lines"""
+    p = subprocess.run([BINARY], input=''.join(c + '\n' for c in commands), cwd=directory,
+                       capture_output=True, text=True)
+    parts = p.stdout.split(PROMPT)[1:]
+    outputs = [part.splitlines() for part in parts[:len(commands)]]
+    errors = [line for line in p.stderr.splitlines() if line.startswith('Error')]
+    return outputs, errors
+
+
+#
+# the results of SELECTs, compared with the ones computed here
+#
+
+def check_queries(directory):
+    rng = random.Random(7)
+    n = 2000
+    keys = list(range(n))
+    rng.shuffle(keys)
+    rows = [(k, 'v%d' % (k % 37)) for k in keys]
+    value = dict(rows)
+    joined = [(k, 'w%d' % k) for k in range(0, n, 3)]
+    write_table(os.path.join(directory, 'a.del'), rows)
+    write_table(os.path.join(directory, 'b.del'), joined)
+
+    commands = ["LOAD t FROM 'a.del' WITH INDEX", "LOAD s FROM 'a.del'", "LOAD b FROM 'b.del'"]
+    cases = []   # (name, command, expected lines, compare sorted)
+
+    def add(name, query, expected, unordered=False):
+        for table in ('t', 's'):
+            cases.append(('%s on %s' % (name, table), query.format(t=table), expected, unordered))
+
+    # ORDER BY key with LIMIT and OFFSET
+    for i in range(40):
+        lo = rng.randrange(-10, n)
+        hi = rng.randrange(lo, n + 10)
+        limit = rng.randrange(0, 30)
+        offset = rng.randrange(0, 40)
+        desc = rng.random() < 0.5
+        matching = sorted(k for k in range(n) if lo <= k <= hi)
+        if desc:
+            matching.reverse()
+        page = matching[offset:offset + limit]
+        add('order %d' % i,
+            'SELECT * FROM {t} WHERE key >= %d AND key <= %d ORDER BY key %s LIMIT %d OFFSET %d'
+            % (lo, hi, 'DESC' if desc else 'ASC', limit, offset),
+            ["%d '%s'" % (k, value[k]) for k in page])
+
+    # aggregates take every matching row, whatever the LIMIT and OFFSET
+    for i in range(20):
+        lo = rng.randrange(0, n - 100)
+        offset = rng.randrange(1, 10)
+        matching = [k for k in range(n) if k > lo]
+        values = [value[k] for k in matching]
+        expected = {'COUNT(*)': str(len(matching)), 'SUM(key)': str(sum(matching)),
+                    'MIN(key)': str(min(matching)), 'MAX(key)': str(max(matching)),
+                    'MIN(value)': min(values), 'MAX(value)': max(values)}
+        for aggregate, result in sorted(expected.items()):
+            add('%s %d' % (aggregate, i),
+                'SELECT %s FROM {t} WHERE key > %d LIMIT 1 OFFSET %d' % (aggregate, lo, offset), [result])
+
+    # GROUP BY
+    for i in range(10):
+        hi = rng.randrange(0, n)
+        groups = {}
+        for k in range(0, hi):
+            count, total = groups.get(value[k], (0, 0))
+            groups[value[k]] = (count + 1, total + k)
+        add('group count %d' % i, 'SELECT value, COUNT(*) FROM {t} WHERE key < %d GROUP BY value' % hi,
+            sorted("'%s' %d" % (v, g[0]) for v, g in groups.items()), True)
+        add('group sum %d' % i, 'SELECT value, SUM(key) FROM {t} WHERE key < %d GROUP BY value' % hi,
+            sorted("'%s' %d" % (v, g[1]) for v, g in groups.items()), True)
+    add('group by key', 'SELECT key, COUNT(*) FROM {t} WHERE key >= 10 AND key < 20 GROUP BY key',
+        ['%d 1' % k for k in range(10, 20)], True)
+
+    # joins
+    for i in range(10):
+        hi = rng.randrange(0, n)
+        pairs = [(k, w) for k, w in joined if k < hi]
+        add('join %d' % i, 'SELECT * FROM {t}, b WHERE {t}.key = b.key AND b.key < %d' % hi,
+            sorted("%d '%s' '%s'" % (k, value[k], w) for k, w in pairs), True)
+        add('join count %d' % i, 'SELECT COUNT(*) FROM {t}, b WHERE {t}.key = b.key AND {t}.key < %d' % hi,
+            [str(len(pairs))])
+
+    # an empty result prints the same whichever way the engine finds it empty
+    add('contradiction', 'SELECT COUNT(*) FROM {t} WHERE key = 1 AND key = 2', ['0'])
+
+    # the commands that are errors print nothing
+    bad = ['SELECT value, COUNT(*) FROM {t} GROUP BY value ORDER BY value DESC',
+           'SELECT * FROM {t}, b WHERE {t}.key = zzz.key',
+           'SELECT * FROM {t}, b WHERE zzz.key = b.key']
+    for i, query in enumerate(bad):
+        add('error %d' % i, query, [])
+
+    outputs, errors = run_commands(directory, commands + [c[1] for c in cases])
+    outputs = outputs[len(commands):]
+    if len(outputs) < len(cases):
+        check('queries ran', len(outputs), len(cases))
+        return
+    for (name, query, expected, unordered), got in zip(cases, outputs):
+        check(name, sorted(got) if unordered else got, expected)
+    check('errors', len(errors), 2 * len(bad))
+
+
+#
+# recovery from the write-ahead log
+#
+
+class Server:
+    def __init__(self, directory):
+        self.directory = directory
+        self.path = os.path.join(directory, 's.sock')
+        if os.path.exists(self.path):
+            os.unlink(self.path)
+        self.process = subprocess.Popen([BINARY, '-u', self.path, '-w', '2'], cwd=directory,
+                                        stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        # the recovery runs before the server listens
+        for i in range(200):
+            try:
+                self.connect().close()
+                return
+            except OSError:
+                time.sleep(0.05)
+        raise RuntimeError('the server did not start')
+
+    def connect(self):
+        s = socket.socket(socket.AF_UNIX)
+        s.connect(self.path)
+        return s
+
+    def run(self, commands):
+        """send the commands, wait until they have all run and return the output"""
+        s = self.connect()
+        s.sendall(''.join(c + '\n' for c in commands).encode())
+        s.shutdown(socket.SHUT_WR)
+        data = []
+        while True:
+            chunk = s.recv(65536)
+            if not chunk:
+                break
+            data.append(chunk)
+        s.close()
+        return b''.join(data).decode()
+
+    def count(self, table):
+        """the # rows through the index and through a table scan"""
+        out = self.run(['SELECT COUNT(*) FROM %s' % table,
+                        "SELECT COUNT(*) FROM %s WHERE value <> 'none'" % table])
+        lines = [line for line in out.split(PROMPT) if line.strip()]
+        return [int(line.split('\n')[0]) for line in lines]
+
+    def kill(self):
+        self.process.send_signal(signal.SIGKILL)
+        self.process.wait()
+
+    def stop(self):
+        self.process.terminate()
+        self.process.wait()
+
+
+def check_recovery(directory):
+    base, big = 2000, 200000
+    write_table(os.path.join(directory, 'base.del'), [(k, 'b%d' % k) for k in range(base)])
+    write_table(os.path.join(directory, 'big.del'), [(k, 'g%d' % k) for k in range(base, base + big)])
+
+    # a crash during the LOAD
+    for delay in (0.05, 0.1, 0.2, 0.3, 0.4, 0.5, 1.0):
+        for name in os.listdir(directory):
+            if not name.endswith('.del'):
+                os.unlink(os.path.join(directory, name))
+        server = Server(directory)
+        server.run(["LOAD t FROM 'base.del' WITH INDEX"])
+        loader = threading.Thread(target=lambda: server.run(["LOAD t FROM 'big.del' WITH INDEX"]))
+        loader.start()
+        time.sleep(delay)
+        server.kill()
+        loader.join()
+        server = Server(directory)
+        counts = server.count('t')
+        check('crash after %.2fs: all rows or none' % delay,
+              counts in ([base, base], [base + big, base + big]), True)
+        server.stop()
+
+    # a crash after the LOAD committed, before the files were synced
+    server = Server(directory)
+    server.run(["LOAD t FROM 'big.del' WITH INDEX"])
+    before = server.count('t')
+    server.kill()
+    server = Server(directory)
+    check('crash after commit', server.count('t'), before)
+    server.stop()
+
+
+def main():
+    if not os.path.exists(BINARY):
+        print('no binary %s. build it first' % BINARY)
+        return 1
+    directory = tempfile.mkdtemp(prefix='bruinbase-e2e-')
+    try:
+        check_queries(directory)
+        recovery = os.path.join(directory, 'recovery')
+        os.mkdir(recovery)
+        check_recovery(recovery)
+    finally:
+        shutil.rmtree(directory, ignore_errors=True)
+    print('%d checks, %d failed' % (checks, len(failures)))
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,175 @@
+/**
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+/*
+ * loadgen: many clients sending queries to a Bruinbase server at once.
+ * Every client sends a query, waits for its result and sends the next.
+ * Prints the queries per second and the latency percentiles.
+ *
+ *   usage: loadgen (-u socket | -p port) [-c clients] [-n queries] [-k keys] [-q query] [-s setup]
+ *
+ * -q is the query, with %d for a random key in [0, keys). the default is
+ * a point lookup in movie. -s is a command every client sends once before
+ * its queries, e.g., the PREPARE of a query "EXECUTE p(%d)".
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+using namespace std;
+using namespace std::chrono;
+
+static const char PROMPT[] = "Bruinbase> ";
+
+static const char *socketPath = NULL;
+static int port = -1;
+
+// connect to the server. -1 on error
+static int connectServer() {
+    int fd;
+    if (socketPath != NULL) {
+        struct sockaddr_un addr;
+        if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) return -1;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path) - 1);
+        if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+            close(fd);
+            return -1;
+        }
+    } else {
+        struct sockaddr_in addr;
+        if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) return -1;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+// read until the server prints the prompt. false if the server went away
+static bool readResult(int fd) {
+    char buffer[4096];
+    string tail;
+    size_t promptLength = strlen(PROMPT);
+    for (;;) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        // only the end of the result matters
+        tail.append(buffer, n);
+        if (tail.size() > promptLength) tail.erase(0, tail.size() - promptLength);
+        if (tail == PROMPT) return true;
+    }
+}
+
+/**
+ * the work of one client. the latencies of its queries go to latencies,
+ * in microseconds
+ */
+static void client(int c, int queries, int keys, const string &query, const string &setup,
+                   vector<long> *latencies, int *failed) {
+    unsigned int seed = (unsigned int) c * 7919 + 1;
+    char line[1024];
+
+    *failed = 0;
+    int fd = connectServer();
+    string command = setup + "\n";
+    if (fd < 0 || !readResult(fd) ||
+        (!setup.empty() && (send(fd, command.data(), command.size(), MSG_NOSIGNAL) < 0 || !readResult(fd)))) {
+        *failed = queries;
+        if (fd >= 0) close(fd);
+        return;
+    }
+    for (int i = 0; i < queries; i++) {
+        snprintf(line, sizeof(line) - 1, query.c_str(), (int) (rand_r(&seed) % keys));
+        strcat(line, "\n");
+        steady_clock::time_point start = steady_clock::now();
+        if (send(fd, line, strlen(line), MSG_NOSIGNAL) < 0 || !readResult(fd)) {
+            *failed = queries - i;
+            break;
+        }
+        latencies->push_back(duration_cast<microseconds>(steady_clock::now() - start).count());
+    }
+    send(fd, "quit\n", 5, MSG_NOSIGNAL);
+    close(fd);
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "usage: %s (-u socket | -p port) [-c clients] [-n queries] [-k keys] [-q query] [-s setup]\n", program);
+}
+
+int main(int argc, char **argv) {
+    int clients = 8;
+    int queries = 1000;
+    int keys = 1000;
+    string query = "SELECT * FROM movie WHERE key = %d";
+    string setup;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "u:p:c:n:k:q:s:")) != -1) {
+        switch (opt) {
+            case 'u': socketPath = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'c': clients = atoi(optarg); break;
+            case 'n': queries = atoi(optarg); break;
+            case 'k': keys = atoi(optarg); break;
+            case 'q': query = optarg; break;
+            case 's': setup = optarg; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if ((socketPath == NULL) == (port < 0) || clients < 1 || queries < 1 || keys < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // every client sends queries / clients queries
+    vector<thread> pool;
+    vector<vector<long> > latencies(clients);
+    vector<int> failed(clients);
+    steady_clock::time_point start = steady_clock::now();
+    for (int c = 0; c < clients; c++) {
+        pool.push_back(thread(client, c, queries / clients, keys, query, setup, &latencies[c], &failed[c]));
+    }
+    for (int c = 0; c < clients; c++) pool[c].join();
+    double seconds = duration<double>(steady_clock::now() - start).count();
+
+    vector<long> all;
+    int failures = 0;
+    for (int c = 0; c < clients; c++) {
+        all.insert(all.end(), latencies[c].begin(), latencies[c].end());
+        failures += failed[c];
+    }
+    if (all.empty()) {
+        fprintf(stderr, "Error: no query got an answer\n");
+        return 1;
+    }
+    sort(all.begin(), all.end());
+    fprintf(stdout, "%d clients, %d queries in %.3f s: %.0f queries/s\n",
+            clients, (int) all.size(), seconds, all.size() / seconds);
+    fprintf(stdout, "  latency (ms): p50 %.3f, p99 %.3f, max %.3f\n",
+            all[all.size() / 2] / 1000.0, all[all.size() * 99 / 100] / 1000.0, all.back() / 1000.0);
+    if (failures > 0) fprintf(stdout, "  %d queries failed\n", failures);
+    return failures > 0 ? 1 : 0;
+}
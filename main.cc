@@ -9,12 +9,79 @@
 
 #include "Bruinbase.h"
 #include "SqlEngine.h"
+#include "QueryServer.h"
+#include "WriteAheadLog.h"
 #include <cstdio>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
 
+// the write-ahead log of the tables in the current directory
+static const char LOG_FILE[] = "bruinbase.log";
 
-int main() {
-    // run the SQL engine taking user commands from standard input (console).
-    SqlEngine::run(stdin);
+// the tables and pages a restarted engine reads first
+static const char HOT_FILE[] = "bruinbase.hot";
 
-    return 0;
+static QueryServer *server = NULL;
+
+static void stopServer(int) {
+    server->stop();
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "usage: %s [-u socket | -p port] [-w workers]\n", program);
+}
+
+int main(int argc, char **argv) {
+    const char *socketPath = NULL;
+    int port = -1;
+    int workers = 8;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "u:p:w:")) != -1) {
+        switch (opt) {
+            case 'u': socketPath = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'w': workers = atoi(optarg); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+
+    if (workers < 1 || (socketPath != NULL && port >= 0)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // finish the LOADs a crash cut short before anything reads the tables
+    if (WriteAheadLog::open(LOG_FILE) < 0) {
+        fprintf(stderr, "Error: cannot recover from the log %s\n", LOG_FILE);
+        return 1;
+    }
+    SqlEngine::warmUp(HOT_FILE);
+
+    if (socketPath == NULL && port < 0) {
+        // run the SQL engine taking user commands from standard input (console).
+        SqlEngine::run(stdin);
+        SqlEngine::saveHotPages(HOT_FILE);
+        SqlEngine::closeTables();
+        return WriteAheadLog::close() < 0 ? 1 : 0;
+    }
+
+    // serve the clients until SIGINT or SIGTERM
+    server = new QueryServer(workers);
+    RC rc = socketPath != NULL ? server->listenUnix(socketPath) : server->listenTcp(port);
+    if (rc < 0) {
+        fprintf(stderr, "Error: cannot listen on %s\n", socketPath != NULL ? socketPath : "the port");
+        WriteAheadLog::close();
+        return 1;
+    }
+    signal(SIGINT, stopServer);
+    signal(SIGTERM, stopServer);
+    rc = server->serve();
+    SqlEngine::shutdown();
+    SqlEngine::saveHotPages(HOT_FILE);
+    SqlEngine::closeTables();
+    delete server;
+    if (WriteAheadLog::close() < 0) rc = RC_FILE_WRITE_FAILED;
+    return rc < 0 ? 1 : 0;
 }